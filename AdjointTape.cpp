@@ -0,0 +1,89 @@
+#include "AdjointTape.h"
+#include <algorithm>
+
+using namespace std;
+
+AdjointTape::AdjointTape(const Expression *e) :
+    program(e, CompiledExpression::KeepAllSlots),
+    values(program.slotCount()), adjoints(program.slotCount()) {
+}
+
+AdjointTape::AdjointTape(const vector<const Expression *> &outputs) :
+    program(outputs, CompiledExpression::KeepAllSlots),
+    values(program.slotCount()), adjoints(program.slotCount()) {
+}
+
+void AdjointTape::forward(double x) {
+  program.evaluate(x, values.data());
+}
+
+double AdjointTape::backward(int output) {
+  std::fill(adjoints.begin(), adjoints.end(), 0.0);
+  adjoints[program.resultSlots()[output]] = 1;
+  sweep();
+  return adjoints[0];
+}
+
+double AdjointTape::backward(const double *seeds) {
+  std::fill(adjoints.begin(), adjoints.end(), 0.0);
+  const vector<int> &results = program.resultSlots();
+  for (size_t k = 0; k < results.size(); k++)
+    adjoints[results[k]] += seeds[k];
+  sweep();
+  return adjoints[0];
+}
+
+void AdjointTape::sweep() {
+  const double *v = values.data();
+  double *adj = adjoints.data();
+  const double *coef = program.polynomialCoefficients().data();
+  const vector<Instruction> &code = program.instructions();
+  for (auto ins = code.rbegin(); ins != code.rend(); ins++) {
+    double g = adj[ins->dst];
+    if (g == 0)
+      continue;
+    switch (ins->op) {
+      case Instruction::Const:
+        break;
+      case Instruction::Add:
+        adj[ins->a] += g;
+        adj[ins->b] += g;
+        break;
+      case Instruction::Multi:
+        adj[ins->a] += g * v[ins->b];
+        adj[ins->b] += g * v[ins->a];
+        break;
+      case Instruction::Divide:
+        // d(a/b) = da / b - (a/b) db / b
+        adj[ins->a] += g / v[ins->b];
+        adj[ins->b] -= g * v[ins->dst] / v[ins->b];
+        break;
+      case Instruction::Poly: {
+        double t = v[ins->a];
+        double tPowerKMinus1 = 1;
+        double derivative = 0;
+        for (int k = 1; k < ins->n; k++) {
+          derivative += k * coef[ins->b + k] * tPowerKMinus1;
+          tPowerKMinus1 *= t;
+        }
+        adj[ins->a] += g * derivative;
+        break;
+      }
+      case Instruction::Sin:
+        adj[ins->a] += g * cos(v[ins->a]);
+        break;
+      case Instruction::Cos:
+        adj[ins->a] -= g * sin(v[ins->a]);
+        break;
+      case Instruction::Tan:
+        adj[ins->a] += g * (1 + v[ins->dst] * v[ins->dst]);
+        break;
+      case Instruction::Exp:
+        adj[ins->a] += g * v[ins->dst];
+        break;
+      case Instruction::Log:
+        adj[ins->a] += g / v[ins->a];
+        break;
+    }
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef ADJOINTTAPE_H
+#define ADJOINTTAPE_H
+
+#include "CompiledExpression.h"
+
+// Reverse mode automatic differentiation.
+// The outputs are recorded once into a CompiledExpression keeping all of
+// its slots, subexpressions shared by several outputs are recorded once.
+// forward() evaluates the tape and keeps every intermediate value,
+// backward() then propagates adjoints from the outputs down to x in a
+// single sweep, whatever the number of outputs. The value and adjoint
+// buffers belong to the tape and are reused by every call, so a tape must
+// not be shared between threads.
+class AdjointTape {
+  CompiledExpression program;
+  std::vector<double> values;
+  std::vector<double> adjoints;
+
+  void sweep();
+ public:
+  explicit AdjointTape(const Expression *e);
+  explicit AdjointTape(const std::vector<const Expression *> &outputs);
+
+  int outputCount() const { return program.resultSlots().size(); }
+
+  // evaluates every output at x
+  void forward(double x);
+
+  // value of an output at the last forward()
+  double value(int output = 0) const { return values[program.resultSlots()[output]]; }
+
+  // d output / dx at the last forward()
+  double backward(int output = 0);
+  // sum of seeds[k] * d output_k / dx, seeds holds outputCount() weights
+  double backward(const double *seeds);
+
+  // d (seeded outputs) / d slot after the last backward(), the sensitivity
+  // of the outputs to each intermediate value of the tape
+  double adjoint(int slot) const { return adjoints[slot]; }
+
+  const CompiledExpression &tape() const { return program; }
+};
+
+#endif // ADJOINTTAPE_H
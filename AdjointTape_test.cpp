@@ -0,0 +1,56 @@
+#include "catch.hpp"
+#include <cmath>
+#include <vector>
+#include "function.h"
+#include "ExpressionEvaluator.h"
+#include "AdjointTape.h"
+using namespace std;
+
+TEST_CASE("AdjointTape derivatives match forward mode", "[adjoint]") {
+  const char *corpus[] = {
+      "1", "x", "2-x", "x*x", "x+x*x", "2*x*x*x-x/3", "x*sin(x)", "sin(x)/x", "log(x)",
+      "tan(x)", "cos(x)*exp(x)", "sin(cos(x))", "exp(sin(x)*x)-log(x+2)",
+      "(2/x)/(sin(x)/exp(x))", "tan(x*x)/(1+x*x)"
+  };
+  ExpressionEvaluator evaluator;
+  for (auto s : corpus) {
+    Expression *e = evaluator.evaluate(s);
+    AdjointTape tape(e);
+    for (double x = 0.15; x < 3; x += 0.35) {
+      Dual expected = (*e)(Dual(x, 1));
+      tape.forward(x);
+      REQUIRE(tape.value() == Approx(expected.value));
+      REQUIRE(tape.backward() == Approx(expected.derivative));
+    }
+    delete e;
+  }
+}
+
+TEST_CASE("AdjointTape with several outputs", "[adjoint]") {
+  ExpressionEvaluator evaluator;
+  Expression *f = evaluator.evaluate("exp(sin(x)*x)+x");
+  Expression *g = evaluator.evaluate("exp(sin(x)*x)*cos(x)");
+  vector<const Expression *> outputs;
+  outputs.push_back(f);
+  outputs.push_back(g);
+  AdjointTape tape(outputs);
+  REQUIRE(tape.outputCount() == 2);
+  // exp(sin(x)*x) is recorded once
+  CompiledExpression separateF(f, CompiledExpression::KeepAllSlots);
+  CompiledExpression separateG(g, CompiledExpression::KeepAllSlots);
+  REQUIRE(tape.tape().instructions().size() <
+              separateF.instructions().size() + separateG.instructions().size());
+  for (double x = -1; x < 1; x += 0.3) {
+    Dual df = (*f)(Dual(x, 1));
+    Dual dg = (*g)(Dual(x, 1));
+    tape.forward(x);
+    REQUIRE(tape.value(0) == Approx(df.value));
+    REQUIRE(tape.value(1) == Approx(dg.value));
+    REQUIRE(tape.backward(0) == Approx(df.derivative));
+    REQUIRE(tape.backward(1) == Approx(dg.derivative));
+    double seeds[] = {2, -3};
+    REQUIRE(tape.backward(seeds) == Approx(2 * df.derivative - 3 * dg.derivative));
+  }
+  delete f;
+  delete g;
+}
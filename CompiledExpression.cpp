@@ -0,0 +1,318 @@
+#include "CompiledExpression.h"
+#include "VectorKernels.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+// outs[j][i] = the value of slot results[j] at xs[i]; rows is grown to
+// the size needed and may be passed again to the next call
+void evaluateBlocks(const ProgramView &p, const double *xs, const int *results,
+                    double *const *outs, size_t outputs, size_t n, const VectorKernels &k,
+                    vector<double> &rows) {
+  const size_t BatchSize = 64;
+  // one row of BatchSize lanes per slot, row 0 is only used for the padded
+  // last block, otherwise x is read directly from xs
+  if (rows.size() < p.slots * BatchSize)
+    rows.resize(p.slots * BatchSize);
+  const double *coef = p.coefficients;
+  for (size_t i = 0; i < n; i += BatchSize) {
+    size_t m = min(BatchSize, n - i);
+    const double *x = xs + i;
+    if (m < BatchSize) {
+      std::copy(x, x + m, rows.begin());
+      std::fill(rows.begin() + m, rows.begin() + BatchSize, x[m - 1]);
+      x = rows.data();
+    }
+    for (const Instruction *ins = p.code, *end = ins + p.codeSize; ins != end; ins++) {
+      double *dst = rows.data() + ins->dst * BatchSize;
+      // operand rows only for the operands read as slots: Const has none,
+      // b of Poly is an offset into the coefficients
+      const double *a = NULL, *b = NULL;
+      if (ins->op != Instruction::Const)
+        a = ins->a == 0 ? x : rows.data() + ins->a * BatchSize;
+      if (ins->op >= Instruction::Add && ins->op <= Instruction::Divide)
+        b = ins->b == 0 ? x : rows.data() + ins->b * BatchSize;
+      switch (ins->op) {
+        case Instruction::Const:
+          std::fill(dst, dst + BatchSize, ins->value);
+          break;
+        case Instruction::Add:
+          k.add(a, b, dst, BatchSize);
+          break;
+        case Instruction::Multi:
+          k.multi(a, b, dst, BatchSize);
+          break;
+        case Instruction::Divide:
+          k.divide(a, b, dst, BatchSize);
+          break;
+        case Instruction::Poly:
+          k.poly(a, coef + ins->b, ins->n, dst, BatchSize);
+          break;
+        case Instruction::Sin:
+          k.sin(a, dst, BatchSize);
+          break;
+        case Instruction::Cos:
+          k.cos(a, dst, BatchSize);
+          break;
+        case Instruction::Tan:
+          k.tan(a, dst, BatchSize);
+          break;
+        case Instruction::Exp:
+          k.exp(a, dst, BatchSize);
+          break;
+        case Instruction::Log:
+          k.log(a, dst, BatchSize);
+          break;
+      }
+    }
+    for (size_t j = 0; j < outputs; j++) {
+      const double *r = results[j] == 0 ? x : rows.data() + results[j] * BatchSize;
+      memmove(outs[j] + i, r, m * sizeof(double));
+    }
+  }
+}
+
+} // namespace
+
+CompiledExpression::CompiledExpression(const Expression *e, SlotPolicy policy) :
+    policy(policy), slots(1) {
+  if (!e) throw invalid_argument("null expression in CompiledExpression");
+  results.push_back(lower(e, 0));
+  emitted.clear();
+}
+
+CompiledExpression::CompiledExpression(const vector<const Expression *> &outputs, SlotPolicy policy) :
+    policy(policy), slots(1) {
+  if (outputs.empty()) throw invalid_argument("no expression in CompiledExpression");
+  for (auto e : outputs) {
+    if (!e) throw invalid_argument("null expression in CompiledExpression");
+    // results are never released, later outputs can't overwrite them
+    results.push_back(lower(e, 0));
+  }
+  emitted.clear();
+}
+
+bool CompiledExpression::InstructionKey::operator<(const InstructionKey &other) const {
+  if (op != other.op) return op < other.op;
+  if (a != other.a) return a < other.a;
+  if (b != other.b) return b < other.b;
+  // compare the bits, so that -0 and 0 or two NaNs are told apart correctly
+  if (memcmp(&value, &other.value, sizeof(double)) != 0)
+    return memcmp(&value, &other.value, sizeof(double)) < 0;
+  return coefficients < other.coefficients;
+}
+
+int CompiledExpression::newSlot() {
+  if (!freeSlots.empty()) {
+    int slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slot;
+  }
+  return slots++;
+}
+
+void CompiledExpression::releaseSlot(int slot, int xSlot) {
+  // the x of the enclosing composition stays alive until that composition
+  // is done, everything else is used exactly once
+  if (policy == RecycleSlots && slot != xSlot && slot != 0)
+    freeSlots.push_back(slot);
+}
+
+int CompiledExpression::emit(Instruction::OpCode op, int a, int b, int xSlot,
+                             double value, const vector<double> *para) {
+  if (policy == KeepAllSlots) {
+    InstructionKey key;
+    key.op = op;
+    key.a = a;
+    key.b = b;
+    key.value = value;
+    if (para) key.coefficients = *para;
+    auto found = emitted.find(key);
+    if (found != emitted.end())
+      return found->second;
+    emitted[key] = slots;
+  }
+  if (a >= 0) releaseSlot(a, xSlot);
+  if (b >= 0 && b != a) releaseSlot(b, xSlot);
+  Instruction ins;
+  ins.op = op;
+  ins.dst = newSlot();
+  ins.a = a;
+  ins.b = b;
+  ins.n = 0;
+  ins.value = value;
+  if (para) {
+    ins.b = coefficients.size();
+    ins.n = para->size();
+    coefficients.insert(coefficients.end(), para->begin(), para->end());
+  }
+  code.push_back(ins);
+  return ins.dst;
+}
+
+// returns the slot holding the value of e, either a fresh one owned by the
+// caller or xSlot itself
+int CompiledExpression::lower(const Expression *e, int xSlot) {
+  switch (e->nodeType()) {
+    case Expression::TypeConstant:
+      return emit(Instruction::Const, -1, -1, xSlot, static_cast<const Constant *>(e)->value());
+    case Expression::TypeVariable:
+      return xSlot;
+    case Expression::TypeAdd:
+    case Expression::TypeMulti: {
+      const ExpressionSet &children = static_cast<const CommutativeOperators *>(e)->getChildren();
+      Instruction::OpCode op = e->nodeType() == Expression::TypeAdd ? Instruction::Add : Instruction::Multi;
+      auto it = children.begin();
+      int acc = lower(*it, xSlot);
+      for (it++; it != children.end(); it++) {
+        int next = lower(*it, xSlot);
+        acc = emit(op, acc, next, xSlot);
+      }
+      return acc;
+    }
+    case Expression::TypeDivide: {
+      const Division *p = static_cast<const Division *>(e);
+      int a = lower(p->getNumerator(), xSlot);
+      int b = lower(p->getDenominator(), xSlot);
+      return emit(Instruction::Divide, a, b, xSlot);
+    }
+    case Expression::TypeCompo: {
+      const Composition *p = static_cast<const Composition *>(e);
+      int inner = lower(p->getRight(), xSlot);
+      int outer = lower(p->getLeft(), inner);
+      if (outer != inner)
+        releaseSlot(inner, xSlot);
+      return outer;
+    }
+    case Expression::TypePoly: {
+      vector<double> para = static_cast<const Polynomial *>(e)->getParameter();
+      return emit(Instruction::Poly, xSlot, -1, xSlot, 0, &para);
+    }
+    case Expression::TypeTrigo:
+      switch (static_cast<const Trigo *>(e)->getTrigoType()) {
+        case Trigo::Sin:
+          return emit(Instruction::Sin, xSlot, -1, xSlot);
+        case Trigo::Cos:
+          return emit(Instruction::Cos, xSlot, -1, xSlot);
+        case Trigo::Tan:
+          return emit(Instruction::Tan, xSlot, -1, xSlot);
+      }
+      break;
+    case Expression::TypeExp:
+      return emit(Instruction::Exp, xSlot, -1, xSlot);
+    case Expression::TypeLog:
+      return emit(Instruction::Log, xSlot, -1, xSlot);
+    default:
+      break;
+  }
+  throw invalid_argument("node type not supported by CompiledExpression");
+}
+
+ProgramView CompiledExpression::view() const {
+  ProgramView v;
+  v.code = code.data();
+  v.codeSize = code.size();
+  v.coefficients = coefficients.data();
+  v.slots = slots;
+  v.result = results[0];
+  return v;
+}
+
+double CompiledExpression::operator()(double x) const {
+  return view()(x);
+}
+
+double CompiledExpression::evaluate(double x, double *slotBuffer) const {
+  return view().evaluate(x, slotBuffer);
+}
+
+void CompiledExpression::evaluate(const double *xs, double *out, size_t n) const {
+  view().evaluate(xs, out, n, vectorKernels());
+}
+
+void CompiledExpression::evaluate(const double *xs, double *out, size_t n,
+                                  const VectorKernels &k) const {
+  view().evaluate(xs, out, n, k);
+}
+
+void CompiledExpression::evaluate(const double *xs, double *const *outputs, size_t n) const {
+  vector<double> rows;
+  evaluate(xs, outputs, n, rows);
+}
+
+void CompiledExpression::evaluate(const double *xs, double *const *outputs, size_t n,
+                                  vector<double> &scratch) const {
+  evaluateBlocks(view(), xs, results.data(), outputs, results.size(), n, vectorKernels(),
+                 scratch);
+}
+
+double ProgramView::operator()(double x) const {
+  double buffer[64];
+  if (slots <= 64)
+    return evaluate(x, buffer);
+  vector<double> heapBuffer(slots);
+  return evaluate(x, heapBuffer.data());
+}
+
+double ProgramView::evaluate(double x, double *r) const {
+  r[0] = x;
+  const double *coef = coefficients;
+  for (const Instruction *ins = code, *end = ins + codeSize; ins != end; ins++) {
+    switch (ins->op) {
+      case Instruction::Const:
+        r[ins->dst] = ins->value;
+        break;
+      case Instruction::Add:
+        r[ins->dst] = r[ins->a] + r[ins->b];
+        break;
+      case Instruction::Multi:
+        r[ins->dst] = r[ins->a] * r[ins->b];
+        break;
+      case Instruction::Divide:
+        r[ins->dst] = r[ins->a] / r[ins->b];
+        break;
+      case Instruction::Poly: {
+        // same summation order as Polynomial::operator()
+        double t = r[ins->a];
+        double xPowerK = 1;
+        double sum = 0;
+        for (const double *c = coef + ins->b, *cend = c + ins->n; c != cend; c++) {
+          sum += (*c) * xPowerK;
+          xPowerK *= t;
+        }
+        r[ins->dst] = sum;
+        break;
+      }
+      case Instruction::Sin:
+        r[ins->dst] = sin(r[ins->a]);
+        break;
+      case Instruction::Cos:
+        r[ins->dst] = cos(r[ins->a]);
+        break;
+      case Instruction::Tan:
+        r[ins->dst] = tan(r[ins->a]);
+        break;
+      case Instruction::Exp:
+        r[ins->dst] = exp(r[ins->a]);
+        break;
+      case Instruction::Log:
+        r[ins->dst] = log(r[ins->a]);
+        break;
+    }
+  }
+  return r[result];
+}
+
+void ProgramView::evaluate(const double *xs, double *out, size_t n) const {
+  evaluate(xs, out, n, vectorKernels());
+}
+
+void ProgramView::evaluate(const double *xs, double *out, size_t n,
+                           const VectorKernels &k) const {
+  vector<double> rows;
+  evaluateBlocks(*this, xs, &result, &out, 1, n, k, rows);
+}
@@ -0,0 +1,124 @@
+#ifndef COMPILEDEXPRESSION_H
+#define COMPILEDEXPRESSION_H
+
+#include "function.h"
+#include <map>
+#include <vector>
+
+struct VectorKernels;
+
+// One step of a compiled expression. Each instruction reads its operands
+// from slots and writes its result into slot dst.
+struct Instruction {
+  enum OpCode {
+    Const,   // dst = value
+    Add,     // dst = a + b
+    Multi,   // dst = a * b
+    Divide,  // dst = a / b
+    Poly,    // dst = sum of coefficients[b + k] * a^k, k < n
+    Sin,     // dst = sin(a)
+    Cos,     // dst = cos(a)
+    Tan,     // dst = tan(a)
+    Exp,     // dst = exp(a)
+    Log      // dst = log(a)
+  };
+  OpCode op;
+  int dst;
+  int a, b;
+  int n;
+  double value;
+};
+
+// Non-owning view of a compiled program: the instruction and coefficient
+// arrays stay where they are, in a CompiledExpression or in a mapped
+// ProgramFile. This is the interpreter of CompiledExpression.
+struct ProgramView {
+  const Instruction *code;
+  size_t codeSize;
+  const double *coefficients;
+  int slots;
+  int result;
+
+  double operator()(double x) const;
+  // slotBuffer must hold at least slots doubles
+  double evaluate(double x, double *slotBuffer) const;
+  // see CompiledExpression::evaluate
+  void evaluate(const double *xs, double *out, size_t n) const;
+  void evaluate(const double *xs, double *out, size_t n, const VectorKernels &kernels) const;
+};
+
+// Flat form of an Expression tree, evaluated by a loop over a contiguous
+// instruction array instead of virtual calls through the tree.
+// Instructions are emitted in post-order, the same order as the reverse
+// polish notation of ExpressionEvaluator. Slot 0 always holds x.
+// With RecycleSlots, slots are reused as soon as their value has been
+// consumed, so the number of slots grows with the depth of the tree, not
+// its size. With KeepAllSlots every instruction keeps its own slot, so the
+// whole evaluation can be inspected afterwards, and identical instructions
+// are emitted only once, so subexpressions shared by the outputs are
+// computed once.
+class CompiledExpression {
+ public:
+  enum SlotPolicy {
+    RecycleSlots,
+    KeepAllSlots
+  };
+ private:
+  struct InstructionKey {
+    int op, a, b;
+    double value;
+    std::vector<double> coefficients;
+    bool operator<(const InstructionKey &other) const;
+  };
+
+  SlotPolicy policy;
+  std::vector<Instruction> code;
+  std::vector<double> coefficients;
+  int slots;
+  std::vector<int> results;
+  std::vector<int> freeSlots;
+  std::map<InstructionKey, int> emitted;
+
+  int newSlot();
+  void releaseSlot(int slot, int xSlot);
+  int emit(Instruction::OpCode op, int a, int b, int xSlot,
+           double value = 0, const std::vector<double> *para = NULL);
+  int lower(const Expression *e, int xSlot);
+ public:
+  explicit CompiledExpression(const Expression *e, SlotPolicy policy = RecycleSlots);
+  // several outputs sharing one instruction array, the single value
+  // evaluations below compute the first one
+  explicit CompiledExpression(const std::vector<const Expression *> &outputs,
+                              SlotPolicy policy = RecycleSlots);
+
+  double operator()(double x) const;
+  // slotBuffer must hold at least slotCount() doubles
+  double evaluate(double x, double *slotBuffer) const;
+  // out[i] = f(xs[i]) for i < n, out may be the same array as xs.
+  // Lanes are evaluated by blocks, one instruction at a time over the whole
+  // block, with the fastest kernels supported by the host.
+  void evaluate(const double *xs, double *out, size_t n) const;
+  void evaluate(const double *xs, double *out, size_t n, const VectorKernels &kernels) const;
+  // outputs[k][i] = output k at xs[i] for every output, in one pass; the
+  // output arrays must not overlap xs
+  void evaluate(const double *xs, double *const *outputs, size_t n) const;
+  // the same with the block rows kept in scratch, which is grown as needed;
+  // a caller evaluating repeatedly passes the same vector to each call
+  void evaluate(const double *xs, double *const *outputs, size_t n,
+                std::vector<double> &scratch) const;
+
+  // valid as long as this CompiledExpression, evaluates the first output
+  ProgramView view() const;
+
+  int slotCount() const { return slots; }
+
+  int resultSlot() const { return results[0]; }
+
+  const std::vector<int> &resultSlots() const { return results; }
+
+  const std::vector<Instruction> &instructions() const { return code; }
+
+  const std::vector<double> &polynomialCoefficients() const { return coefficients; }
+};
+
+#endif // COMPILEDEXPRESSION_H
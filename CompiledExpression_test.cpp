@@ -0,0 +1,138 @@
+#include "catch.hpp"
+#include <cmath>
+#include <vector>
+#include <string>
+#include "function.h"
+#include "ExpressionEvaluator.h"
+#include "CompiledExpression.h"
+#include "VectorKernels.h"
+using namespace std;
+
+// NaN and infinities compare equal to themselves, finite values approximately
+static bool sameValue(double actual, double expected) {
+  if (std::isnan(expected)) return std::isnan(actual);
+  if (std::isinf(expected)) return actual == expected;
+  return actual == Approx(expected);
+}
+
+TEST_CASE("CompiledExpression matches the tree evaluator", "[compiled]") {
+  const char *corpus[] = {
+      "1", "x", "-x", "1+2-x", "2*x*x+3*x", "(2*x*x+3*x)*x", "1/x/-x/x/x/x",
+      "(2/x)/(sin(x)/exp(x))", "sin(x)/x+cos(x)*x/3", "sin(cos(x))",
+      "exp(sin(x)*x)-log(x+2)", "tan(x)/(1+x*x)", "sin(x)*x*x-sin(x)*x*x*x/x",
+      "log(exp(cos(x*x)+1)*x)"
+  };
+  double xs[] = {-2.5, -0.3, 0.1, 0.7, 1.234, 3.0};
+  ExpressionEvaluator evaluator;
+  for (auto s : corpus) {
+    Expression *e = evaluator.evaluate(s);
+    CompiledExpression c(e);
+    for (double x : xs) {
+      double expected = (*e)(x);
+      if (std::isnan(expected))
+        REQUIRE(std::isnan(c(x)));
+      else
+        REQUIRE(c(x) == expected);
+    }
+    Expression *d = e->diffSimplify();
+    CompiledExpression cd(d);
+    for (double x : xs) {
+      double expected = (*d)(x);
+      if (!std::isnan(expected))
+        REQUIRE(cd(x) == Approx(expected));
+    }
+    delete d;
+    delete e;
+  }
+}
+
+TEST_CASE("CompiledExpression of general compositions", "[compiled]") {
+  // (1+2x+3x^2) o (x + sin(x)), the inner x is reused by both terms
+  vector<double> a;
+  a.push_back(1);
+  a.push_back(2);
+  a.push_back(3);
+  Expression *inner = new Addition(new VariableX, new Trigo(Trigo::Sin));
+  Expression *e = new Composition(new Polynomial(a), inner);
+  // exp o (e o x) * e
+  Expression *f = new Multiplication(new Composition(new Exponential, e->clone()), e);
+  CompiledExpression c(f);
+  for (double x = -3; x < 3; x += 0.25)
+    REQUIRE(c(x) == Approx((*f)(x)));
+  delete f;
+
+  Expression *x = new VariableX;
+  CompiledExpression cx(x);
+  REQUIRE(cx.instructions().empty());
+  REQUIRE(cx(4.5) == 4.5);
+  delete x;
+}
+
+TEST_CASE("CompiledExpression recycles slots", "[compiled]") {
+  ExpressionSet terms;
+  for (int i = 0; i < 200; i++)
+    terms.insert(new Composition(new Trigo(Trigo::Sin), Polynomial::create(i + 1, 0)));
+  Expression *sum = new Addition(terms);
+  CompiledExpression c(sum);
+  REQUIRE(c.slotCount() <= 4);
+  REQUIRE(c(0.3) == Approx((*sum)(0.3)));
+  delete sum;
+}
+
+TEST_CASE("CompiledExpression batch evaluation", "[compiled][batch]") {
+  const char *corpus[] = {
+      "x", "3", "2*x*x+3*x-1", "(2/x)/(sin(x)/exp(x))", "sin(x)/x+cos(x)*x/3",
+      "tan(cos(x))+log(x*x+1)", "exp(-x*x)*(1+x+x*x*x)"
+  };
+  vector<const VectorKernels *> kernels;
+  kernels.push_back(&scalarKernels());
+  if (avx2Kernels())
+    kernels.push_back(avx2Kernels());
+  // not a multiple of the block size, to exercise the padded tail
+  const size_t n = 203;
+  vector<double> xs(n), out(n);
+  for (size_t i = 0; i < n; i++)
+    xs[i] = -5 + 0.05 * i;
+  ExpressionEvaluator evaluator;
+  for (auto s : corpus) {
+    Expression *e = evaluator.evaluate(s);
+    CompiledExpression c(e);
+    for (auto k : kernels) {
+      c.evaluate(xs.data(), out.data(), n, *k);
+      for (size_t i = 0; i < n; i++) {
+        REQUIRE(sameValue(out[i], (*e)(xs[i])));
+      }
+    }
+    // in place
+    vector<double> inPlace = xs;
+    c.evaluate(inPlace.data(), inPlace.data(), n);
+    for (size_t i = 0; i < n; i++)
+      REQUIRE(sameValue(inPlace[i], (*e)(xs[i])));
+    delete e;
+  }
+}
+
+TEST_CASE("CompiledExpression batch evaluation of several outputs", "[compiled][batch]") {
+  ExpressionEvaluator evaluator;
+  Expression *f = evaluator.evaluate("sin(x)/x+cos(x)*x/3");
+  Expression *g = f->diffSimplify();
+  VariableX x;
+  vector<const Expression *> outputs;
+  outputs.push_back(f);
+  outputs.push_back(g);
+  outputs.push_back(&x);
+  CompiledExpression c(outputs, CompiledExpression::KeepAllSlots);
+  const size_t n = 150;
+  vector<double> xs(n), fs(n), gs(n), copies(n);
+  for (size_t i = 0; i < n; i++)
+    xs[i] = 0.1 + 0.05 * i;
+  double *const out[] = {fs.data(), gs.data(), copies.data()};
+  c.evaluate(xs.data(), out, n);
+  for (size_t i = 0; i < n; i++) {
+    REQUIRE(sameValue(fs[i], (*f)(xs[i])));
+    REQUIRE(sameValue(gs[i], (*g)(xs[i])));
+    REQUIRE(copies[i] == xs[i]);
+  }
+  delete g;
+  delete f;
+}
@@ -0,0 +1,259 @@
+#include "ConcurrentParseCache.h"
+#include "ExpressionArena.h"
+#include "ExpressionEvaluator.h"
+#include "ParseCache.h"
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// bookkeeping of an entry: node, future state, clock slot
+const size_t EntryOverhead = 192;
+
+} // namespace
+
+// Counts a lookup in the half of the readers selected by the generation.
+// If the generation moved between the load and the count, the writer may
+// have missed the count: leave and count again in the new half.
+class ConcurrentParseCache::ReadSection {
+  Shard &shard;
+  int half;
+ public:
+  explicit ReadSection(Shard &s) : shard(s) {
+    for (;;) {
+      unsigned generation = shard.generation.load();
+      half = generation & 1;
+      shard.readers[half].fetch_add(1);
+      if (shard.generation.load() == generation)
+        break;
+      shard.readers[half].fetch_sub(1);
+    }
+  }
+
+  ~ReadSection() { shard.readers[half].fetch_sub(1, memory_order_release); }
+};
+
+ConcurrentParseCache::ConcurrentParseCache(size_t byteLimit, int shardCount,
+                                           int bucketsPerShard) {
+  size_t count = 1;
+  while (count < static_cast<size_t>(max(1, shardCount)))
+    count *= 2;
+  size_t buckets = 1;
+  while (buckets < static_cast<size_t>(max(1, bucketsPerShard)))
+    buckets *= 2;
+  bucketMask = buckets - 1;
+  shardLimit = byteLimit / count;
+  for (size_t i = 0; i < count; i++) {
+    unique_ptr<Shard> shard(new Shard);
+    shard->buckets.reset(new atomic<Node *>[buckets]);
+    for (size_t b = 0; b < buckets; b++)
+      shard->buckets[b].store(NULL, memory_order_relaxed);
+    shard->generation.store(0);
+    shard->readers[0].store(0);
+    shard->readers[1].store(0);
+    shard->hitCount.store(0);
+    shard->missCount.store(0);
+    shard->used = 0;
+    shard->count = 0;
+    shard->evictionCount = 0;
+    shards.push_back(move(shard));
+  }
+}
+
+ConcurrentParseCache::~ConcurrentParseCache() {
+  for (auto it = shards.begin(); it != shards.end(); it++) {
+    for (size_t b = 0; b <= bucketMask; b++) {
+      Node *node = (*it)->buckets[b].load(memory_order_relaxed);
+      while (node) {
+        Node *next = node->next.load(memory_order_relaxed);
+        delete node;
+        node = next;
+      }
+    }
+  }
+}
+
+ConcurrentParseCache::Node *ConcurrentParseCache::find(Shard &shard, const string &key,
+                                                       size_t hash) const {
+  size_t bucket = (hash / shards.size()) & bucketMask;
+  for (Node *node = shard.buckets[bucket].load(memory_order_acquire); node;
+       node = node->next.load(memory_order_acquire))
+    if (node->hash == hash && node->key == key)
+      return node;
+  return NULL;
+}
+
+// under the shard mutex; readers standing on the node still see its next
+void ConcurrentParseCache::unlink(Shard &shard, Node *node) {
+  atomic<Node *> *link = &shard.buckets[(node->hash / shards.size()) & bucketMask];
+  for (Node *n = link->load(memory_order_relaxed); n != node; n = link->load(memory_order_relaxed))
+    link = &n->next;
+  link->store(node->next.load(memory_order_relaxed), memory_order_release);
+}
+
+// under the shard mutex; returns when no reader can see an unlinked node
+void ConcurrentParseCache::synchronize(Shard &shard) {
+  unsigned generation = shard.generation.load();
+  shard.generation.store(generation + 1);
+  // the readers of the other half came in after the previous
+  // synchronize and only ever saw its unlinks done
+  while (shard.readers[generation & 1].load() != 0)
+    this_thread::yield();
+}
+
+// under the shard mutex
+void ConcurrentParseCache::evict(Shard &shard) {
+  vector<Node *> retired;
+  // every entry gets at most one second chance per call
+  size_t steps = 2 * shard.order.size();
+  while (shard.used > shardLimit && shard.count > 1 && steps-- > 0) {
+    Node *node = shard.order.front();
+    shard.order.pop_front();
+    if (!node->done.load(memory_order_relaxed)
+        || node->referenced.exchange(false, memory_order_relaxed)) {
+      shard.order.push_back(node);
+      continue;
+    }
+    unlink(shard, node);
+    shard.used -= node->bytes;
+    shard.count--;
+    shard.evictionCount++;
+    retired.push_back(node);
+  }
+  if (retired.empty())
+    return;
+  synchronize(shard);
+  for (auto it = retired.begin(); it != retired.end(); it++)
+    delete *it;
+}
+
+ConcurrentParseCache::Value ConcurrentParseCache::lookup(const string &formula) {
+  string key = ParseCache::normalize(formula);
+  size_t hash = std::hash<string>()(key);
+  Shard &shard = *shards[hash & (shards.size() - 1)];
+  shared_future<Value> pending;
+  {
+    ReadSection read(shard);
+    Node *node = find(shard, key, hash);
+    if (node) {
+      if (!node->referenced.load(memory_order_relaxed))
+        node->referenced.store(true, memory_order_relaxed);
+      shard.hitCount.fetch_add(1, memory_order_relaxed);
+      if (node->done.load(memory_order_acquire))
+        return node->value.get();
+      pending = node->value;
+    }
+  }
+  if (pending.valid())
+    return pending.get();
+
+  promise<Value> promised;
+  Node *node = NULL;
+  {
+    lock_guard<mutex> lock(shard.mutex);
+    Node *existing = find(shard, key, hash);
+    if (existing) {
+      pending = existing->value;
+    } else {
+      node = new Node;
+      node->key = key;
+      node->hash = hash;
+      node->bytes = 0;
+      node->value = promised.get_future().share();
+      node->done.store(false, memory_order_relaxed);
+      node->referenced.store(false, memory_order_relaxed);
+      atomic<Node *> &bucket = shard.buckets[(hash / shards.size()) & bucketMask];
+      node->next.store(bucket.load(memory_order_relaxed), memory_order_relaxed);
+      bucket.store(node, memory_order_release);
+      shard.order.push_back(node);
+      shard.count++;
+    }
+  }
+  if (pending.valid()) {
+    shard.hitCount.fetch_add(1, memory_order_relaxed);
+    return pending.get();
+  }
+
+  shard.missCount.fetch_add(1, memory_order_relaxed);
+  Value value;
+  try {
+    // the tree outlives any arena of the caller
+    ExpressionArena::HeapScope heap;
+    ExpressionEvaluator evaluator;
+    value.expression.reset(evaluator.evaluate(key));
+    value.program = make_shared<CompiledExpression>(value.expression.get());
+    // fills the structure caches of every node, the tree is read-only once
+    // published
+    value.expression->structuralHash();
+  } catch (...) {
+    promised.set_exception(current_exception());
+    lock_guard<mutex> lock(shard.mutex);
+    unlink(shard, node);
+    shard.order.erase(find_if(shard.order.begin(), shard.order.end(),
+                              [node](Node *n) { return n == node; }));
+    shard.count--;
+    synchronize(shard);
+    delete node;
+    throw;
+  }
+  promised.set_value(value);
+  lock_guard<mutex> lock(shard.mutex);
+  node->bytes = EntryOverhead + 2 * key.size() + ParseCache::estimateBytes(value.expression.get())
+      + ParseCache::estimateBytes(*value.program);
+  shard.used += node->bytes;
+  node->done.store(true, memory_order_release);
+  evict(shard);
+  return value;
+}
+
+shared_ptr<const Expression> ConcurrentParseCache::expression(const string &formula) {
+  return lookup(formula).expression;
+}
+
+shared_ptr<const CompiledExpression> ConcurrentParseCache::compiled(const string &formula) {
+  return lookup(formula).program;
+}
+
+size_t ConcurrentParseCache::hits() const {
+  size_t sum = 0;
+  for (auto it = shards.begin(); it != shards.end(); it++)
+    sum += (*it)->hitCount.load(memory_order_relaxed);
+  return sum;
+}
+
+size_t ConcurrentParseCache::misses() const {
+  size_t sum = 0;
+  for (auto it = shards.begin(); it != shards.end(); it++)
+    sum += (*it)->missCount.load(memory_order_relaxed);
+  return sum;
+}
+
+size_t ConcurrentParseCache::evictions() const {
+  size_t sum = 0;
+  for (auto it = shards.begin(); it != shards.end(); it++) {
+    lock_guard<mutex> lock((*it)->mutex);
+    sum += (*it)->evictionCount;
+  }
+  return sum;
+}
+
+size_t ConcurrentParseCache::size() const {
+  size_t sum = 0;
+  for (auto it = shards.begin(); it != shards.end(); it++) {
+    lock_guard<mutex> lock((*it)->mutex);
+    sum += (*it)->count;
+  }
+  return sum;
+}
+
+size_t ConcurrentParseCache::bytes() const {
+  size_t sum = 0;
+  for (auto it = shards.begin(); it != shards.end(); it++) {
+    lock_guard<mutex> lock((*it)->mutex);
+    sum += (*it)->used;
+  }
+  return sum;
+}
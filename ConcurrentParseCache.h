@@ -0,0 +1,104 @@
+#ifndef CONCURRENTPARSECACHE_H
+#define CONCURRENTPARSECACHE_H
+
+#include "function.h"
+#include "CompiledExpression.h"
+#include <atomic>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ParseCache for many threads at once.
+// The formulas, normalized like ParseCache's, are hashed into shards,
+// each a fixed array of buckets holding chains of immutable entries.
+// Lookups only follow atomic pointers: they take no lock and never wait
+// for a writer. Inserts and evictions take the mutex of their shard and
+// publish their changes with release stores.
+// The first thread to miss on a formula publishes a pending entry and
+// parses and compiles it outside the lock; the other threads asking for it
+// meanwhile wait on that entry's future, so a formula is compiled once.
+// Formulas that don't parse are removed again, and everybody waiting on
+// them gets the invalid_argument.
+// Evicted entries are unlinked, then freed after a grace period: each
+// shard counts its readers in two halves selected by a generation number,
+// the writer bumps the generation and waits for the readers of the old
+// half to leave, after which nobody can still see the entry. Programs and
+// trees already handed out are shared, they outlive their entry.
+// The trees are truly immutable: the lazily computed structuralHash(),
+// nodeCount() and depth() of all their nodes are filled before the entry
+// is published, so threads reading the same tree never write to it.
+// Eviction is a CLOCK approximation of LRU per shard: lookups set a
+// referenced flag, the writer gives referenced entries a second chance.
+// Every shard keeps at least one entry, the limit is split evenly.
+class ConcurrentParseCache {
+ public:
+  struct Value {
+    std::shared_ptr<const Expression> expression;
+    std::shared_ptr<const CompiledExpression> program;
+  };
+
+ private:
+  struct Node {
+    std::string key;
+    size_t hash;
+    size_t bytes;
+    std::shared_future<Value> value;
+    std::atomic<bool> done;
+    std::atomic<bool> referenced;
+    std::atomic<Node *> next;
+  };
+
+  struct Shard {
+    // buckets and readers only touched atomically, the rest under mutex
+    std::unique_ptr<std::atomic<Node *>[]> buckets;
+    std::atomic<unsigned> generation;
+    std::atomic<long> readers[2];
+    std::atomic<size_t> hitCount, missCount;
+    std::mutex mutex;
+    // clock order, oldest first
+    std::deque<Node *> order;
+    size_t used;
+    size_t count;
+    size_t evictionCount;
+  };
+
+  class ReadSection;
+
+  std::vector<std::unique_ptr<Shard> > shards;
+  size_t bucketMask;
+  size_t shardLimit;
+
+  ConcurrentParseCache(const ConcurrentParseCache &);
+  ConcurrentParseCache &operator=(const ConcurrentParseCache &);
+
+  Value lookup(const std::string &formula);
+  Node *find(Shard &shard, const std::string &key, size_t hash) const;
+  void unlink(Shard &shard, Node *node);
+  void synchronize(Shard &shard);
+  void evict(Shard &shard);
+ public:
+  // shardCount is rounded up to a power of two
+  explicit ConcurrentParseCache(size_t byteLimit = 64 << 20, int shardCount = 16,
+                                int bucketsPerShard = 1024);
+  // no lookup may be running
+  ~ConcurrentParseCache();
+
+  std::shared_ptr<const Expression> expression(const std::string &formula);
+  std::shared_ptr<const CompiledExpression> compiled(const std::string &formula);
+
+  // the counters are sums over the shards, exact once the threads are done
+  size_t hits() const;
+  size_t misses() const;
+  size_t evictions() const;
+  size_t size() const;
+  size_t bytes() const;
+
+  size_t byteLimit() const { return shardLimit * shards.size(); }
+
+  int shardCount() const { return static_cast<int>(shards.size()); }
+};
+
+#endif // CONCURRENTPARSECACHE_H
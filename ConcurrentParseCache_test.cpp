@@ -0,0 +1,92 @@
+#include "catch.hpp"
+#include <cmath>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "function.h"
+#include "ConcurrentParseCache.h"
+using namespace std;
+
+namespace {
+
+string formula(int k) {
+  ostringstream s;
+  s << "sin(x)/x + cos(" << k << "*x)*x - " << k;
+  return s.str();
+}
+
+} // namespace
+
+TEST_CASE("ConcurrentParseCache shares the programs", "[cache]") {
+  ConcurrentParseCache cache;
+  shared_ptr<const CompiledExpression> p = cache.compiled("x * sin(x)");
+  REQUIRE(cache.compiled("x*sin( x )") == p);
+  REQUIRE((*p)(0.7) == Approx(0.7 * sin(0.7)));
+  REQUIRE(cache.expression("x*sin(x)")->stringPrint() == "x*sin(x)");
+  REQUIRE(cache.misses() == 1);
+  REQUIRE(cache.hits() == 2);
+  REQUIRE(cache.size() == 1);
+  REQUIRE_THROWS_AS(cache.compiled("2 3"), invalid_argument);
+  REQUIRE_THROWS_AS(cache.compiled("2 3"), invalid_argument);
+  REQUIRE(cache.size() == 1);
+  REQUIRE(cache.misses() == 3);
+}
+
+TEST_CASE("ConcurrentParseCache compiles each formula once", "[cache]") {
+  ConcurrentParseCache cache(64 << 20, 4);
+  const int formulas = 40;
+  const int threads = 8;
+  vector<vector<shared_ptr<const CompiledExpression> > > seen(threads);
+  vector<thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(thread([&cache, &seen, t]() {
+      for (int round = 0; round < 5; round++)
+        for (int i = 0; i < formulas; i++)
+          seen[t].push_back(cache.compiled(formula((i * 7 + t) % formulas)));
+    }));
+  }
+  for (auto it = workers.begin(); it != workers.end(); it++)
+    it->join();
+  REQUIRE(cache.misses() == static_cast<size_t>(formulas));
+  REQUIRE(cache.hits() == static_cast<size_t>(threads * 5 * formulas - formulas));
+  REQUIRE(cache.size() == static_cast<size_t>(formulas));
+  for (int i = 0; i < formulas; i++) {
+    shared_ptr<const CompiledExpression> p = cache.compiled(formula(i));
+    REQUIRE((*p)(0.5) == Approx(sin(0.5) / 0.5 + cos(i * 0.5) * 0.5 - i));
+  }
+  // every thread got the same program for a formula
+  for (int t = 0; t < threads; t++)
+    for (size_t j = 0; j < seen[t].size(); j++)
+      REQUIRE(seen[t][j] == cache.compiled(formula((j % formulas * 7 + t) % formulas)));
+}
+
+TEST_CASE("ConcurrentParseCache evicts under concurrent lookups", "[cache]") {
+  // one shard, room for a few entries
+  ConcurrentParseCache probe(64 << 20, 1);
+  probe.compiled(formula(1));
+  ConcurrentParseCache cache(probe.bytes() * 4, 1);
+  const int threads = 4;
+  vector<thread> workers;
+  vector<int> wrong(threads, 0);
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(thread([&cache, &wrong, t]() {
+      for (int i = 0; i < 300; i++) {
+        int k = (i * 13 + t * 5) % 30;
+        shared_ptr<const CompiledExpression> p = cache.compiled(formula(k));
+        if (fabs((*p)(0.5) - (sin(0.5) / 0.5 + cos(k * 0.5) * 0.5 - k)) > 1e-9)
+          wrong[t]++;
+      }
+    }));
+  }
+  for (auto it = workers.begin(); it != workers.end(); it++)
+    it->join();
+  for (int t = 0; t < threads; t++)
+    REQUIRE(wrong[t] == 0);
+  REQUIRE(cache.evictions() > 0);
+  REQUIRE(cache.size() <= 5);
+  REQUIRE(cache.bytes() <= cache.byteLimit() + probe.bytes());
+  REQUIRE(cache.size() + cache.evictions() == cache.misses());
+}
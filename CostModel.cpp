@@ -0,0 +1,132 @@
+#include "CostModel.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COSTMODEL_X86
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// no operation is cheaper than this, so that every tree costs something
+const double MinimumCost = 0.5;
+
+unsigned long long now() {
+#ifdef COSTMODEL_X86
+  return __rdtsc();
+#else
+  return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// best of a few repetitions, the others were interrupted; the first one
+// warms the caches up and isn't counted
+double cyclesPerEvaluation(const Expression *e, int evaluations) {
+  double best = numeric_limits<double>::infinity();
+  volatile double sink = 0;
+  for (int repetition = 0; repetition < 6; repetition++) {
+    double sum = 0;
+    unsigned long long start = now();
+    for (int i = 0; i < evaluations; i++)
+      sum += (*e)(0.5 + i * 1e-6);
+    unsigned long long stop = now();
+    sink = sum;
+    if (repetition > 0)
+      best = min(best, static_cast<double>(stop - start) / evaluations);
+  }
+  (void) sink;
+  return best;
+}
+
+} // namespace
+
+CostModel::CostModel() {
+  // calibrated on a 2 GHz x86-64 with the default flags of this project
+  costs[Expression::TypeConstant] = 9;
+  costs[Expression::TypeVariable] = 9;
+  costs[Expression::TypeAdd] = 28;
+  costs[Expression::TypeMulti] = 28;
+  costs[Expression::TypeDivide] = 6;
+  costs[Expression::TypePower] = 0;
+  costs[Expression::TypeCompo] = 6;
+  costs[Expression::TypePoly] = 50;
+  costs[Expression::TypeTrigo] = 36;
+  costs[Expression::TypeExp] = 28;
+  costs[Expression::TypeLog] = 28;
+}
+
+double CostModel::estimate(const Expression *e) const {
+  if (!e) throw invalid_argument("null expression in CostModel");
+  switch (e->nodeType()) {
+    case Expression::TypeAdd:
+    case Expression::TypeMulti: {
+      const ExpressionSet &children = static_cast<const CommutativeOperators *>(e)->getChildren();
+      double sum = costs[e->nodeType()] * (children.size() - 1);
+      for (auto it = children.begin(); it != children.end(); it++)
+        sum += estimate(*it);
+      return sum;
+    }
+    case Expression::TypeDivide: {
+      const Division *d = static_cast<const Division *>(e);
+      return costs[Expression::TypeDivide] + estimate(d->getNumerator())
+          + estimate(d->getDenominator());
+    }
+    case Expression::TypeCompo: {
+      const Composition *c = static_cast<const Composition *>(e);
+      return costs[Expression::TypeCompo] + estimate(c->getLeft()) + estimate(c->getRight());
+    }
+    case Expression::TypePoly:
+      return costs[Expression::TypePoly]
+          * static_cast<const Polynomial *>(e)->getParameter().size();
+    default:
+      return costs[e->nodeType()];
+  }
+}
+
+CostModel CostModel::calibrate(int evaluations) {
+  // each tree adds one node to trees already measured, the cost of the
+  // node is the difference
+  unique_ptr<Expression> variable(new VariableX);
+  unique_ptr<Expression> constant(new Constant(2));
+  unique_ptr<Expression> sum(new Addition(new VariableX, new VariableX));
+  unique_ptr<Expression> product(new Multiplication(new VariableX, new VariableX));
+  unique_ptr<Expression> quotient(new Division(new VariableX, new VariableX));
+  vector<double> coefficients(4, 1.5);
+  unique_ptr<Expression> polynomial(new Polynomial(coefficients));
+  unique_ptr<Expression> sine(new Trigo(Trigo::Sin));
+  unique_ptr<Expression> composed(new Composition(new Trigo(Trigo::Sin), new VariableX));
+  unique_ptr<Expression> exponential(new Exponential);
+  unique_ptr<Expression> logarithm(new Logarithm);
+
+  double x = cyclesPerEvaluation(variable.get(), evaluations);
+  double sin = cyclesPerEvaluation(sine.get(), evaluations);
+  CostModel model;
+  model.costs[Expression::TypeVariable] = x;
+  model.costs[Expression::TypeConstant] = cyclesPerEvaluation(constant.get(), evaluations);
+  model.costs[Expression::TypeAdd] = cyclesPerEvaluation(sum.get(), evaluations) - 2 * x;
+  model.costs[Expression::TypeMulti] = cyclesPerEvaluation(product.get(), evaluations) - 2 * x;
+  model.costs[Expression::TypeDivide] = cyclesPerEvaluation(quotient.get(), evaluations) - 2 * x;
+  model.costs[Expression::TypePoly] =
+      cyclesPerEvaluation(polynomial.get(), evaluations) / coefficients.size();
+  model.costs[Expression::TypeTrigo] = sin;
+  model.costs[Expression::TypeCompo] =
+      cyclesPerEvaluation(composed.get(), evaluations) - sin - x;
+  model.costs[Expression::TypeExp] = cyclesPerEvaluation(exponential.get(), evaluations);
+  model.costs[Expression::TypeLog] = cyclesPerEvaluation(logarithm.get(), evaluations);
+  for (int type = 0; type <= Expression::TypeLog; type++)
+    if (type != Expression::TypePower)
+      model.costs[type] = max(model.costs[type], MinimumCost);
+  return model;
+}
+
+const CostModel &CostModel::host() {
+  static const CostModel model = calibrate();
+  return model;
+}
@@ -0,0 +1,33 @@
+#ifndef COSTMODEL_H
+#define COSTMODEL_H
+
+#include "function.h"
+
+// Estimated cost of evaluating an Expression tree once, in cycles of the
+// time stamp counter on x86, in nanoseconds elsewhere.
+// Every NodeType has a cost per operation: a sum or a product of k
+// children does k-1 operations, a Polynomial one per coefficient, other
+// nodes one. The cost of a node excludes its children, so the cost of a
+// tree is the sum over its nodes.
+// The default costs were measured once and are only good for comparing
+// trees; calibrate() measures them on the host by timing small trees of
+// each type through their operator().
+class CostModel {
+  double costs[Expression::TypeLog + 1];
+ public:
+  CostModel();
+
+  double cost(Expression::NodeType type) const { return costs[type]; }
+
+  void setCost(Expression::NodeType type, double cycles) { costs[type] = cycles; }
+
+  double estimate(const Expression *e) const;
+
+  // evaluations is the number of timed calls per tree and repetition
+  static CostModel calibrate(int evaluations = 20000);
+
+  // calibrated on first use, then shared
+  static const CostModel &host();
+};
+
+#endif // COSTMODEL_H
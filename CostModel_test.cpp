@@ -0,0 +1,38 @@
+#include "catch.hpp"
+#include <memory>
+#include <vector>
+#include "function.h"
+#include "ExpressionEvaluator.h"
+#include "CostModel.h"
+using namespace std;
+
+TEST_CASE("CostModel estimates", "[cost]") {
+  ExpressionEvaluator evaluator;
+  CostModel model;
+  unique_ptr<Expression> e(evaluator.evaluate("sin(x)+x"));
+  REQUIRE(model.estimate(e.get()) == Approx(model.cost(Expression::TypeTrigo)
+      + model.cost(Expression::TypeAdd) + model.cost(Expression::TypeVariable)));
+  // k children, k-1 operations
+  e.reset(evaluator.evaluate("sin(x)*cos(x)*exp(x)"));
+  REQUIRE(model.estimate(e.get()) == Approx(2 * model.cost(Expression::TypeMulti)
+      + 2 * model.cost(Expression::TypeTrigo) + model.cost(Expression::TypeExp)));
+  // a composition with a polynomial of three coefficients
+  vector<double> coefficients(3, 1.0);
+  e.reset(new Composition(new Trigo(Trigo::Sin), new Polynomial(coefficients)));
+  REQUIRE(model.estimate(e.get()) == Approx(model.cost(Expression::TypeCompo)
+      + model.cost(Expression::TypeTrigo) + 3 * model.cost(Expression::TypePoly)));
+  model.setCost(Expression::TypeTrigo, 1000);
+  REQUIRE(model.estimate(e.get()) > 1000);
+}
+
+TEST_CASE("CostModel calibration", "[cost]") {
+  CostModel model = CostModel::calibrate(2000);
+  for (int type = 0; type <= Expression::TypeLog; type++)
+    if (type != Expression::TypePower)
+      REQUIRE(model.cost(static_cast<Expression::NodeType>(type)) > 0);
+  ExpressionEvaluator evaluator;
+  unique_ptr<Expression> cheap(evaluator.evaluate("x"));
+  unique_ptr<Expression> costly(evaluator.evaluate("sin(x)*cos(x)*exp(x)/log(x)"));
+  REQUIRE(model.estimate(costly.get()) > model.estimate(cheap.get()));
+  REQUIRE(&CostModel::host() == &CostModel::host());
+}
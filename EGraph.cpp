@@ -0,0 +1,615 @@
+#include "EGraph.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+// polynomials are only multiplied up to this degree
+const size_t MaxPolyDegree = 8;
+
+void combine(size_t &seed, size_t v) {
+  seed ^= v + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+}
+
+size_t doubleBits(double v) {
+  unsigned long long bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return static_cast<size_t>(bits);
+}
+
+double applyFunction(ExpressionDag::Op op, double t) {
+  switch (op) {
+    case ExpressionDag::Sin:
+      return sin(t);
+    case ExpressionDag::Cos:
+      return cos(t);
+    case ExpressionDag::Tan:
+      return tan(t);
+    case ExpressionDag::Exp:
+      return exp(t);
+    case ExpressionDag::Log:
+      return log(t);
+    default:
+      throw invalid_argument("not an elementary function in EGraph");
+  }
+}
+
+double polynomialValue(const vector<double> &para, double t) {
+  double xPowerK = 1;
+  double sum = 0;
+  for (auto it = para.begin(); it != para.end(); it++) {
+    sum += (*it) * xPowerK;
+    xPowerK *= t;
+  }
+  return sum;
+}
+
+vector<double> addCoefficients(const vector<double> &p, const vector<double> &q) {
+  vector<double> sum(max(p.size(), q.size()), 0.0);
+  for (size_t i = 0; i < p.size(); i++)
+    sum[i] += p[i];
+  for (size_t i = 0; i < q.size(); i++)
+    sum[i] += q[i];
+  return sum;
+}
+
+vector<double> multiplyCoefficients(const vector<double> &p, const vector<double> &q) {
+  vector<double> product(p.size() + q.size() - 1, 0.0);
+  for (size_t i = 0; i < p.size(); i++)
+    for (size_t j = 0; j < q.size(); j++)
+      product[i + j] += p[i] * q[j];
+  return product;
+}
+
+} // namespace
+
+size_t EGraph::NodeHash::operator()(const Node &n) const {
+  size_t seed = n.op;
+  combine(seed, doubleBits(n.value));
+  combine(seed, n.a);
+  combine(seed, n.b);
+  for (auto it = n.coefficients.begin(); it != n.coefficients.end(); it++)
+    combine(seed, doubleBits(*it));
+  return seed;
+}
+
+bool EGraph::NodeEqual::operator()(const Node &x, const Node &y) const {
+  return x.op == y.op && doubleBits(x.value) == doubleBits(y.value)
+      && x.a == y.a && x.b == y.b && x.coefficients.size() == y.coefficients.size()
+      && std::equal(x.coefficients.begin(), x.coefficients.end(), y.coefficients.begin(),
+                    [](double u, double v) { return doubleBits(u) == doubleBits(v); });
+}
+
+EGraph::EGraph(const CostModel &model)
+    : model(model), nodes(0), iterationCount(0), dirty(true) { }
+
+EGraph::ClassId EGraph::find(ClassId c) const {
+  while (parent[c] != c)
+    c = parent[c];
+  return c;
+}
+
+EGraph::Node EGraph::canonical(Node n) const {
+  if (n.a >= 0)
+    n.a = find(n.a);
+  if (n.b >= 0)
+    n.b = find(n.b);
+  return n;
+}
+
+EGraph::ClassId EGraph::addNode(const Node &node) {
+  Node n = canonical(node);
+  auto found = memo.find(n);
+  if (found != memo.end())
+    return find(found->second);
+  ClassId id = parent.size();
+  parent.push_back(id);
+  classes.push_back(vector<Node>(1, n));
+  memo.insert(make_pair(n, id));
+  nodes++;
+  dirty = true;
+  return id;
+}
+
+EGraph::ClassId EGraph::leaf(Op op, double value) {
+  Node n;
+  n.op = op;
+  n.value = value;
+  n.a = n.b = -1;
+  return addNode(n);
+}
+
+EGraph::ClassId EGraph::binary(Op op, ClassId a, ClassId b) {
+  Node n;
+  n.op = op;
+  n.value = 0;
+  n.a = a;
+  n.b = b;
+  return addNode(n);
+}
+
+EGraph::ClassId EGraph::unary(Op op, ClassId a) {
+  return binary(op, a, -1);
+}
+
+EGraph::ClassId EGraph::polynomial(vector<double> coefficients, ClassId argument) {
+  while (!coefficients.empty() && coefficients.back() == 0)
+    coefficients.pop_back();
+  if (coefficients.empty())
+    return leaf(ExpressionDag::Const, 0);
+  if (coefficients.size() == 1)
+    return leaf(ExpressionDag::Const, coefficients[0]);
+  Node n;
+  n.op = ExpressionDag::Poly;
+  n.value = 0;
+  n.a = argument;
+  n.b = -1;
+  n.coefficients.swap(coefficients);
+  return addNode(n);
+}
+
+bool EGraph::merge(ClassId a, ClassId b) {
+  a = find(a);
+  b = find(b);
+  if (a == b)
+    return false;
+  // the smaller class is moved into the larger one
+  if (classes[a].size() < classes[b].size())
+    swap(a, b);
+  parent[b] = a;
+  classes[a].insert(classes[a].end(), classes[b].begin(), classes[b].end());
+  vector<Node>().swap(classes[b]);
+  dirty = true;
+  return true;
+}
+
+void EGraph::assertEqual(ClassId a, ClassId b) {
+  merge(a, b);
+  rebuild();
+}
+
+// restores the invariants broken by merges: children are canonical, every
+// node is in the memo once, and congruent nodes (same operator, children
+// in the same classes) are in the same class
+void EGraph::rebuild() {
+  bool merged = true;
+  while (merged) {
+    merged = false;
+    memo.clear();
+    nodes = 0;
+    vector<pair<ClassId, ClassId> > congruent;
+    for (size_t c = 0; c < classes.size(); c++) {
+      if (parent[c] != static_cast<ClassId>(c))
+        continue;
+      vector<Node> &list = classes[c];
+      size_t kept = 0;
+      for (size_t i = 0; i < list.size(); i++) {
+        Node n = canonical(list[i]);
+        auto inserted = memo.insert(make_pair(n, static_cast<ClassId>(c)));
+        if (!inserted.second) {
+          // duplicate within the class, or congruent to another class
+          if (inserted.first->second != static_cast<ClassId>(c))
+            congruent.push_back(make_pair(inserted.first->second, static_cast<ClassId>(c)));
+          continue;
+        }
+        list[kept++] = n;
+      }
+      list.resize(kept);
+      nodes += kept;
+    }
+    for (auto it = congruent.begin(); it != congruent.end(); it++)
+      merged = merge(it->first, it->second) || merged;
+  }
+}
+
+size_t EGraph::classCount() const {
+  size_t count = 0;
+  for (size_t c = 0; c < parent.size(); c++)
+    if (parent[c] == static_cast<ClassId>(c))
+      count++;
+  return count;
+}
+
+bool EGraph::constantOf(ClassId c, double &value) const {
+  const vector<Node> &list = classes[find(c)];
+  for (auto it = list.begin(); it != list.end(); it++) {
+    if (it->op == ExpressionDag::Const) {
+      value = it->value;
+      return true;
+    }
+  }
+  return false;
+}
+
+const vector<int> &EGraph::snapshotNodes(ClassId c) const {
+  static const vector<int> none;
+  if (c < 0 || static_cast<size_t>(c) >= snapshotClasses.size())
+    return none;
+  return snapshotClasses[c];
+}
+
+EGraph::ClassId EGraph::add(const Expression *e) {
+  ExpressionDag dag;
+  ExpressionDag::Id root = dag.fromExpression(e);
+  // Ids are in topological order, children are mapped before parents
+  vector<ClassId> mapped(root + 1);
+  for (ExpressionDag::Id id = 0; id <= root; id++) {
+    const ExpressionDag::Node &n = dag.node(id);
+    switch (n.op) {
+      case ExpressionDag::Const:
+      case ExpressionDag::X:
+        mapped[id] = leaf(n.op, n.value);
+        break;
+      case ExpressionDag::Add:
+      case ExpressionDag::Multi:
+      case ExpressionDag::Divide: {
+        ClassId c = mapped[n.children[0]];
+        for (size_t i = 1; i < n.children.size(); i++)
+          c = binary(n.op, c, mapped[n.children[i]]);
+        mapped[id] = c;
+        break;
+      }
+      case ExpressionDag::Poly:
+        mapped[id] = polynomial(n.coefficients, mapped[n.children[0]]);
+        break;
+      default:
+        mapped[id] = unary(n.op, mapped[n.children[0]]);
+        break;
+    }
+  }
+  return mapped[root];
+}
+
+// matches every rule at one node of the snapshot; new nodes and merges go
+// to the live graph
+void EGraph::applyRules(ClassId c, const Node &n) {
+  typedef ExpressionDag D;
+  double u, v;
+  switch (n.op) {
+    case D::Const:
+    case D::X:
+      break;
+    case D::Add: {
+      ClassId a = n.a, b = n.b;
+      // a+b=b+a
+      merge(c, binary(D::Add, b, a));
+      if (constantOf(a, u)) {
+        // constant folding, 0+b=b
+        if (constantOf(b, v))
+          merge(c, leaf(D::Const, u + v));
+        else if (u == 0)
+          merge(c, b);
+      }
+      // a+a=2*a
+      if (find(a) == find(b))
+        merge(c, binary(D::Multi, leaf(D::Const, 2), a));
+      const vector<int> &left = snapshotNodes(a);
+      const vector<int> &right = snapshotNodes(b);
+      for (auto i = left.begin(); i != left.end(); i++) {
+        const Node &l = snapshot[*i];
+        // (p+q)+b=p+(q+b)
+        if (l.op == D::Add)
+          merge(c, binary(D::Add, l.a, binary(D::Add, l.b, b)));
+        // p*q+p=p*(q+1)
+        if (l.op == D::Multi && find(l.a) == find(b))
+          merge(c, binary(D::Multi, b, binary(D::Add, l.b, leaf(D::Const, 1))));
+        if (l.op == D::Poly) {
+          // P(t)+k and P(t)+t are polynomials of t
+          if (constantOf(b, v)) {
+            vector<double> k(1, v);
+            merge(c, polynomial(addCoefficients(l.coefficients, k), l.a));
+          }
+          if (find(l.a) == find(b)) {
+            vector<double> t(2, 0.0);
+            t[1] = 1;
+            merge(c, polynomial(addCoefficients(l.coefficients, t), l.a));
+          }
+        }
+        for (auto j = right.begin(); j != right.end(); j++) {
+          const Node &r = snapshot[*j];
+          // p*q+p*s=p*(q+s)
+          if (l.op == D::Multi && r.op == D::Multi && find(l.a) == find(r.a))
+            merge(c, binary(D::Multi, l.a, binary(D::Add, l.b, r.b)));
+          // p/q+s/q=(p+s)/q
+          if (l.op == D::Divide && r.op == D::Divide && find(l.b) == find(r.b))
+            merge(c, binary(D::Divide, binary(D::Add, l.a, r.a), l.b));
+          // P(t)+Q(t)=(P+Q)(t)
+          if (l.op == D::Poly && r.op == D::Poly && find(l.a) == find(r.a))
+            merge(c, polynomial(addCoefficients(l.coefficients, r.coefficients), l.a));
+        }
+      }
+      break;
+    }
+    case D::Multi: {
+      ClassId a = n.a, b = n.b;
+      // a*b=b*a
+      merge(c, binary(D::Multi, b, a));
+      if (constantOf(a, u)) {
+        // constant folding, 1*b=b, 0*b=0
+        if (constantOf(b, v))
+          merge(c, leaf(D::Const, u * v));
+        else if (u == 1)
+          merge(c, b);
+        else if (u == 0)
+          merge(c, leaf(D::Const, 0));
+      }
+      // t*t=t^2
+      if (find(a) == find(b)) {
+        vector<double> square(3, 0.0);
+        square[2] = 1;
+        merge(c, polynomial(square, a));
+      }
+      const vector<int> &left = snapshotNodes(a);
+      const vector<int> &right = snapshotNodes(b);
+      for (auto i = left.begin(); i != left.end(); i++) {
+        const Node &l = snapshot[*i];
+        // (p*q)*b=p*(q*b)
+        if (l.op == D::Multi)
+          merge(c, binary(D::Multi, l.a, binary(D::Multi, l.b, b)));
+        // (p/q)*b=(p*b)/q
+        if (l.op == D::Divide)
+          merge(c, binary(D::Divide, binary(D::Multi, l.a, b), l.b));
+        if (l.op == D::Poly) {
+          // k*P(t) and P(t)*t are polynomials of t
+          if (constantOf(b, v)) {
+            vector<double> k(1, v);
+            merge(c, polynomial(multiplyCoefficients(l.coefficients, k), l.a));
+          }
+          if (find(l.a) == find(b) && l.coefficients.size() <= MaxPolyDegree) {
+            vector<double> shifted(1, 0.0);
+            shifted.insert(shifted.end(), l.coefficients.begin(), l.coefficients.end());
+            merge(c, polynomial(shifted, l.a));
+          }
+        }
+        for (auto j = right.begin(); j != right.end(); j++) {
+          const Node &r = snapshot[*j];
+          // exp(p)*exp(q)=exp(p+q)
+          if (l.op == D::Exp && r.op == D::Exp)
+            merge(c, unary(D::Exp, binary(D::Add, l.a, r.a)));
+          // P(t)*Q(t)=(P*Q)(t)
+          if (l.op == D::Poly && r.op == D::Poly && find(l.a) == find(r.a)
+              && l.coefficients.size() + r.coefficients.size() - 2 <= MaxPolyDegree)
+            merge(c, polynomial(multiplyCoefficients(l.coefficients, r.coefficients), l.a));
+        }
+      }
+      break;
+    }
+    case D::Divide: {
+      ClassId a = n.a, b = n.b;
+      if (constantOf(b, v)) {
+        // constant folding, a/1=a
+        if (constantOf(a, u))
+          merge(c, leaf(D::Const, u / v));
+        else if (v == 1)
+          merge(c, a);
+      }
+      // 0/b=0, as Division::simplify does
+      if (constantOf(a, u) && u == 0)
+        merge(c, leaf(D::Const, 0));
+      const vector<int> &left = snapshotNodes(a);
+      const vector<int> &right = snapshotNodes(b);
+      for (auto i = left.begin(); i != left.end(); i++) {
+        const Node &l = snapshot[*i];
+        // (p/q)/b=p/(q*b)
+        if (l.op == D::Divide)
+          merge(c, binary(D::Divide, l.a, binary(D::Multi, l.b, b)));
+      }
+      for (auto j = right.begin(); j != right.end(); j++) {
+        const Node &r = snapshot[*j];
+        // a/(p/q)=(a*q)/p
+        if (r.op == D::Divide)
+          merge(c, binary(D::Divide, binary(D::Multi, a, r.b), r.a));
+        // sin(t)/cos(t)=tan(t)
+        if (r.op == D::Cos) {
+          for (auto i = left.begin(); i != left.end(); i++) {
+            const Node &l = snapshot[*i];
+            if (l.op == D::Sin && find(l.a) == find(r.a))
+              merge(c, unary(D::Tan, l.a));
+          }
+        }
+      }
+      break;
+    }
+    case D::Poly:
+      if (constantOf(n.a, u))
+        merge(c, leaf(D::Const, polynomialValue(n.coefficients, u)));
+      break;
+    default: {
+      if (constantOf(n.a, u))
+        merge(c, leaf(D::Const, applyFunction(n.op, u)));
+      // log(exp(t))=t
+      if (n.op == D::Log) {
+        const vector<int> &argument = snapshotNodes(n.a);
+        for (auto i = argument.begin(); i != argument.end(); i++)
+          if (snapshot[*i].op == D::Exp)
+            merge(c, snapshot[*i].a);
+      }
+      break;
+    }
+  }
+}
+
+bool EGraph::saturate(const SaturationLimits &limits) {
+  typedef chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+  rebuild();
+  for (int iteration = 0; iteration < limits.maxIterations; iteration++) {
+    snapshot.clear();
+    snapshotClasses.assign(classes.size(), vector<int>());
+    vector<ClassId> owners;
+    for (size_t c = 0; c < classes.size(); c++) {
+      if (parent[c] != static_cast<ClassId>(c))
+        continue;
+      for (auto it = classes[c].begin(); it != classes[c].end(); it++) {
+        snapshotClasses[c].push_back(snapshot.size());
+        snapshot.push_back(*it);
+        owners.push_back(c);
+      }
+    }
+    size_t before = nodes;
+    size_t classesBefore = classCount();
+    bool outOfBudget = false;
+    for (size_t i = 0; i < snapshot.size() && !outOfBudget; i++) {
+      applyRules(owners[i], snapshot[i]);
+      outOfBudget = nodes > limits.maxNodes
+          || chrono::duration<double>(Clock::now() - start).count() > limits.maxSeconds;
+    }
+    rebuild();
+    iterationCount++;
+    snapshot.clear();
+    snapshotClasses.clear();
+    if (outOfBudget)
+      return false;
+    // nothing was added nor merged: saturated
+    if (nodes == before && classCount() == classesBefore)
+      return true;
+  }
+  return false;
+}
+
+// cost of the node with the costs of its children, a function of x is a
+// single node of the tree, a function of anything else a composition
+double EGraph::nodeCost(const Node &n, ClassId xClass) const {
+  double total = 0;
+  switch (n.op) {
+    case ExpressionDag::Const:
+      return model.cost(Expression::TypeConstant);
+    case ExpressionDag::X:
+      return model.cost(Expression::TypeVariable);
+    case ExpressionDag::Add:
+      return model.cost(Expression::TypeAdd) + bestCost[n.a] + bestCost[n.b];
+    case ExpressionDag::Multi:
+      return model.cost(Expression::TypeMulti) + bestCost[n.a] + bestCost[n.b];
+    case ExpressionDag::Divide:
+      return model.cost(Expression::TypeDivide) + bestCost[n.a] + bestCost[n.b];
+    case ExpressionDag::Poly:
+      total = model.cost(Expression::TypePoly) * n.coefficients.size();
+      break;
+    case ExpressionDag::Sin:
+    case ExpressionDag::Cos:
+    case ExpressionDag::Tan:
+      total = model.cost(Expression::TypeTrigo);
+      break;
+    case ExpressionDag::Exp:
+      total = model.cost(Expression::TypeExp);
+      break;
+    case ExpressionDag::Log:
+      total = model.cost(Expression::TypeLog);
+      break;
+  }
+  if (n.a != xClass)
+    total += model.cost(Expression::TypeCompo) + bestCost[n.a];
+  return total;
+}
+
+// cheapest node of each class, relaxed until no cost improves; classes
+// only reachable through cycles keep an infinite cost
+void EGraph::computeCosts() {
+  if (!dirty)
+    return;
+  rebuild();
+  const double infinity = numeric_limits<double>::infinity();
+  bestCost.assign(classes.size(), infinity);
+  bestNode.assign(classes.size(), -1);
+  Node x;
+  x.op = ExpressionDag::X;
+  x.value = 0;
+  x.a = x.b = -1;
+  auto found = memo.find(x);
+  ClassId xClass = found == memo.end() ? -1 : find(found->second);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t c = 0; c < classes.size(); c++) {
+      if (parent[c] != static_cast<ClassId>(c))
+        continue;
+      for (size_t i = 0; i < classes[c].size(); i++) {
+        double total = nodeCost(classes[c][i], xClass);
+        if (total < bestCost[c]) {
+          bestCost[c] = total;
+          bestNode[c] = i;
+          changed = true;
+        }
+      }
+    }
+  }
+  dirty = false;
+}
+
+double EGraph::cost(ClassId c) {
+  computeCosts();
+  return bestCost[find(c)];
+}
+
+Expression *EGraph::extract(ClassId root) {
+  computeCosts();
+  // every cost is positive, so the best node of a class only refers to
+  // cheaper classes and the recursion ends
+  ExpressionDag dag;
+  unordered_map<ClassId, ExpressionDag::Id> built;
+  struct Builder {
+    EGraph &g;
+    ExpressionDag &dag;
+    unordered_map<ClassId, ExpressionDag::Id> &built;
+
+    ExpressionDag::Id build(ClassId c) {
+      c = g.find(c);
+      auto found = built.find(c);
+      if (found != built.end())
+        return found->second;
+      const Node &n = g.classes[c][g.bestNode[c]];
+      ExpressionDag::Id id;
+      switch (n.op) {
+        case ExpressionDag::Const:
+          id = dag.constant(n.value);
+          break;
+        case ExpressionDag::X:
+          id = dag.variable();
+          break;
+        case ExpressionDag::Add:
+          id = dag.add(build(n.a), build(n.b));
+          break;
+        case ExpressionDag::Multi:
+          id = dag.multi(build(n.a), build(n.b));
+          break;
+        case ExpressionDag::Divide: {
+          ExpressionDag::Id numerator = build(n.a);
+          id = dag.divide(numerator, build(n.b));
+          break;
+        }
+        case ExpressionDag::Poly:
+          id = dag.polynomial(n.coefficients, build(n.a));
+          break;
+        default:
+          id = dag.apply(n.op, build(n.a));
+          break;
+      }
+      built[c] = id;
+      return id;
+    }
+  };
+  if (bestNode[find(root)] < 0)
+    throw logic_error("no finite expression in the class in EGraph");
+  Builder builder = { *this, dag, built };
+  return dag.toExpression(builder.build(root));
+}
+
+Expression *EGraph::simplify(const Expression *e, const SaturationLimits &limits,
+                             const CostModel &model) {
+  if (!e) throw invalid_argument("null expression in EGraph");
+  EGraph g(model);
+  ClassId root = g.add(e);
+  // the greedy rules of Expression::simplify seed the graph with their
+  // result
+  unique_ptr<Expression> greedy = Expression::simplified(unique_ptr<Expression>(e->clone()));
+  g.assertEqual(root, g.add(greedy.get()));
+  g.saturate(limits);
+  return g.extract(root);
+}
@@ -0,0 +1,105 @@
+#ifndef EGRAPH_H
+#define EGRAPH_H
+
+#include "CostModel.h"
+#include "ExpressionDag.h"
+#include <unordered_map>
+
+struct SaturationLimits {
+  size_t maxNodes;
+  int maxIterations;
+  double maxSeconds;
+
+  SaturationLimits() : maxNodes(20000), maxIterations(30), maxSeconds(0.1) { }
+};
+
+// Equality saturation.
+// An e-graph stores many equivalent forms of an expression at once: its
+// classes are sets of equivalent nodes whose children are classes. The
+// rewrite rules only ever add nodes and merge classes, so no rule can
+// hide a better form behind a worse one and the order in which they
+// apply doesn't matter. Once saturated, or out of budget, the cheapest
+// tree is extracted from the classes according to a CostModel.
+// Nodes are those of ExpressionDag, with binary sums and products.
+// The rules keep the value of the expression as a real function, not
+// bitwise: sums and products are reassociated, exp(a)*exp(b) becomes
+// exp(a+b) and so on.
+class EGraph {
+ public:
+  typedef int ClassId;
+  typedef ExpressionDag::Op Op;
+
+  struct Node {
+    Op op;
+    double value;                       // Const
+    ClassId a, b;                       // children, -1 when absent
+    std::vector<double> coefficients;   // Poly
+  };
+ private:
+  struct NodeHash {
+    size_t operator()(const Node &n) const;
+  };
+  struct NodeEqual {
+    bool operator()(const Node &x, const Node &y) const;
+  };
+
+  CostModel model;
+  std::vector<ClassId> parent;
+  std::vector<std::vector<Node> > classes;
+  std::unordered_map<Node, ClassId, NodeHash, NodeEqual> memo;
+  size_t nodes;
+  int iterationCount;
+  bool dirty;
+
+  // extraction, valid while not dirty
+  std::vector<double> bestCost;
+  std::vector<int> bestNode;
+
+  // the nodes of the classes at the start of an iteration, the rules
+  // read them while adding to the graph
+  std::vector<Node> snapshot;
+  std::vector<std::vector<int> > snapshotClasses;
+
+  Node canonical(Node n) const;
+  ClassId addNode(const Node &n);
+  ClassId leaf(Op op, double value);
+  ClassId binary(Op op, ClassId a, ClassId b);
+  ClassId unary(Op op, ClassId a);
+  ClassId polynomial(std::vector<double> coefficients, ClassId argument);
+  bool merge(ClassId a, ClassId b);
+  void rebuild();
+  bool constantOf(ClassId c, double &value) const;
+  const std::vector<int> &snapshotNodes(ClassId c) const;
+  void applyRules(ClassId c, const Node &n);
+  double nodeCost(const Node &n, ClassId xClass) const;
+  void computeCosts();
+ public:
+  explicit EGraph(const CostModel &model = CostModel::host());
+
+  ClassId add(const Expression *e);
+
+  ClassId find(ClassId c) const;
+
+  // merges the classes of two expressions known to be equal
+  void assertEqual(ClassId a, ClassId b);
+
+  // applies the rules until nothing changes or a limit is hit, returns
+  // true when saturated
+  bool saturate(const SaturationLimits &limits = SaturationLimits());
+
+  // the cheapest expression of a class, and its cost
+  Expression *extract(ClassId c);
+  double cost(ClassId c);
+
+  size_t nodeCount() const { return nodes; }
+  size_t classCount() const;
+  int iterations() const { return iterationCount; }
+
+  // e and its greedy simplification saturated together, then the
+  // cheapest form extracted; never costlier than the greedy result
+  static Expression *simplify(const Expression *e,
+                              const SaturationLimits &limits = SaturationLimits(),
+                              const CostModel &model = CostModel::host());
+};
+
+#endif // EGRAPH_H
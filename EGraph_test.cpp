@@ -0,0 +1,84 @@
+#include "catch.hpp"
+#include <cmath>
+#include <memory>
+#include <string>
+#include "function.h"
+#include "ExpressionEvaluator.h"
+#include "EGraph.h"
+using namespace std;
+
+static const char *egraphCorpus[] = {
+    "1", "x", "2-x", "x*x", "x+x*x", "2*x*x*x-x/3", "x*sin(x)", "sin(x)/x", "log(x)",
+    "cos(x)*exp(x)", "sin(cos(x))", "exp(sin(x)*x)-log(x+2)", "(2/x)/(sin(x)/exp(x))",
+    "sin(x)*cos(x)+sin(x)*exp(x)", "exp(x)*exp(x*x)", "sin(x)/cos(x)", "log(exp(x+1))"
+};
+
+static size_t occurrences(const string &s, const string &word) {
+  size_t count = 0;
+  for (size_t at = s.find(word); at != string::npos; at = s.find(word, at + 1))
+    count++;
+  return count;
+}
+
+TEST_CASE("EGraph keeps the value of the expression", "[egraph]") {
+  ExpressionEvaluator evaluator;
+  CostModel model;
+  for (auto s : egraphCorpus) {
+    unique_ptr<Expression> e(evaluator.evaluate(s));
+    unique_ptr<Expression> greedy(Expression::simplified(unique_ptr<Expression>(e->clone())));
+    unique_ptr<Expression> best(EGraph::simplify(e.get(), SaturationLimits(), model));
+    for (double x = 0.15; x < 3; x += 0.35)
+      REQUIRE((*best)(x) == Approx((*e)(x)));
+    // the greedy result is one of the candidates
+    REQUIRE(model.estimate(best.get()) <= model.estimate(greedy.get()));
+    EGraph g(model);
+    REQUIRE(g.cost(g.add(best.get())) == Approx(model.estimate(best.get())));
+  }
+}
+
+TEST_CASE("EGraph finds the cheaper forms", "[egraph]") {
+  ExpressionEvaluator evaluator;
+  CostModel model;
+  SaturationLimits limits;
+  // factoring
+  unique_ptr<Expression> e(evaluator.evaluate("sin(x)*cos(x)+sin(x)*exp(x)"));
+  unique_ptr<Expression> best(EGraph::simplify(e.get(), limits, model));
+  REQUIRE(occurrences(best->stringPrint(), "sin") == 1);
+  // exp(a)*exp(b)=exp(a+b)
+  e.reset(evaluator.evaluate("exp(x)*exp(x*x)"));
+  best.reset(EGraph::simplify(e.get(), limits, model));
+  REQUIRE(occurrences(best->stringPrint(), "exp") == 1);
+  // sin/cos=tan
+  e.reset(evaluator.evaluate("sin(x)/cos(x)"));
+  best.reset(EGraph::simplify(e.get(), limits, model));
+  REQUIRE(best->stringPrint() == "tan(x)");
+  e.reset(evaluator.evaluate("log(exp(x+1))"));
+  best.reset(EGraph::simplify(e.get(), limits, model));
+  REQUIRE((*best)(2) == Approx(3));
+  REQUIRE(occurrences(best->stringPrint(), "log") == 0);
+}
+
+TEST_CASE("EGraph classes and budgets", "[egraph]") {
+  ExpressionEvaluator evaluator;
+  unique_ptr<Expression> a(evaluator.evaluate("exp(x)*exp(x*x)"));
+  unique_ptr<Expression> b(evaluator.evaluate("exp(x+x*x)"));
+  EGraph g((CostModel()));
+  EGraph::ClassId ia = g.add(a.get());
+  EGraph::ClassId ib = g.add(b.get());
+  REQUIRE(g.find(ia) != g.find(ib));
+  REQUIRE(g.saturate());
+  REQUIRE(g.find(ia) == g.find(ib));
+
+  // a wide sum doesn't saturate within a small budget, but still gives a
+  // valid expression
+  unique_ptr<Expression> wide(evaluator.evaluate(
+      "sin(x)+cos(x)+exp(x)+log(x)+tan(x)+sin(x)*exp(x)+cos(x)*log(x)+tan(x)/x"));
+  EGraph small((CostModel()));
+  EGraph::ClassId root = small.add(wide.get());
+  SaturationLimits limits;
+  limits.maxNodes = 300;
+  REQUIRE_FALSE(small.saturate(limits));
+  REQUIRE(small.nodeCount() < 10 * limits.maxNodes);
+  unique_ptr<Expression> best(small.extract(root));
+  REQUIRE((*best)(0.7) == Approx((*wide)(0.7)));
+}
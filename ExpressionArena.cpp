@@ -0,0 +1,71 @@
+#include "ExpressionArena.h"
+
+using namespace std;
+
+namespace {
+
+thread_local ExpressionArena *currentArena = NULL;
+
+} // namespace
+
+ExpressionArena::ExpressionArena() :
+    currentBlock(0), top(NULL), end(NULL), used(0) {
+}
+
+ExpressionArena::~ExpressionArena() {
+  for (auto it = blocks.begin(); it != blocks.end(); it++)
+    ::operator delete(*it);
+  for (auto it = largeBlocks.begin(); it != largeBlocks.end(); it++)
+    ::operator delete(*it);
+}
+
+void *ExpressionArena::allocateSlow(size_t size) {
+  used += size;
+  if (size > BlockSize / 4) {
+    // oversized, gets a block of its own so that the current one isn't wasted
+    char *p = static_cast<char *>(::operator new(size));
+    largeBlocks.push_back(p);
+    return p;
+  }
+  if (top != NULL)
+    currentBlock++;
+  if (currentBlock == blocks.size())
+    blocks.push_back(static_cast<char *>(::operator new(BlockSize)));
+  top = blocks[currentBlock] + size;
+  end = blocks[currentBlock] + BlockSize;
+  return blocks[currentBlock];
+}
+
+void ExpressionArena::reset() {
+  for (auto it = largeBlocks.begin(); it != largeBlocks.end(); it++)
+    ::operator delete(*it);
+  largeBlocks.clear();
+  currentBlock = 0;
+  if (blocks.empty()) {
+    top = end = NULL;
+  } else {
+    top = blocks[0];
+    end = blocks[0] + BlockSize;
+  }
+  used = 0;
+}
+
+ExpressionArena *ExpressionArena::current() {
+  return currentArena;
+}
+
+ExpressionArena::Scope::Scope(ExpressionArena &arena) : previous(currentArena) {
+  currentArena = &arena;
+}
+
+ExpressionArena::Scope::~Scope() {
+  currentArena = previous;
+}
+
+ExpressionArena::HeapScope::HeapScope() : previous(currentArena) {
+  currentArena = NULL;
+}
+
+ExpressionArena::HeapScope::~HeapScope() {
+  currentArena = previous;
+}
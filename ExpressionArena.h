@@ -0,0 +1,132 @@
+#ifndef EXPRESSIONARENA_H
+#define EXPRESSIONARENA_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Region allocator for expression trees.
+// While a Scope is alive on a thread, every Expression created on that
+// thread, together with the storage of its children set and polynomial
+// coefficients, is bump-allocated in the scope's arena. Deleting such a
+// node runs its destructor but frees nothing; reset() releases everything
+// allocated in the arena at once, without walking the trees. The blocks
+// are kept for the next round, so a loop that parses, differentiates and
+// simplifies into the same arena stops calling malloc once warm.
+// Nodes of an arena must not be used, nor deleted, after its reset().
+// Nodes allocated outside of any scope come from the heap as before, and
+// a tree should not mix both: the children created by simplify() come
+// from the arena current at that time.
+class ExpressionArena {
+  std::vector<char *> blocks;
+  std::vector<char *> largeBlocks;
+  size_t currentBlock;
+  char *top;
+  char *end;
+  size_t used;
+
+  static const size_t BlockSize = 64 * 1024;
+
+  ExpressionArena(const ExpressionArena &);
+  ExpressionArena &operator=(const ExpressionArena &);
+  void *allocateSlow(size_t size);
+ public:
+  static const size_t Alignment = 16;
+
+  ExpressionArena();
+  ~ExpressionArena();
+
+  void *allocate(size_t size) {
+    size = (size + Alignment - 1) & ~(Alignment - 1);
+    if (static_cast<size_t>(end - top) < size)
+      return allocateSlow(size);
+    void *p = top;
+    top += size;
+    used += size;
+    return p;
+  }
+
+  // frees every allocation, keeps the blocks for reuse
+  void reset();
+
+  // bytes handed out since the last reset
+  size_t bytesUsed() const { return used; }
+
+  // blocks obtained from the heap, including oversized allocations
+  size_t blockCount() const { return blocks.size() + largeBlocks.size(); }
+
+  // the arena of the innermost Scope of this thread, NULL if none
+  static ExpressionArena *current();
+
+  // makes an arena the current one of this thread for its lifetime
+  class Scope {
+    ExpressionArena *previous;
+
+    Scope(const Scope &);
+    Scope &operator=(const Scope &);
+   public:
+    explicit Scope(ExpressionArena &arena);
+    ~Scope();
+  };
+
+  // makes the heap current on this thread for its lifetime, for trees
+  // that must outlive the arenas of the caller
+  class HeapScope {
+    ExpressionArena *previous;
+
+    HeapScope(const HeapScope &);
+    HeapScope &operator=(const HeapScope &);
+   public:
+    HeapScope();
+    ~HeapScope();
+  };
+};
+
+// std allocator bound to the arena current at its construction, or to the
+// heap outside of any scope.
+template<class T>
+class ArenaAllocator {
+  template<class U> friend class ArenaAllocator;
+  ExpressionArena *arena;
+ public:
+  typedef T value_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template<class U>
+  struct rebind {
+    typedef ArenaAllocator<U> other;
+  };
+
+  ArenaAllocator() : arena(ExpressionArena::current()) { }
+
+  template<class U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) { }
+
+  // copies of a container go to the arena current at the copy, like the
+  // node holding them
+  ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+
+  T *allocate(size_t n) {
+    if (arena)
+      return static_cast<T *>(arena->allocate(n * sizeof(T)));
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *p, size_t) {
+    if (!arena)
+      ::operator delete(p);
+  }
+
+  template<class U>
+  bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+
+  template<class U>
+  bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
+
+#endif // EXPRESSIONARENA_H
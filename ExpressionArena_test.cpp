@@ -0,0 +1,68 @@
+#include "catch.hpp"
+#include <cmath>
+#include "function.h"
+#include "ExpressionEvaluator.h"
+#include "ExpressionArena.h"
+using namespace std;
+
+TEST_CASE("ExpressionArena bump allocation", "[arena]") {
+  ExpressionArena arena;
+  REQUIRE(ExpressionArena::current() == NULL);
+  char *a = static_cast<char *>(arena.allocate(3));
+  char *b = static_cast<char *>(arena.allocate(40));
+  REQUIRE(reinterpret_cast<size_t>(a) % ExpressionArena::Alignment == 0);
+  REQUIRE(b == a + ExpressionArena::Alignment);
+  REQUIRE(arena.bytesUsed() == 64);
+  arena.allocate(1 << 20);
+  REQUIRE(arena.blockCount() == 2);
+  arena.reset();
+  REQUIRE(arena.bytesUsed() == 0);
+  REQUIRE(arena.blockCount() == 1);
+  REQUIRE(arena.allocate(8) == a);
+}
+
+TEST_CASE("ExpressionArena scopes", "[arena]") {
+  ExpressionArena outer, inner;
+  {
+    ExpressionArena::Scope s1(outer);
+    REQUIRE(ExpressionArena::current() == &outer);
+    {
+      ExpressionArena::Scope s2(inner);
+      REQUIRE(ExpressionArena::current() == &inner);
+    }
+    REQUIRE(ExpressionArena::current() == &outer);
+  }
+  REQUIRE(ExpressionArena::current() == NULL);
+}
+
+TEST_CASE("Expressions allocated in an arena", "[arena]") {
+  ExpressionEvaluator evaluator;
+  Expression *heap = evaluator.evaluate("sin(x)/x+cos(x)*x*x");
+  Expression *heapDiff = heap->diffSimplify();
+  ExpressionArena arena;
+  size_t blocks = 0;
+  for (int round = 0; round < 5; round++) {
+    ExpressionArena::Scope scope(arena);
+    Expression *e = evaluator.evaluate("sin(x)/x+cos(x)*x*x");
+    Expression *d = e->diffSimplify();
+    REQUIRE(arena.bytesUsed() > 0);
+    REQUIRE(d->stringPrint() == heapDiff->stringPrint());
+    for (double x = 0.5; x < 3; x += 0.5)
+      REQUIRE((*d)(x) == Approx((*heapDiff)(x)));
+    // deleting frees nothing, the trees go away with the reset
+    size_t used = arena.bytesUsed();
+    delete d;
+    REQUIRE(arena.bytesUsed() == used);
+    arena.reset();
+    // blocks are reused from the second round on
+    if (round == 0)
+      blocks = arena.blockCount();
+    REQUIRE(arena.blockCount() == blocks);
+  }
+  // clones made outside of the scope come from the heap again
+  Expression *copy = heap->clone();
+  REQUIRE(copy->stringPrint() == heap->stringPrint());
+  delete copy;
+  delete heapDiff;
+  delete heap;
+}
@@ -0,0 +1,454 @@
+#include "ExpressionDag.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+void combine(size_t &seed, size_t v) {
+  seed ^= v + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+}
+
+size_t doubleBits(double v) {
+  unsigned long long bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return static_cast<size_t>(bits);
+}
+
+double applyFunction(ExpressionDag::Op op, double t) {
+  switch (op) {
+    case ExpressionDag::Sin:
+      return sin(t);
+    case ExpressionDag::Cos:
+      return cos(t);
+    case ExpressionDag::Tan:
+      return tan(t);
+    case ExpressionDag::Exp:
+      return exp(t);
+    case ExpressionDag::Log:
+      return log(t);
+    default:
+      throw invalid_argument("not an elementary function in ExpressionDag");
+  }
+}
+
+double polynomialValue(const vector<double> &para, double t) {
+  double xPowerK = 1;
+  double sum = 0;
+  for (auto it = para.begin(); it != para.end(); it++) {
+    sum += (*it) * xPowerK;
+    xPowerK *= t;
+  }
+  return sum;
+}
+
+} // namespace
+
+size_t ExpressionDag::hash(const Node &n) {
+  size_t seed = n.op;
+  combine(seed, doubleBits(n.value));
+  for (auto it = n.children.begin(); it != n.children.end(); it++)
+    combine(seed, *it);
+  for (auto it = n.coefficients.begin(); it != n.coefficients.end(); it++)
+    combine(seed, doubleBits(*it));
+  return seed;
+}
+
+bool ExpressionDag::equal(const Node &a, const Node &b) {
+  // constants are compared bitwise so that 0 and -0 stay distinct
+  return a.op == b.op && doubleBits(a.value) == doubleBits(b.value)
+      && a.children == b.children && a.coefficients.size() == b.coefficients.size()
+      && std::equal(a.coefficients.begin(), a.coefficients.end(), b.coefficients.begin(),
+                    [](double u, double v) { return doubleBits(u) == doubleBits(v); });
+}
+
+ExpressionDag::Id ExpressionDag::intern(const Node &n) {
+  size_t h = hash(n);
+  auto range = index.equal_range(h);
+  for (auto it = range.first; it != range.second; it++) {
+    if (equal(nodes[it->second], n))
+      return it->second;
+  }
+  Id id = nodes.size();
+  nodes.push_back(n);
+  index.insert(make_pair(h, id));
+  return id;
+}
+
+ExpressionDag::Id ExpressionDag::constant(double c) {
+  Node n;
+  n.op = Const;
+  n.value = c;
+  return intern(n);
+}
+
+ExpressionDag::Id ExpressionDag::variable() {
+  Node n;
+  n.op = X;
+  n.value = 0;
+  return intern(n);
+}
+
+// flattens nested operators of the same kind, folds the constants and
+// sorts the operands so that a+b and b+a are the same node
+ExpressionDag::Id ExpressionDag::commutative(Op op, const vector<Id> &operands) {
+  double neutral = op == Add ? 0 : 1;
+  double folded = neutral;
+  Node n;
+  n.op = op;
+  n.value = 0;
+  vector<Id> pending(operands.rbegin(), operands.rend());
+  while (!pending.empty()) {
+    Id id = pending.back();
+    pending.pop_back();
+    const Node &child = nodes[id];
+    if (child.op == Const) {
+      folded = op == Add ? folded + child.value : folded * child.value;
+    } else if (child.op == op) {
+      pending.insert(pending.end(), child.children.rbegin(), child.children.rend());
+    } else {
+      n.children.push_back(id);
+    }
+  }
+  // 0*a=0
+  if (op == Multi && folded == 0)
+    return constant(0);
+  if (folded != neutral || n.children.empty())
+    n.children.push_back(constant(folded));
+  if (n.children.size() == 1)
+    return n.children[0];
+  sort(n.children.begin(), n.children.end());
+  return intern(n);
+}
+
+ExpressionDag::Id ExpressionDag::add(Id a, Id b) {
+  vector<Id> terms;
+  terms.push_back(a);
+  terms.push_back(b);
+  return commutative(Add, terms);
+}
+
+ExpressionDag::Id ExpressionDag::add(const vector<Id> &terms) {
+  return commutative(Add, terms);
+}
+
+ExpressionDag::Id ExpressionDag::multi(Id a, Id b) {
+  vector<Id> factors;
+  factors.push_back(a);
+  factors.push_back(b);
+  return commutative(Multi, factors);
+}
+
+ExpressionDag::Id ExpressionDag::multi(const vector<Id> &factors) {
+  return commutative(Multi, factors);
+}
+
+ExpressionDag::Id ExpressionDag::divide(Id numerator, Id denominator) {
+  const Node &num = nodes[numerator];
+  const Node &den = nodes[denominator];
+  if (den.op == Const && den.value == 1)
+    return numerator;
+  if (num.op == Const && den.op == Const)
+    return constant(num.value / den.value);
+  if (num.op == Const && num.value == 0)
+    return constant(0);
+  Node n;
+  n.op = Divide;
+  n.value = 0;
+  n.children.push_back(numerator);
+  n.children.push_back(denominator);
+  return intern(n);
+}
+
+ExpressionDag::Id ExpressionDag::polynomial(const vector<double> &coefficients, Id argument) {
+  vector<double> para = coefficients;
+  // clear zeros at the end of list
+  while (!para.empty() && para.back() == 0)
+    para.pop_back();
+  if (para.empty())
+    return constant(0);
+  if (para.size() == 1)
+    return constant(para[0]);
+  if (nodes[argument].op == Const)
+    return constant(polynomialValue(para, nodes[argument].value));
+  Node n;
+  n.op = Poly;
+  n.value = 0;
+  n.children.push_back(argument);
+  n.coefficients.swap(para);
+  return intern(n);
+}
+
+ExpressionDag::Id ExpressionDag::apply(Op op, Id argument) {
+  if (op < Sin)
+    throw invalid_argument("not an elementary function in ExpressionDag");
+  if (nodes[argument].op == Const)
+    return constant(applyFunction(op, nodes[argument].value));
+  Node n;
+  n.op = op;
+  n.value = 0;
+  n.children.push_back(argument);
+  return intern(n);
+}
+
+ExpressionDag::Id ExpressionDag::fromExpression(const Expression *e) {
+  if (!e) throw invalid_argument("null expression in ExpressionDag");
+  return fromExpression(e, variable());
+}
+
+// x is the node standing for the variable, the right side of the
+// enclosing compositions
+ExpressionDag::Id ExpressionDag::fromExpression(const Expression *e, Id x) {
+  switch (e->nodeType()) {
+    case Expression::TypeConstant:
+      return constant(static_cast<const Constant *>(e)->value());
+    case Expression::TypeVariable:
+      return x;
+    case Expression::TypeAdd:
+    case Expression::TypeMulti: {
+      const ExpressionSet &children = static_cast<const CommutativeOperators *>(e)->getChildren();
+      vector<Id> operands;
+      for (auto it = children.begin(); it != children.end(); it++)
+        operands.push_back(fromExpression(*it, x));
+      return commutative(e->nodeType() == Expression::TypeAdd ? Add : Multi, operands);
+    }
+    case Expression::TypeDivide: {
+      const Division *d = static_cast<const Division *>(e);
+      Id numerator = fromExpression(d->getNumerator(), x);
+      return divide(numerator, fromExpression(d->getDenominator(), x));
+    }
+    case Expression::TypeCompo: {
+      const Composition *c = static_cast<const Composition *>(e);
+      return fromExpression(c->getLeft(), fromExpression(c->getRight(), x));
+    }
+    case Expression::TypePoly:
+      return polynomial(static_cast<const Polynomial *>(e)->getParameter(), x);
+    case Expression::TypeTrigo:
+      switch (static_cast<const Trigo *>(e)->getTrigoType()) {
+        case Trigo::Sin:
+          return apply(Sin, x);
+        case Trigo::Cos:
+          return apply(Cos, x);
+        case Trigo::Tan:
+          return apply(Tan, x);
+      }
+      throw invalid_argument("unsupported trigonometric function in ExpressionDag");
+    case Expression::TypeExp:
+      return apply(Exp, x);
+    case Expression::TypeLog:
+      return apply(Log, x);
+    default:
+      throw invalid_argument("unsupported expression in ExpressionDag");
+  }
+}
+
+Expression *ExpressionDag::toExpression(Id id) const {
+  const Node &n = nodes[id];
+  Expression *f;
+  switch (n.op) {
+    case Const:
+      return new Constant(n.value);
+    case X:
+      return new VariableX;
+    case Add:
+    case Multi: {
+      ExpressionSet children;
+      for (auto it = n.children.begin(); it != n.children.end(); it++)
+        children.insert(toExpression(*it));
+      if (n.op == Add)
+        return new Addition(children);
+      return new Multiplication(children);
+    }
+    case Divide: {
+      Expression *numerator = toExpression(n.children[0]);
+      return new Division(numerator, toExpression(n.children[1]));
+    }
+    case Poly:
+      f = new Polynomial(n.coefficients);
+      break;
+    case Sin:
+      f = new Trigo(Trigo::Sin);
+      break;
+    case Cos:
+      f = new Trigo(Trigo::Cos);
+      break;
+    case Tan:
+      f = new Trigo(Trigo::Tan);
+      break;
+    case Exp:
+      f = new Exponential;
+      break;
+    case Log:
+      f = new Logarithm;
+      break;
+  }
+  if (nodes[n.children[0]].op == X)
+    return f;
+  return new Composition(f, toExpression(n.children[0]));
+}
+
+ExpressionDag::Id ExpressionDag::diff(Id id) {
+  auto found = derivatives.find(id);
+  if (found != derivatives.end())
+    return found->second;
+  // copied, interning new nodes may move the node storage
+  Node n = nodes[id];
+  Id d;
+  switch (n.op) {
+    case Const:
+      d = constant(0);
+      break;
+    case X:
+      d = constant(1);
+      break;
+    case Add: {
+      vector<Id> terms;
+      for (auto it = n.children.begin(); it != n.children.end(); it++)
+        terms.push_back(diff(*it));
+      d = add(terms);
+      break;
+    }
+    case Multi: {
+      // (abc)' = a'bc + ab'c + abc'
+      vector<Id> terms;
+      for (size_t k = 0; k < n.children.size(); k++) {
+        vector<Id> factors = n.children;
+        factors[k] = diff(n.children[k]);
+        terms.push_back(multi(factors));
+      }
+      d = add(terms);
+      break;
+    }
+    case Divide: {
+      // (u/v)' = (u'v - uv') / (v*v)
+      Id u = n.children[0], v = n.children[1];
+      vector<Id> minusUDv;
+      minusUDv.push_back(constant(-1));
+      minusUDv.push_back(u);
+      minusUDv.push_back(diff(v));
+      Id numerator = add(multi(diff(u), v), multi(minusUDv));
+      d = divide(numerator, multi(v, v));
+      break;
+    }
+    case Poly: {
+      vector<double> para;
+      for (size_t k = 1; k < n.coefficients.size(); k++)
+        para.push_back(k * n.coefficients[k]);
+      d = multi(polynomial(para, n.children[0]), diff(n.children[0]));
+      break;
+    }
+    case Sin:
+      d = multi(apply(Cos, n.children[0]), diff(n.children[0]));
+      break;
+    case Cos: {
+      vector<Id> factors;
+      factors.push_back(constant(-1));
+      factors.push_back(apply(Sin, n.children[0]));
+      factors.push_back(diff(n.children[0]));
+      d = multi(factors);
+      break;
+    }
+    case Tan: {
+      Id c = apply(Cos, n.children[0]);
+      d = divide(diff(n.children[0]), multi(c, c));
+      break;
+    }
+    case Exp:
+      d = multi(id, diff(n.children[0]));
+      break;
+    case Log:
+      d = divide(diff(n.children[0]), n.children[0]);
+      break;
+  }
+  derivatives[id] = d;
+  return d;
+}
+
+double ExpressionDag::evaluate(Id root, double x) const {
+  // children have smaller Ids than their parents, so visiting the
+  // reachable nodes by increasing Id evaluates operands first
+  vector<char> reachable(root + 1, 0);
+  vector<Id> pending(1, root);
+  reachable[root] = 1;
+  while (!pending.empty()) {
+    const Node &n = nodes[pending.back()];
+    pending.pop_back();
+    for (auto it = n.children.begin(); it != n.children.end(); it++) {
+      if (!reachable[*it]) {
+        reachable[*it] = 1;
+        pending.push_back(*it);
+      }
+    }
+  }
+  vector<double> values(root + 1);
+  for (Id id = 0; id <= root; id++) {
+    if (!reachable[id])
+      continue;
+    const Node &n = nodes[id];
+    double v;
+    switch (n.op) {
+      case Const:
+        v = n.value;
+        break;
+      case X:
+        v = x;
+        break;
+      case Add:
+        v = 0;
+        for (auto it = n.children.begin(); it != n.children.end(); it++)
+          v += values[*it];
+        break;
+      case Multi:
+        v = 1;
+        for (auto it = n.children.begin(); it != n.children.end(); it++)
+          v *= values[*it];
+        break;
+      case Divide:
+        v = values[n.children[0]] / values[n.children[1]];
+        break;
+      case Poly:
+        v = polynomialValue(n.coefficients, values[n.children[0]]);
+        break;
+      default:
+        v = applyFunction(n.op, values[n.children[0]]);
+        break;
+    }
+    values[id] = v;
+  }
+  return values[root];
+}
+
+size_t ExpressionDag::dagSize(Id root) const {
+  vector<char> reachable(root + 1, 0);
+  vector<Id> pending(1, root);
+  reachable[root] = 1;
+  size_t count = 1;
+  while (!pending.empty()) {
+    const Node &n = nodes[pending.back()];
+    pending.pop_back();
+    for (auto it = n.children.begin(); it != n.children.end(); it++) {
+      if (!reachable[*it]) {
+        reachable[*it] = 1;
+        pending.push_back(*it);
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+double ExpressionDag::treeSize(Id root) const {
+  // double, the count grows exponentially with the depth of sharing
+  vector<double> sizes(root + 1);
+  for (Id id = 0; id <= root; id++) {
+    const Node &n = nodes[id];
+    double s = 1;
+    for (auto it = n.children.begin(); it != n.children.end(); it++)
+      s += sizes[*it];
+    sizes[id] = s;
+  }
+  return sizes[root];
+}
@@ -0,0 +1,79 @@
+#ifndef EXPRESSIONDAG_H
+#define EXPRESSIONDAG_H
+
+#include "function.h"
+#include <unordered_map>
+
+// Hash-consed, immutable form of expressions.
+// Nodes are created through the factory methods only, which look up an
+// identical node before creating a new one, so every structure exists
+// once and is shared by all the expressions using it. A node is named by
+// its Id, an index into the factory, and is never modified nor freed
+// before the factory itself.
+// Compositions are expanded at construction: sin(x) composed with g is
+// stored as the node Sin whose argument is g, so every node is a function
+// of the same x. Children are always created before their parents, so
+// Ids are in topological order.
+// The factory methods apply the local rules of Expression::simplify that
+// don't need to look inside children (flattening of sums and products,
+// folding of constants, neutral and absorbing elements), so nodes are
+// always simplified and diff() doesn't need a separate simplification.
+class ExpressionDag {
+ public:
+  typedef int Id;
+  enum Op {
+    Const, X, Add, Multi, Divide, Poly, Sin, Cos, Tan, Exp, Log
+  };
+  struct Node {
+    Op op;
+    double value;                       // Const
+    std::vector<Id> children;           // operands, or the argument of a function
+    std::vector<double> coefficients;   // Poly
+  };
+ private:
+  std::vector<Node> nodes;
+  std::unordered_multimap<size_t, Id> index;
+  std::unordered_map<Id, Id> derivatives;
+
+  static size_t hash(const Node &n);
+  static bool equal(const Node &a, const Node &b);
+  Id intern(const Node &n);
+  Id commutative(Op op, const std::vector<Id> &operands);
+  Id fromExpression(const Expression *e, Id x);
+ public:
+  ExpressionDag() { }
+
+  Id constant(double c);
+  Id variable();
+  Id add(Id a, Id b);
+  Id add(const std::vector<Id> &terms);
+  Id multi(Id a, Id b);
+  Id multi(const std::vector<Id> &factors);
+  Id divide(Id numerator, Id denominator);
+  Id polynomial(const std::vector<double> &coefficients, Id argument);
+  // op is one of Sin, Cos, Tan, Exp, Log
+  Id apply(Op op, Id argument);
+
+  Id fromExpression(const Expression *e);
+  // a new tree, shared nodes are copied as many times as they are used
+  Expression *toExpression(Id id) const;
+
+  // derivative with respect to x, memoized: every node is differentiated
+  // once, however many times it is shared
+  Id diff(Id id);
+
+  // value at x, every node reachable from root is evaluated once
+  double evaluate(Id root, double x) const;
+
+  const Node &node(Id id) const { return nodes[id]; }
+
+  // number of distinct nodes in the factory
+  size_t size() const { return nodes.size(); }
+
+  // number of distinct nodes reachable from root
+  size_t dagSize(Id root) const;
+  // number of nodes if every shared node were copied at each of its uses
+  double treeSize(Id root) const;
+};
+
+#endif // EXPRESSIONDAG_H
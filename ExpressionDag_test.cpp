@@ -0,0 +1,91 @@
+#include "catch.hpp"
+#include <cmath>
+#include <string>
+#include "function.h"
+#include "ExpressionEvaluator.h"
+#include "ExpressionDag.h"
+using namespace std;
+
+static const char *dagCorpus[] = {
+    "1", "x", "2-x", "x*x", "x+x*x", "2*x*x*x-x/3", "x*sin(x)", "sin(x)/x", "log(x)",
+    "tan(x)", "cos(x)*exp(x)", "sin(cos(x))", "exp(sin(x)*x)-log(x+2)",
+    "(2/x)/(sin(x)/exp(x))", "tan(x*x)/(1+x*x)"
+};
+
+TEST_CASE("ExpressionDag keeps the value of the tree", "[dag]") {
+  ExpressionEvaluator evaluator;
+  for (auto s : dagCorpus) {
+    Expression *e = evaluator.evaluate(s);
+    ExpressionDag dag;
+    ExpressionDag::Id id = dag.fromExpression(e);
+    Expression *back = dag.toExpression(id);
+    for (double x = 0.15; x < 3; x += 0.35) {
+      REQUIRE(dag.evaluate(id, x) == Approx((*e)(x)));
+      REQUIRE((*back)(x) == Approx((*e)(x)));
+    }
+    delete back;
+    delete e;
+  }
+}
+
+TEST_CASE("ExpressionDag interns identical structures", "[dag]") {
+  ExpressionEvaluator evaluator;
+  ExpressionDag dag;
+  Expression *a = evaluator.evaluate("x*sin(x)+exp(x*sin(x))");
+  Expression *b = evaluator.evaluate("exp(sin(x)*x)+sin(x)*x");
+  ExpressionDag::Id ia = dag.fromExpression(a);
+  size_t size = dag.size();
+  REQUIRE(dag.fromExpression(b) == ia);
+  REQUIRE(dag.size() == size);
+  // x*sin(x) appears once, under the sum and under exp
+  REQUIRE(dag.dagSize(ia) == 5);
+  REQUIRE(dag.treeSize(ia) == 10);
+
+  ExpressionDag::Id x = dag.variable();
+  REQUIRE(dag.add(x, dag.constant(0)) == x);
+  REQUIRE(dag.multi(x, dag.constant(1)) == x);
+  REQUIRE(dag.multi(dag.apply(ExpressionDag::Sin, x), dag.constant(0)) == dag.constant(0));
+  REQUIRE(dag.add(dag.add(x, dag.constant(1)), dag.constant(2))
+              == dag.add(dag.constant(3), x));
+  delete a;
+  delete b;
+}
+
+TEST_CASE("ExpressionDag derivatives", "[dag]") {
+  ExpressionEvaluator evaluator;
+  for (auto s : dagCorpus) {
+    Expression *e = evaluator.evaluate(s);
+    ExpressionDag dag;
+    ExpressionDag::Id id = dag.fromExpression(e);
+    ExpressionDag::Id d = dag.diff(id);
+    ExpressionDag::Id dd = dag.diff(d);
+    REQUIRE(dag.diff(id) == d);
+    Expression *derivative = dag.toExpression(d);
+    for (double x = 0.15; x < 3; x += 0.35) {
+      REQUIRE(dag.evaluate(d, x) == Approx((*e)(Dual(x, 1)).derivative));
+      REQUIRE(dag.evaluate(dd, x) == Approx((*derivative)(Dual(x, 1)).derivative));
+    }
+    delete derivative;
+    delete e;
+  }
+}
+
+TEST_CASE("ExpressionDag derivatives share their subexpressions", "[dag]") {
+  ExpressionEvaluator evaluator;
+  string s = "x";
+  for (int i = 0; i < 20; i++)
+    s = "sin(" + s + ")*x";
+  Expression *e = evaluator.evaluate(s);
+  ExpressionDag dag;
+  ExpressionDag::Id d = dag.fromExpression(e);
+  for (int k = 0; k < 3; k++)
+    d = dag.diff(d);
+  // a tree would copy the nested sines into every term of the product rule
+  REQUIRE(dag.treeSize(d) > 1e6);
+  REQUIRE(dag.dagSize(d) < 2000);
+  Expression *second = dag.toExpression(dag.diff(dag.diff(dag.fromExpression(e))));
+  for (double x = 0.15; x < 3; x += 0.35)
+    REQUIRE(dag.evaluate(d, x) == Approx((*second)(Dual(x, 1)).derivative));
+  delete second;
+  delete e;
+}
@@ -3,7 +3,8 @@
 //
 
 #include "ExpressionEvaluator.h"
-#include <sstream>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 
 using namespace std;
@@ -28,283 +29,288 @@ OperatorPrecedence::Order Symbol::precedence() {
   }
 }
 
-void ExpressionEvaluator::stringDecomposition() {
-  stringstream ss;
-  ss << this->expression;
-  char c;
-  while ((c = ss.peek()) != EOF) {
-    if (c == ' ') {
-      ss.get();
-      continue;
-    } else if ((c >= '0' && c <= '9') || c == '.') {
-      double x;
-      ss >> x;
-      if (ss.fail()) throw invalid_argument("invalid expression");
-      symbolQueue.push(Symbol(x));
-    } else if (c == '+') {
-      ss.get();
-      if (symbolQueue.size() == 0) {
-        symbolQueue.push(Symbol(Symbol::Positive));
-      } else {
-        switch (symbolQueue.back().type) {
-          case Symbol::FunName:
-          case Symbol::Number:
-          case Symbol::theVariableX:
-          case Symbol::RightParenthese:
-            symbolQueue.push(Symbol(Symbol::Add));
-            break;
-          default:
-            symbolQueue.push(Symbol(Symbol::Positive));
-            break;
-        }
-      }
-    } else if (c == '-') {
-      ss.get();
-      if (symbolQueue.size() == 0) {
-        symbolQueue.push(Symbol(Symbol::Negative));
-      } else {
-        switch (symbolQueue.back().type) {
-          case Symbol::FunName:
-          case Symbol::Number:
-          case Symbol::theVariableX:
-          case Symbol::RightParenthese:
-            symbolQueue.push(Symbol(Symbol::Sub));
-            break;
-          default:
-            symbolQueue.push(Symbol(Symbol::Negative));
-            break;
-        }
-      }
-    } else if (c == '*') {
-      ss.get();
-      symbolQueue.push(Symbol(Symbol::Multi));
-    } else if (c == '/') {
-      ss.get();
-      symbolQueue.push(Symbol(Symbol::Divide));
-    } else if (c == '^') {
-      ss.get();
-      symbolQueue.push(Symbol(Symbol::Power));
-    } else if (c == '(') {
-      ss.get();
-      symbolQueue.push(Symbol(Symbol::LeftParenthese));
-    } else if (c == ')') {
-      ss.get();
-      symbolQueue.push(Symbol(Symbol::RightParenthese));
-    } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
-      // identifiers
-      string name;
-      char next;
-      do {// get full name string
-        name.push_back(ss.get());
-        next = ss.peek();
-      } while ((next >= 'a' && next <= 'z')
-          || (next >= 'A' && next <= 'Z')
-          || (next >= '0' && next <= '9')
-          || next == '_');
-      if (name == "sin")
-        symbolQueue.push(Symbol(Sin));
-      else if (name == "cos")
-        symbolQueue.push(Symbol(Cos));
-      else if (name == "tan")
-        symbolQueue.push(Symbol(Tan));
-      else if (name == "exp")
-        symbolQueue.push(Symbol(Exp));
-      else if (name == "log")
-        symbolQueue.push(Symbol(Log));
-      else if (name == "x")
-        symbolQueue.push(Symbol(Symbol::theVariableX));
-      else
-        throw invalid_argument("invalid function name");
+namespace {
+
+const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+inline bool isLetter(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// Reads digits[.digits][e[+-]digits] at p, like std::from_chars. Returns
+// the end of the number, NULL when there is no digit.
+// Up to 19 significant digits are gathered into an integer; when both it
+// and the power of ten are exact doubles, one multiplication or division
+// gives the correctly rounded value. Other numbers go through strtod.
+const char *parseNumber(const char *p, const char *end, double &value) {
+  const char *start = p;
+  unsigned long long mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  for (; p < end && isDigit(*p); p++, any = true) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      if (mantissa)
+        digits++;
     } else {
-      throw invalid_argument("invalid symbol");
+      exponent++;
     }
   }
+  if (p < end && *p == '.') {
+    for (p++; p < end && isDigit(*p); p++, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa)
+          digits++;
+        exponent--;
+      }
+    }
+  }
+  if (!any)
+    return NULL;
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char *q = p + 1;
+    bool negative = false;
+    if (q < end && (*q == '+' || *q == '-'))
+      negative = *q++ == '-';
+    if (q < end && isDigit(*q)) {
+      int e = 0;
+      for (; q < end && isDigit(*q); q++)
+        if (e < 100000)
+          e = e * 10 + (*q - '0');
+      exponent += negative ? -e : e;
+      p = q;
+    }
+  }
+  if (mantissa < (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+    if (exponent < 0)
+      value = mantissa / powersOfTen[-exponent];
+    else
+      value = mantissa * powersOfTen[exponent];
+    return p;
+  }
+  string copy(start, p);
+  value = strtod(copy.c_str(), NULL);
+  return p;
+}
+
+inline bool nameIs(const char *name, size_t length, const char *word) {
+  return strlen(word) == length && memcmp(name, word, length) == 0;
+}
+
+// '+' and '-' are binary after an operand, unary elsewhere
+inline bool isOperand(Symbol::Type type) {
+  switch (type) {
+    case Symbol::FunName:
+    case Symbol::Number:
+    case Symbol::theVariableX:
+    case Symbol::RightParenthese:
+      return true;
+    default:
+      return false;
+  }
+}
 
+// reads the symbol at p into sym and moves p past it, returns false at
+// the end of the input
+bool scanSymbol(const char *&p, const char *end, bool afterOperand, Symbol &sym) {
+  while (p < end && *p == ' ')
+    p++;
+  if (p == end)
+    return false;
+  char c = *p;
+  if (isDigit(c) || c == '.') {
+    double x;
+    p = parseNumber(p, end, x);
+    if (!p) throw invalid_argument("invalid expression");
+    sym = Symbol(x);
+  } else if (c == '+') {
+    p++;
+    sym = Symbol(afterOperand ? Symbol::Add : Symbol::Positive);
+  } else if (c == '-') {
+    p++;
+    sym = Symbol(afterOperand ? Symbol::Sub : Symbol::Negative);
+  } else if (c == '*') {
+    p++;
+    sym = Symbol(Symbol::Multi);
+  } else if (c == '/') {
+    p++;
+    sym = Symbol(Symbol::Divide);
+  } else if (c == '^') {
+    p++;
+    sym = Symbol(Symbol::Power);
+  } else if (c == '(') {
+    p++;
+    sym = Symbol(Symbol::LeftParenthese);
+  } else if (c == ')') {
+    p++;
+    sym = Symbol(Symbol::RightParenthese);
+  } else if (isLetter(c)) {
+    // identifiers
+    const char *name = p;
+    do {
+      p++;
+    } while (p < end && (isLetter(*p) || isDigit(*p) || *p == '_'));
+    size_t length = p - name;
+    if (nameIs(name, length, "x"))
+      sym = Symbol(Symbol::theVariableX);
+    else if (nameIs(name, length, "sin"))
+      sym = Symbol(Sin);
+    else if (nameIs(name, length, "cos"))
+      sym = Symbol(Cos);
+    else if (nameIs(name, length, "tan"))
+      sym = Symbol(Tan);
+    else if (nameIs(name, length, "exp"))
+      sym = Symbol(Exp);
+    else if (nameIs(name, length, "log"))
+      sym = Symbol(Log);
+    else
+      throw invalid_argument("invalid function name");
+  } else {
+    throw invalid_argument("invalid symbol");
+  }
+  return true;
 }
 
-void ExpressionEvaluator::reversePolishNotation() {
-  // Shunting-yard algorithm
-  stack<Symbol> operators;
-  while (!symbolQueue.empty()) {
-    Symbol sym = symbolQueue.front();
-    symbolQueue.pop();
-    switch (sym.type) {
-      case Symbol::FunName:
-        if (symbolQueue.front().type != Symbol::LeftParenthese)
-          throw invalid_argument("funtion name must be followed by a '('");
-        symbolPolish.push(sym);
-        operators.push(Symbol(Symbol::ApplyFunction));
-        break;
-      case Symbol::Number:
-      case Symbol::theVariableX:
-        symbolPolish.push(sym);
-        break;
+} // namespace
+
+ExpressionEvaluator::ExpressionEvaluator()
+    : cursor(NULL), limit(NULL), lookahead(Symbol::Add), hasLookahead(false) { }
+
+const vector<Symbol> &ExpressionEvaluator::tokenize(const std::string &s) {
+  symbols.clear();
+  const char *p = s.data();
+  const char *end = p + s.size();
+  Symbol sym(Symbol::Add);
+  while (scanSymbol(p, end, !symbols.empty() && isOperand(symbols.back().type), sym))
+    symbols.push_back(sym);
+  return symbols;
+}
+
+void ExpressionEvaluator::advance() {
+  bool afterOperand = hasLookahead && isOperand(lookahead.type);
+  hasLookahead = scanSymbol(cursor, limit, afterOperand, lookahead);
+}
+
+// Precedence climbing: the loop takes the binary operators binding more
+// tightly than minimum, their right operand is parsed with their own
+// precedence as minimum, so operators of the same precedence associate to
+// the left.
+Expression *ExpressionEvaluator::parse(OperatorPrecedence::Order minimum) {
+  unique_ptr<Expression> left(parsePrefix());
+  while (hasLookahead) {
+    Symbol::Type type = lookahead.type;
+    if (type == Symbol::Power)
+      throw invalid_argument("power is not supported");
+    if (type != Symbol::Add && type != Symbol::Sub && type != Symbol::Multi
+        && type != Symbol::Divide)
+      break;
+    OperatorPrecedence::Order order = lookahead.precedence();
+    if (order <= minimum)
+      break;
+    advance();
+    unique_ptr<Expression> right(parse(order));
+    switch (type) {
       case Symbol::Add:
-      case Symbol::Sub:
-      case Symbol::Multi:
-      case Symbol::Divide:
-      case Symbol::Positive:
-      case Symbol::Negative:
-      case Symbol::Power:
-      case Symbol::ApplyFunction:
-        while (!operators.empty() && operators.top().type != Symbol::LeftParenthese) {
-          Symbol top = operators.top();
-          if (top.precedence() < sym.precedence())break;
-          symbolPolish.push(operators.top());
-          operators.pop();
-        }
-        operators.push(sym);
+        left.reset(new Addition(left.release(), right.release()));
         break;
-      case Symbol::RightParenthese:
-        while (!operators.empty()
-            && operators.top().type != Symbol::LeftParenthese) {
-          symbolPolish.push(operators.top());
-          operators.pop();
-        }
-        if (operators.empty())
-          throw invalid_argument("a '(' is missed in the expression");
-        assert(operators.top().type == Symbol::LeftParenthese);
-        operators.pop();
+      case Symbol::Sub:
+        left.reset(new Addition(left.release(),
+                                new Multiplication(new Constant(-1), right.release())));
         break;
-      case Symbol::LeftParenthese:
-        operators.push(sym);
+      case Symbol::Multi:
+        left.reset(new Multiplication(left.release(), right.release()));
         break;
       default:
-        assert(false);
-
+        left.reset(new Division(left.release(), right.release()));
+        break;
     }
-  } // while
-  while (!operators.empty()) {
-    if (operators.top().type == Symbol::LeftParenthese)
-      throw invalid_argument("a ')' is missed in the expression");
-    assert(operators.top().type != Symbol::RightParenthese);
-    symbolPolish.push(operators.top());
-    operators.pop();
   }
+  return left.release();
 }
 
-Expression *ExpressionEvaluator::constructTree() {
-  stack<Expression *> exprStack;
-  while (!symbolPolish.empty()) {
-    Symbol sym = symbolPolish.front();
-    symbolPolish.pop();
-    switch (sym.type) {
-      case Symbol::RightParenthese:
-      case Symbol::LeftParenthese:
-        //no parenthesis is possible in polish notation
-        assert(false);
-        break;
-      case Symbol::Number:
-        exprStack.push(new Constant(sym.number));
-        break;
-      case Symbol::Add: {
-        assert(exprStack.size() >= 2);
-        Expression *b = exprStack.top();
-        exprStack.pop();
-        Expression *a = exprStack.top();
-        exprStack.pop();
-        Expression *ab = new Addition(a, b);
-        exprStack.push(ab);
-        break;
-      }
-      case Symbol::Sub: {
-        assert(exprStack.size() >= 2);
-        Expression *b = exprStack.top();
-        exprStack.pop();
-        Expression *a = exprStack.top();
-        exprStack.pop();
-        Expression *ab = new Addition(a, new Multiplication(new Constant(-1), b));
-        exprStack.push(ab);
-        break;
-      }
-      case Symbol::Multi: {
-        assert(exprStack.size() >= 2);
-        Expression *b = exprStack.top();
-        exprStack.pop();
-        Expression *a = exprStack.top();
-        exprStack.pop();
-        Expression *ab = new Multiplication(a, b);
-        exprStack.push(ab);
-        break;
-      }
-      case Symbol::Divide: {
-        assert(exprStack.size() >= 2);
-        Expression *b = exprStack.top();
-        exprStack.pop();
-        Expression *a = exprStack.top();
-        exprStack.pop();
-        Expression *ab = new Division(a, b);
-        exprStack.push(ab);
-        break;
-      }
-      case Symbol::FunName: {
-        switch (sym.funName) {
-          case Sin:
-            exprStack.push(new Trigo(Trigo::Sin));
-            break;
-          case Cos:
-            exprStack.push(new Trigo(Trigo::Cos));
-            break;
-          case Tan:
-            exprStack.push(new Trigo(Trigo::Tan));
-            break;
-          case Log:
-            exprStack.push(new Logarithm);
-            break;
-          case Exp:
-            exprStack.push(new Exponential);
-            break;
-        }
-        break;
-      }
-      case Symbol::theVariableX:
-        exprStack.push(new VariableX);
-        break;
-      case Symbol::ApplyFunction: {
-        assert(exprStack.size() >= 2);
-        Expression *x = exprStack.top();
-        exprStack.pop();
-        Expression *f = exprStack.top();
-        exprStack.pop();
-        Expression *fx = new Composition(f, x);
-        exprStack.push(fx);
-        break;
-      }
-      case Symbol::Positive:
-        break;
-      case Symbol::Negative: {
-        assert(exprStack.size() >= 1);
-        Expression *a = exprStack.top();
-        exprStack.pop();
-        Expression *minus_a = new Multiplication(new Constant(-1), a);
-        exprStack.push(minus_a);
-        break;
+// a number, x, a signed operand, a parenthesized expression or a function
+// applied to one
+Expression *ExpressionEvaluator::parsePrefix() {
+  if (!hasLookahead)
+    throw invalid_argument("invalid expression");
+  Symbol sym = lookahead;
+  advance();
+  switch (sym.type) {
+    case Symbol::Number:
+      return new Constant(sym.number);
+    case Symbol::theVariableX:
+      return new VariableX;
+    case Symbol::Positive:
+      return parse(OperatorPrecedence::PositiveNegative);
+    case Symbol::Negative: {
+      // parsed first, the constant would leak if the operand throws
+      unique_ptr<Expression> operand(parse(OperatorPrecedence::PositiveNegative));
+      return new Multiplication(new Constant(-1), operand.release());
+    }
+    case Symbol::LeftParenthese: {
+      unique_ptr<Expression> inner(parse(OperatorPrecedence::None));
+      if (!hasLookahead || lookahead.type != Symbol::RightParenthese)
+        throw invalid_argument("a ')' is missed in the expression");
+      advance();
+      return inner.release();
+    }
+    case Symbol::FunName: {
+      if (!hasLookahead || lookahead.type != Symbol::LeftParenthese)
+        throw invalid_argument("funtion name must be followed by a '('");
+      Expression *argument = parsePrefix();
+      Expression *f;
+      switch (sym.funName) {
+        case Sin:
+          f = new Trigo(Trigo::Sin);
+          break;
+        case Cos:
+          f = new Trigo(Trigo::Cos);
+          break;
+        case Tan:
+          f = new Trigo(Trigo::Tan);
+          break;
+        case Log:
+          f = new Logarithm;
+          break;
+        default:
+          f = new Exponential;
+          break;
       }
+      return new Composition(f, argument);
     }
+    case Symbol::RightParenthese:
+      throw invalid_argument("a '(' is missed in the expression");
+    case Symbol::Power:
+      throw invalid_argument("power is not supported");
+    default:
+      throw invalid_argument("invalid expression");
   }
-  assert(exprStack.size() == 1);
-  Expression *e = exprStack.top();
-  bool changed;
-  Expression *simplify = e->simplify(changed);
-  if (simplify){
-    delete e;
-    return simplify;
-  }
-  else
-    return e;
 }
 
 Expression *ExpressionEvaluator::evaluate(const std::string &s) {
-  pos = 0;
-  //clear old data
-  while (!symbolPolish.empty())
-    symbolPolish.pop();
-  while (!symbolQueue.empty())
-    symbolQueue.pop();
+  return evaluate(s.data(), s.data() + s.size());
+}
 
-  if (s.size() == 0) throw invalid_argument("empty string");
-  expression = s;
-  stringDecomposition();
-  reversePolishNotation();
-  return constructTree();
+Expression *ExpressionEvaluator::evaluate(const char *begin, const char *end) {
+  if (begin == end) throw invalid_argument("empty string");
+  cursor = begin;
+  limit = end;
+  hasLookahead = false;
+  advance();
+  unique_ptr<Expression> root(parse(OperatorPrecedence::None));
+  if (hasLookahead) {
+    if (lookahead.type == Symbol::RightParenthese)
+      throw invalid_argument("a '(' is missed in the expression");
+    throw invalid_argument("invalid expression");
+  }
+  return Expression::simplified(std::move(root)).release();
 }
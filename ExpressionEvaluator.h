@@ -35,17 +35,28 @@ struct Symbol {
   OperatorPrecedence::Order precedence();
 };
 
+// Single pass parser: symbols are scanned one at a time as the parser
+// asks for them and the tree is built by precedence climbing, with the
+// precedences of OperatorPrecedence, without any intermediate buffer.
+// An evaluator keeps its position in the input, so each thread needs its
+// own; ExpressionLoader::parseAll gives one to each worker.
 class ExpressionEvaluator {
  private:
-  std::string expression;
-  int pos;
-  std::queue<Symbol> symbolQueue;
-  std::queue<Symbol> symbolPolish;
-  void stringDecomposition();
-  void reversePolishNotation();
-  Expression *constructTree();
+  std::vector<Symbol> symbols;
+  // the parser reads one symbol ahead
+  const char *cursor, *limit;
+  Symbol lookahead;
+  bool hasLookahead;
+  void advance();
+  Expression *parse(OperatorPrecedence::Order minimum);
+  Expression *parsePrefix();
  public:
+  ExpressionEvaluator();
   Expression *evaluate(const std::string &s);
+  // the characters in [begin, end), which need not be null-terminated
+  Expression *evaluate(const char *begin, const char *end);
+  // the symbols of s, valid until the next call
+  const std::vector<Symbol> &tokenize(const std::string &s);
 };
 
 #endif //EXPRESSIONEVALUATOR_H
@@ -0,0 +1,171 @@
+#include "ExpressionLoader.h"
+#include "ExpressionArena.h"
+#include "ExpressionEvaluator.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// lines parsed by one worker of parseAll at a time
+const size_t ParseAllChunk = 64;
+
+bool isBlank(const char *begin, const char *end) {
+  for (const char *p = begin; p < end; p++)
+    if (*p != ' ')
+      return false;
+  return true;
+}
+
+// the lines of [begin, end), numbered from 1 within the shard
+void parseLines(const char *begin, const char *end, ExpressionLoader::Batch &batch) {
+  // with a single shard this runs on the caller's thread, whose arena the
+  // trees must not land in
+  ExpressionArena::HeapScope heap;
+  ExpressionEvaluator evaluator;
+  const char *line = begin;
+  while (line < end) {
+    const char *newline = static_cast<const char *>(memchr(line, '\n', end - line));
+    const char *next = newline ? newline + 1 : end;
+    const char *last = newline ? newline : end;
+    if (last > line && last[-1] == '\r')
+      last--;
+    Expression *e = NULL;
+    if (!isBlank(line, last)) {
+      try {
+        e = evaluator.evaluate(line, last);
+      } catch (const invalid_argument &error) {
+        ExpressionLoader::Error reported;
+        reported.line = batch.expressions.size() + 1;
+        reported.message = error.what();
+        batch.errors.push_back(reported);
+      }
+    }
+    batch.expressions.push_back(unique_ptr<Expression>(e));
+    line = next;
+  }
+}
+
+// runs on a worker thread, anything other than a parse error is passed
+// back to be rethrown by the caller
+void parseShard(const char *begin, const char *end, ExpressionLoader::Batch &batch,
+                exception_ptr &failure) {
+  try {
+    parseLines(begin, end, batch);
+  } catch (...) {
+    failure = current_exception();
+  }
+}
+
+} // namespace
+
+ExpressionLoader::Batch ExpressionLoader::loadFile(const string &path, int threads) {
+  MappedFile file(path, MappedFile::Sequential);
+  return parse(file.begin(), file.end(), threads);
+}
+
+ExpressionLoader::Batch ExpressionLoader::parse(const char *begin, const char *end, int threads) {
+  if (threads < 1)
+    threads = 1;
+  // shard boundaries, moved forward to the start of the next line
+  vector<const char *> bounds(1, begin);
+  for (int k = 1; k < threads; k++) {
+    const char *cut = max(bounds.back(), begin + (end - begin) * k / threads);
+    if (cut > begin && cut < end && cut[-1] != '\n') {
+      const char *newline = static_cast<const char *>(memchr(cut, '\n', end - cut));
+      cut = newline ? newline + 1 : end;
+    }
+    bounds.push_back(cut);
+  }
+  bounds.push_back(end);
+
+  vector<Batch> shards(threads);
+  if (threads == 1) {
+    parseLines(begin, end, shards[0]);
+  } else {
+    vector<exception_ptr> failures(threads);
+    vector<thread> workers;
+    for (int k = 0; k < threads; k++)
+      workers.push_back(thread(parseShard, bounds[k], bounds[k + 1], ref(shards[k]),
+                               ref(failures[k])));
+    for (auto it = workers.begin(); it != workers.end(); it++)
+      it->join();
+    for (auto it = failures.begin(); it != failures.end(); it++)
+      if (*it)
+        rethrow_exception(*it);
+  }
+
+  // shards are consecutive, their line numbers are offset by the lines
+  // before them
+  Batch batch;
+  for (auto shard = shards.begin(); shard != shards.end(); shard++) {
+    size_t offset = batch.expressions.size();
+    for (auto it = shard->errors.begin(); it != shard->errors.end(); it++) {
+      batch.errors.push_back(*it);
+      batch.errors.back().line += offset;
+    }
+    for (auto it = shard->expressions.begin(); it != shard->expressions.end(); it++)
+      batch.expressions.push_back(std::move(*it));
+  }
+  return batch;
+}
+
+ExpressionLoader::Batch ExpressionLoader::parseAll(const vector<string> &formulas, ThreadPool &pool) {
+  Batch batch;
+  batch.expressions.resize(formulas.size());
+  vector<string> messages(formulas.size());
+  // workers take chunks of consecutive formulas until none is left, and
+  // write into the slots of their formulas only
+  atomic<size_t> next(0);
+  function<void()> worker = [&]() {
+    ExpressionArena::HeapScope heap;
+    ExpressionEvaluator evaluator;
+    for (;;) {
+      size_t first = next.fetch_add(ParseAllChunk);
+      if (first >= formulas.size())
+        return;
+      size_t last = min(first + ParseAllChunk, formulas.size());
+      for (size_t i = first; i < last; i++) {
+        const string &s = formulas[i];
+        if (isBlank(s.data(), s.data() + s.size()))
+          continue;
+        try {
+          batch.expressions[i].reset(evaluator.evaluate(s));
+        } catch (const invalid_argument &error) {
+          messages[i] = error.what();
+        }
+      }
+    }
+  };
+  size_t chunks = (formulas.size() + ParseAllChunk - 1) / ParseAllChunk;
+  size_t tasks = min(static_cast<size_t>(pool.size()), chunks);
+  vector<future<void> > done;
+  for (size_t k = 0; k < tasks; k++)
+    done.push_back(pool.submit(worker));
+  // every worker must be finished before anything is rethrown, they use
+  // the locals of this frame
+  for (auto it = done.begin(); it != done.end(); it++)
+    it->wait();
+  for (auto it = done.begin(); it != done.end(); it++)
+    it->get();
+  for (size_t i = 0; i < messages.size(); i++) {
+    if (messages[i].empty())
+      continue;
+    Error reported;
+    reported.line = i + 1;
+    reported.message.swap(messages[i]);
+    batch.errors.push_back(reported);
+  }
+  return batch;
+}
+
+ExpressionLoader::Batch ExpressionLoader::parseAll(const vector<string> &formulas) {
+  return parseAll(formulas, ThreadPool::shared());
+}
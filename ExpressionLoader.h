@@ -0,0 +1,47 @@
+#ifndef EXPRESSIONLOADER_H
+#define EXPRESSIONLOADER_H
+
+#include "function.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// Bulk parsing of formula files, one expression per line.
+// The file is memory-mapped and the lines are parsed in place, without
+// being copied into strings. A line that doesn't parse is reported with
+// its number and the message of its invalid_argument, and the batch goes
+// on. Blank lines are skipped; "\r\n" line ends are accepted.
+// With several threads the text is cut into shards of about the same
+// size at line boundaries, each shard is parsed by its own thread with
+// its own ExpressionEvaluator, and the results are put back in line
+// order. The trees come from the heap, whatever arena is current.
+class ExpressionLoader {
+ public:
+  struct Error {
+    size_t line;   // 1-based
+    std::string message;
+  };
+
+  struct Batch {
+    // expressions[i] is line i+1, NULL for blank lines and errors
+    std::vector<std::unique_ptr<Expression> > expressions;
+    // in line order
+    std::vector<Error> errors;
+  };
+
+  // throws runtime_error when the file can't be read
+  static Batch loadFile(const std::string &path, int threads = 1);
+
+  static Batch parse(const char *begin, const char *end, int threads = 1);
+
+  // formulas[i] parsed into expressions[i] by the workers of the pool,
+  // each with its own ExpressionEvaluator; errors are numbered from 1 like
+  // lines. Must not be called from a task of the same pool.
+  static Batch parseAll(const std::vector<std::string> &formulas, ThreadPool &pool);
+  // on ThreadPool::shared()
+  static Batch parseAll(const std::vector<std::string> &formulas);
+};
+
+#endif // EXPRESSIONLOADER_H
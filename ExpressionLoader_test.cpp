@@ -0,0 +1,135 @@
+#include "catch.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <memory>
+#include <string>
+#include <vector>
+#include "function.h"
+#include "ExpressionArena.h"
+#include "ExpressionEvaluator.h"
+#include "ExpressionLoader.h"
+#include "ThreadPool.h"
+using namespace std;
+
+namespace {
+
+// a file in the temporary directory, removed when it goes out of scope
+class TempFile {
+  string filePath;
+
+  TempFile(const TempFile &);
+  TempFile &operator=(const TempFile &);
+ public:
+  explicit TempFile(const string &name) {
+    const char *dir = getenv("TMPDIR");
+    if (!dir || !*dir)
+      dir = getenv("TEMP");
+    filePath = string(dir && *dir ? dir : "/tmp") + "/" + name;
+  }
+  ~TempFile() { remove(filePath.c_str()); }
+
+  const string &path() const { return filePath; }
+};
+
+} // namespace
+
+TEST_CASE("ExpressionLoader reports errors per line", "[loader]") {
+  string text = "x*x\n"
+      "sin(x)/x\r\n"
+      "\n"
+      "2*(x+1\n"
+      "  \n"
+      "exp(x)-log(x)\n"
+      "x^2\n"
+      "cos(x)";
+  ExpressionLoader::Batch batch = ExpressionLoader::parse(text.data(), text.data() + text.size());
+  REQUIRE(batch.expressions.size() == 8);
+  REQUIRE(batch.expressions[0]->stringPrint() == "Poly[x^2]");
+  REQUIRE(batch.expressions[1]->stringPrint() == "sin(x)/x");
+  REQUIRE(!batch.expressions[2]);
+  REQUIRE(!batch.expressions[3]);
+  REQUIRE(!batch.expressions[4]);
+  REQUIRE((*batch.expressions[5])(2) == Approx(exp(2) - log(2)));
+  REQUIRE(batch.expressions[7]->stringPrint() == "cos(x)");
+  REQUIRE(batch.errors.size() == 2);
+  REQUIRE(batch.errors[0].line == 4);
+  REQUIRE(batch.errors[0].message == "a ')' is missed in the expression");
+  REQUIRE(batch.errors[1].line == 7);
+
+  // the trees outlive the arena of the caller, with one thread or several
+  ExpressionArena arena;
+  ExpressionLoader::Batch single, sharded;
+  {
+    ExpressionArena::Scope scope(arena);
+    single = ExpressionLoader::parse(text.data(), text.data() + text.size());
+    sharded = ExpressionLoader::parse(text.data(), text.data() + text.size(), 2);
+  }
+  REQUIRE(arena.bytesUsed() == 0);
+  arena.reset();
+  REQUIRE(single.expressions[1]->stringPrint() == "sin(x)/x");
+  REQUIRE(sharded.expressions[7]->stringPrint() == "cos(x)");
+}
+
+TEST_CASE("ExpressionLoader shards a file across threads", "[loader]") {
+  const char *corpus[] = {"2*x*x*x-x/3", "sin(x)/x+cos(x)*x/3", "exp(sin(x)*x)-log(x+2)", "1/",
+                          "(2/x)/(sin(x)/exp(x))", "tan(x*x)/(1+x*x)", "", "sin(cos(x))"};
+  const int lines = 1000;
+  TempFile file("ExpressionLoader_test.txt");
+  const string &path = file.path();
+  {
+    ofstream out(path.c_str());
+    for (int i = 0; i < lines; i++)
+      out << corpus[i % 8] << "\n";
+  }
+  ExpressionLoader::Batch single = ExpressionLoader::loadFile(path);
+  ExpressionLoader::Batch sharded = ExpressionLoader::loadFile(path, 3);
+  REQUIRE(single.expressions.size() == lines);
+  REQUIRE(sharded.expressions.size() == lines);
+  REQUIRE(single.errors.size() == lines / 8);
+  REQUIRE(sharded.errors.size() == lines / 8);
+  ExpressionEvaluator evaluator;
+  for (int i = 0; i < lines; i++) {
+    if (i % 8 == 3 || i % 8 == 6) {
+      REQUIRE(!sharded.expressions[i]);
+      continue;
+    }
+    unique_ptr<Expression> e(evaluator.evaluate(corpus[i % 8]));
+    REQUIRE(sharded.expressions[i]->stringPrint() == e->stringPrint());
+  }
+  for (int k = 0; k < lines / 8; k++) {
+    REQUIRE(sharded.errors[k].line == static_cast<size_t>(8 * k + 4));
+    REQUIRE(single.errors[k].line == sharded.errors[k].line);
+  }
+  // more threads than lines
+  string text = "x\nx+1";
+  ExpressionLoader::Batch small = ExpressionLoader::parse(text.data(), text.data() + text.size(), 8);
+  REQUIRE(small.expressions.size() == 2);
+  REQUIRE(small.expressions[1]->stringPrint() == "Poly[1+x]");
+  REQUIRE_THROWS_AS(ExpressionLoader::loadFile("no/such/file"), runtime_error);
+}
+
+TEST_CASE("ExpressionLoader parseAll keeps the input order", "[loader]") {
+  const char *corpus[] = {"x*x", "sin(x)/x", "2*(x", "", "exp(x)-log(x)", "cos(x)*x"};
+  vector<string> formulas;
+  for (int i = 0; i < 1000; i++)
+    formulas.push_back(corpus[i % 6]);
+  ThreadPool pool(4);
+  ExpressionLoader::Batch batch = ExpressionLoader::parseAll(formulas, pool);
+  REQUIRE(batch.expressions.size() == formulas.size());
+  REQUIRE(batch.errors.size() == 167);
+  ExpressionEvaluator evaluator;
+  for (size_t i = 0; i < formulas.size(); i++) {
+    if (i % 6 == 2 || i % 6 == 3) {
+      REQUIRE(!batch.expressions[i]);
+      continue;
+    }
+    unique_ptr<Expression> e(evaluator.evaluate(formulas[i]));
+    REQUIRE(batch.expressions[i]->stringPrint() == e->stringPrint());
+  }
+  for (size_t k = 0; k < batch.errors.size(); k++)
+    REQUIRE(batch.errors[k].line == 6 * k + 3);
+  REQUIRE(ExpressionLoader::parseAll(vector<string>()).expressions.empty());
+}
@@ -0,0 +1,241 @@
+#include "ExpressionSerializer.h"
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+const unsigned char SmallInteger = 1;
+
+void writeVarint(size_t v, string &out) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+void writeDouble(double v, string &out) {
+  unsigned long long bits;
+  memcpy(&bits, &v, sizeof(bits));
+  char bytes[8];
+  for (int i = 0; i < 8; i++)
+    bytes[i] = static_cast<char>(bits >> (8 * i));
+  out.append(bytes, 8);
+}
+
+void writeTag(Expression::NodeType type, unsigned detail, string &out) {
+  out.push_back(static_cast<char>(type | (detail << 4)));
+}
+
+// -0.0 and fractions keep their 8 bytes
+bool isSmallInteger(double c) {
+  return c >= -128 && c <= 127 && c == static_cast<signed char>(c)
+      && !(c == 0 && signbit(c));
+}
+
+void fail(const char *message) {
+  throw invalid_argument(string("serialized expression: ") + message);
+}
+
+unsigned char readByte(const char *&cursor, const char *end) {
+  if (cursor == end)
+    fail("truncated");
+  return static_cast<unsigned char>(*cursor++);
+}
+
+size_t readVarint(const char *&cursor, const char *end) {
+  size_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    unsigned char b = readByte(cursor, end);
+    v |= static_cast<size_t>(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return v;
+  }
+  fail("varint too long");
+  return 0;
+}
+
+double readDouble(const char *&cursor, const char *end) {
+  if (end - cursor < 8)
+    fail("truncated");
+  unsigned long long bits = 0;
+  for (int i = 0; i < 8; i++)
+    bits |= static_cast<unsigned long long>(static_cast<unsigned char>(cursor[i])) << (8 * i);
+  cursor += 8;
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+} // namespace
+
+void ExpressionSerializer::write(const Expression *e, string &out) {
+  switch (e->nodeType()) {
+    case Expression::TypeConstant: {
+      double c = static_cast<const Constant *>(e)->value();
+      if (isSmallInteger(c)) {
+        writeTag(Expression::TypeConstant, SmallInteger, out);
+        out.push_back(static_cast<char>(static_cast<signed char>(c)));
+      } else {
+        writeTag(Expression::TypeConstant, 0, out);
+        writeDouble(c, out);
+      }
+      return;
+    }
+    case Expression::TypeAdd:
+    case Expression::TypeMulti: {
+      const ExpressionSet &children = static_cast<const CommutativeOperators *>(e)->getChildren();
+      writeTag(e->nodeType(), 0, out);
+      writeVarint(children.size(), out);
+      for (auto it = children.begin(); it != children.end(); it++)
+        write(*it, out);
+      return;
+    }
+    case Expression::TypeDivide: {
+      const Division *d = static_cast<const Division *>(e);
+      writeTag(Expression::TypeDivide, 0, out);
+      write(d->getNumerator(), out);
+      write(d->getDenominator(), out);
+      return;
+    }
+    case Expression::TypeCompo: {
+      const Composition *c = static_cast<const Composition *>(e);
+      writeTag(Expression::TypeCompo, 0, out);
+      write(c->getLeft(), out);
+      write(c->getRight(), out);
+      return;
+    }
+    case Expression::TypePoly: {
+      vector<double> coefficients = static_cast<const Polynomial *>(e)->getParameter();
+      writeTag(Expression::TypePoly, 0, out);
+      writeVarint(coefficients.size(), out);
+      for (auto it = coefficients.begin(); it != coefficients.end(); it++)
+        writeDouble(*it, out);
+      return;
+    }
+    case Expression::TypeTrigo:
+      writeTag(Expression::TypeTrigo, static_cast<const Trigo *>(e)->getTrigoType(), out);
+      return;
+    case Expression::TypeVariable:
+    case Expression::TypeExp:
+    case Expression::TypeLog:
+      writeTag(e->nodeType(), 0, out);
+      return;
+    default:
+      throw invalid_argument("power is not supported");
+  }
+}
+
+Expression *ExpressionSerializer::read(const char *&cursor, const char *end) {
+  return read(cursor, end, 0);
+}
+
+Expression *ExpressionSerializer::read(const char *&cursor, const char *end, int depth) {
+  if (depth >= MaxDepth)
+    fail("nested too deep");
+  unsigned char tag = readByte(cursor, end);
+  unsigned detail = tag >> 4;
+  switch (tag & 0x0f) {
+    case Expression::TypeConstant:
+      if (detail == SmallInteger)
+        return new Constant(static_cast<signed char>(readByte(cursor, end)));
+      if (detail != 0)
+        break;
+      return new Constant(readDouble(cursor, end));
+    case Expression::TypeVariable:
+      if (detail != 0)
+        break;
+      return new VariableX;
+    case Expression::TypeAdd:
+    case Expression::TypeMulti: {
+      if (detail != 0)
+        break;
+      size_t count = readVarint(cursor, end);
+      // every child takes a byte at least
+      if (count < 2 || count > static_cast<size_t>(end - cursor))
+        fail("bad operand count");
+      ExpressionSet children;
+      try {
+        for (size_t i = 0; i < count; i++)
+          children.insert(read(cursor, end, depth + 1));
+      } catch (...) {
+        for (auto it = children.begin(); it != children.end(); it++)
+          delete *it;
+        throw;
+      }
+      if ((tag & 0x0f) == Expression::TypeAdd)
+        return new Addition(children);
+      return new Multiplication(children);
+    }
+    case Expression::TypeDivide: {
+      if (detail != 0)
+        break;
+      unique_ptr<Expression> numerator(read(cursor, end, depth + 1));
+      unique_ptr<Expression> denominator(read(cursor, end, depth + 1));
+      Expression *d = new Division(numerator.get(), denominator.get());
+      numerator.release();
+      denominator.release();
+      return d;
+    }
+    case Expression::TypeCompo: {
+      if (detail != 0)
+        break;
+      unique_ptr<Expression> left(read(cursor, end, depth + 1));
+      unique_ptr<Expression> right(read(cursor, end, depth + 1));
+      Expression *c = new Composition(left.get(), right.get());
+      left.release();
+      right.release();
+      return c;
+    }
+    case Expression::TypePoly: {
+      if (detail != 0)
+        break;
+      size_t count = readVarint(cursor, end);
+      if (count > static_cast<size_t>(end - cursor) / 8)
+        fail("truncated");
+      vector<double> coefficients(count);
+      for (size_t i = 0; i < count; i++)
+        coefficients[i] = readDouble(cursor, end);
+      return new Polynomial(coefficients);
+    }
+    case Expression::TypeTrigo:
+      if (detail > Trigo::Tan)
+        break;
+      return new Trigo(static_cast<Trigo::TrigoType>(detail));
+    case Expression::TypeExp:
+      if (detail != 0)
+        break;
+      return new Exponential;
+    case Expression::TypeLog:
+      if (detail != 0)
+        break;
+      return new Logarithm;
+  }
+  fail("unknown tag");
+  return NULL;
+}
+
+string ExpressionSerializer::serialize(const Expression *e) {
+  string out;
+  out.push_back(static_cast<char>(Version));
+  write(e, out);
+  return out;
+}
+
+Expression *ExpressionSerializer::deserialize(const char *begin, const char *end) {
+  const char *cursor = begin;
+  if (readByte(cursor, end) != Version)
+    fail("unknown version");
+  unique_ptr<Expression> e(read(cursor, end));
+  if (cursor != end)
+    fail("trailing bytes");
+  return e.release();
+}
+
+Expression *ExpressionSerializer::deserialize(const string &data) {
+  return deserialize(data.data(), data.data() + data.size());
+}
@@ -0,0 +1,46 @@
+#ifndef EXPRESSIONSERIALIZER_H
+#define EXPRESSIONSERIALIZER_H
+
+#include "function.h"
+#include <string>
+
+// Compact binary form of expression trees, to skip parsing and
+// simplification when a corpus is loaded again.
+// A tree is written in prefix order, every node starting with a tag byte:
+// the low 4 bits are the NodeType, the high bits a detail of the node.
+//   Constant   detail 1: the value is a small integer, one signed byte
+//              follows; detail 0: the 8 bytes of the double follow
+//   Variable   nothing follows
+//   Add, Multi a varint child count, then the children in stored order
+//   Divide     numerator, then denominator
+//   Compo      the outer function, then its argument
+//   Poly       a varint coefficient count, then 8 bytes per coefficient,
+//              constant term first
+//   Trigo      detail is the TrigoType
+//   Exp, Log   nothing follows
+// Varints are LEB128, doubles their IEEE bits in little-endian order, so
+// the bytes don't depend on the host and values round-trip exactly,
+// signed zeros and NaN payloads included.
+// serialize() puts a version byte in front of the tree, write() and read()
+// handle bare trees, for containers of their own. Malformed input throws
+// invalid_argument, trees nested deeper than MaxDepth included, so that a
+// hostile input can't exhaust the stack; nodes are allocated like
+// ExpressionEvaluator's, from the current ExpressionArena if any.
+class ExpressionSerializer {
+  static Expression *read(const char *&cursor, const char *end, int depth);
+ public:
+  static const unsigned char Version = 1;
+  static const int MaxDepth = 1000;
+
+  static std::string serialize(const Expression *e);
+  // the whole of data must be one serialized tree
+  static Expression *deserialize(const std::string &data);
+  static Expression *deserialize(const char *begin, const char *end);
+
+  // appends the tree to out
+  static void write(const Expression *e, std::string &out);
+  // reads one tree at cursor and moves cursor past it
+  static Expression *read(const char *&cursor, const char *end);
+};
+
+#endif // EXPRESSIONSERIALIZER_H
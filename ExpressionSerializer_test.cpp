@@ -0,0 +1,95 @@
+#include "catch.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "function.h"
+#include "ExpressionEvaluator.h"
+#include "ExpressionSerializer.h"
+using namespace std;
+
+static const char *serializerCorpus[] = {
+    "1", "x", "0.1", "-3", "1e300", "2-x", "x*x", "x+x*x", "2*x*x*x-x/3", "x*sin(x)",
+    "sin(x)/x", "log(x)", "tan(x)", "cos(x)*exp(x)", "sin(cos(x))",
+    "exp(sin(x)*x)-log(x+2.5)", "(2/x)/(sin(x)/exp(x))", "tan(x*x)/(1+x*x)",
+    "sin(x)+cos(x)+tan(x)+exp(x)+log(x)+x+0.25"
+};
+
+TEST_CASE("ExpressionSerializer round-trips the trees", "[serializer]") {
+  ExpressionEvaluator evaluator;
+  for (auto s : serializerCorpus) {
+    Expression *e = evaluator.evaluate(s);
+    string bytes = ExpressionSerializer::serialize(e);
+    Expression *back = ExpressionSerializer::deserialize(bytes);
+    REQUIRE(back->stringPrint() == e->stringPrint());
+    REQUIRE(back->structuralHash() == e->structuralHash());
+    REQUIRE(ExpressionSerializer::serialize(back) == bytes);
+    for (double x = 0.15; x < 3; x += 0.35)
+      REQUIRE((*back)(x) == (*e)(x));
+    delete back;
+    delete e;
+  }
+}
+
+TEST_CASE("ExpressionSerializer keeps the exact values", "[serializer]") {
+  vector<double> coefficients;
+  coefficients.push_back(-0.0);
+  coefficients.push_back(1.0 / 3);
+  coefficients.push_back(5e-324);
+  Expression *e = new Composition(new Polynomial(coefficients), new Trigo(Trigo::Cos));
+  string bytes = ExpressionSerializer::serialize(e);
+  Expression *back = ExpressionSerializer::deserialize(bytes);
+  REQUIRE(back->nodeType() == Expression::TypeCompo);
+  const Composition *c = static_cast<const Composition *>(back);
+  REQUIRE(static_cast<const Trigo *>(c->getRight())->getTrigoType() == Trigo::Cos);
+  vector<double> read = static_cast<const Polynomial *>(c->getLeft())->getParameter();
+  REQUIRE(read.size() == 3);
+  REQUIRE(signbit(read[0]));
+  REQUIRE(read[1] == 1.0 / 3);
+  REQUIRE(read[2] == 5e-324);
+  delete back;
+  delete e;
+
+  // small integers take two bytes, negative zero doesn't count as one
+  Constant small(-7), zero(-0.0);
+  REQUIRE(ExpressionSerializer::serialize(&small).size() == 3);
+  REQUIRE(ExpressionSerializer::serialize(&zero).size() == 10);
+  Expression *z = ExpressionSerializer::deserialize(ExpressionSerializer::serialize(&zero));
+  REQUIRE(signbit(static_cast<Constant *>(z)->value()));
+  delete z;
+}
+
+TEST_CASE("ExpressionSerializer rejects malformed input", "[serializer]") {
+  ExpressionEvaluator evaluator;
+  Expression *e = evaluator.evaluate("sin(x)/x+cos(x)*1.5");
+  string bytes = ExpressionSerializer::serialize(e);
+  delete e;
+  for (size_t n = 0; n < bytes.size(); n++)
+    REQUIRE_THROWS_AS(delete ExpressionSerializer::deserialize(bytes.substr(0, n)), invalid_argument);
+  REQUIRE_THROWS_AS(delete ExpressionSerializer::deserialize(bytes + '\x01'), invalid_argument);
+  string version = bytes;
+  version[0] = 99;
+  REQUIRE_THROWS_AS(delete ExpressionSerializer::deserialize(version), invalid_argument);
+  // Trigo with a subtype past Tan, a sum of one term
+  REQUIRE_THROWS_AS(delete ExpressionSerializer::deserialize(string("\x01\x38", 2)), invalid_argument);
+  REQUIRE_THROWS_AS(delete ExpressionSerializer::deserialize(string("\x01\x02\x01\x01", 4)),
+                    invalid_argument);
+  // a chain of divisions deep enough to overflow the stack
+  string deep(1, static_cast<char>(ExpressionSerializer::Version));
+  deep.append(2000000, static_cast<char>(Expression::TypeDivide));
+  REQUIRE_THROWS_AS(delete ExpressionSerializer::deserialize(deep), invalid_argument);
+  // several trees in a row
+  string stream;
+  Constant one(1);
+  VariableX x;
+  ExpressionSerializer::write(&one, stream);
+  ExpressionSerializer::write(&x, stream);
+  const char *cursor = stream.data();
+  Expression *a = ExpressionSerializer::read(cursor, stream.data() + stream.size());
+  Expression *b = ExpressionSerializer::read(cursor, stream.data() + stream.size());
+  REQUIRE(cursor == stream.data() + stream.size());
+  REQUIRE(a->stringPrint() == "1");
+  REQUIRE(b->stringPrint() == "x");
+  delete a;
+  delete b;
+}
@@ -0,0 +1,248 @@
+#include "JitExpression.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define JITEXPRESSION_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef JITEXPRESSION_X86_64
+
+namespace {
+
+double jitSin(double x) { return sin(x); }
+double jitCos(double x) { return cos(x); }
+double jitTan(double x) { return tan(x); }
+double jitExp(double x) { return exp(x); }
+double jitLog(double x) { return log(x); }
+
+// Minimal x86-64 assembler for the handful of instructions we need.
+// Slots live at [rsp + 8 * slot], only xmm0-xmm3 and rax are used.
+class Assembler {
+  vector<unsigned char> code;
+
+  void byte(unsigned char b) { code.push_back(b); }
+
+  void int32(int32_t v) {
+    for (int i = 0; i < 4; i++)
+      byte(static_cast<unsigned char>(v >> (8 * i)));
+  }
+
+  void int64(uint64_t v) {
+    for (int i = 0; i < 8; i++)
+      byte(static_cast<unsigned char>(v >> (8 * i)));
+  }
+
+  // ModRM + SIB + disp32 for [rsp + disp]
+  void stackOperand(int reg, int32_t disp) {
+    byte(0x84 | (reg << 3));
+    byte(0x24);
+    int32(disp);
+  }
+
+ public:
+  enum SseOp {
+    AddSd = 0x58, MulSd = 0x59, DivSd = 0x5E
+  };
+
+  const vector<unsigned char> &bytes() const { return code; }
+
+  // sub rsp, imm32
+  void subRsp(int32_t v) {
+    byte(0x48); byte(0x81); byte(0xEC);
+    int32(v);
+  }
+
+  // add rsp, imm32
+  void addRsp(int32_t v) {
+    byte(0x48); byte(0x81); byte(0xC4);
+    int32(v);
+  }
+
+  // movsd xmm, [rsp + 8 * slot]
+  void loadSlot(int xmm, int slot) {
+    byte(0xF2); byte(0x0F); byte(0x10);
+    stackOperand(xmm, 8 * slot);
+  }
+
+  // movsd [rsp + 8 * slot], xmm
+  void storeSlot(int slot, int xmm) {
+    byte(0xF2); byte(0x0F); byte(0x11);
+    stackOperand(xmm, 8 * slot);
+  }
+
+  // addsd/mulsd/divsd xmm, [rsp + 8 * slot]
+  void opSlot(SseOp op, int xmm, int slot) {
+    byte(0xF2); byte(0x0F); byte(op);
+    stackOperand(xmm, 8 * slot);
+  }
+
+  // addsd/mulsd/divsd dst, src
+  void opRegister(SseOp op, int dst, int src) {
+    byte(0xF2); byte(0x0F); byte(op);
+    byte(0xC0 | (dst << 3) | src);
+  }
+
+  // mov rax, imm64
+  void movRax(uint64_t v) {
+    byte(0x48); byte(0xB8);
+    int64(v);
+  }
+
+  // movq xmm, rax
+  void movXmmRax(int xmm) {
+    byte(0x66); byte(0x48); byte(0x0F); byte(0x6E);
+    byte(0xC0 | (xmm << 3));
+  }
+
+  // mov [rsp + 8 * slot], rax
+  void storeRax(int slot) {
+    byte(0x48); byte(0x89);
+    stackOperand(0, 8 * slot);
+  }
+
+  void loadConstant(int xmm, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    movRax(bits);
+    movXmmRax(xmm);
+  }
+
+  // xorpd xmm, xmm
+  void zero(int xmm) {
+    byte(0x66); byte(0x0F); byte(0x57);
+    byte(0xC0 | (xmm << 3) | xmm);
+  }
+
+  // mov rax, f; call rax
+  void call(double (*f)(double)) {
+    movRax(reinterpret_cast<uint64_t>(f));
+    byte(0xFF); byte(0xD0);
+  }
+
+  void ret() { byte(0xC3); }
+};
+
+double (*libraryFunction(Instruction::OpCode op))(double) {
+  switch (op) {
+    case Instruction::Sin:
+      return jitSin;
+    case Instruction::Cos:
+      return jitCos;
+    case Instruction::Tan:
+      return jitTan;
+    case Instruction::Exp:
+      return jitExp;
+    case Instruction::Log:
+      return jitLog;
+    default:
+      return NULL;
+  }
+}
+
+// returns false if an instruction can't be translated
+bool assemble(const CompiledExpression &program, Assembler &as) {
+  // on entry rsp is 8 mod 16, keep it 16 byte aligned for the calls
+  int32_t frame = 8 * program.slotCount();
+  if (frame % 16 == 0) frame += 8;
+  as.subRsp(frame);
+  as.storeSlot(0, 0);
+  const double *coef = program.polynomialCoefficients().data();
+  const vector<Instruction> &code = program.instructions();
+  for (auto ins = code.begin(); ins != code.end(); ins++) {
+    switch (ins->op) {
+      case Instruction::Const: {
+        uint64_t bits;
+        memcpy(&bits, &ins->value, sizeof(bits));
+        as.movRax(bits);
+        as.storeRax(ins->dst);
+        break;
+      }
+      case Instruction::Add:
+      case Instruction::Multi:
+      case Instruction::Divide: {
+        Assembler::SseOp op = ins->op == Instruction::Add ? Assembler::AddSd
+            : ins->op == Instruction::Multi ? Assembler::MulSd : Assembler::DivSd;
+        as.loadSlot(0, ins->a);
+        as.opSlot(op, 0, ins->b);
+        as.storeSlot(ins->dst, 0);
+        break;
+      }
+      case Instruction::Poly: {
+        // xmm0 = sum, xmm1 = t, xmm2 = t^k, same order as Polynomial::operator()
+        as.zero(0);
+        as.loadSlot(1, ins->a);
+        as.loadConstant(2, 1.0);
+        for (int k = 0; k < ins->n; k++) {
+          as.loadConstant(3, coef[ins->b + k]);
+          as.opRegister(Assembler::MulSd, 3, 2);
+          as.opRegister(Assembler::AddSd, 0, 3);
+          if (k + 1 < ins->n)
+            as.opRegister(Assembler::MulSd, 2, 1);
+        }
+        as.storeSlot(ins->dst, 0);
+        break;
+      }
+      case Instruction::Sin:
+      case Instruction::Cos:
+      case Instruction::Tan:
+      case Instruction::Exp:
+      case Instruction::Log:
+        as.loadSlot(0, ins->a);
+        as.call(libraryFunction(ins->op));
+        as.storeSlot(ins->dst, 0);
+        break;
+      default:
+        return false;
+    }
+  }
+  as.loadSlot(0, program.resultSlot());
+  as.addRsp(frame);
+  as.ret();
+  return true;
+}
+
+} // namespace
+
+#endif
+
+JitExpression::JitExpression(const Expression *e) :
+    entry(NULL), memory(NULL), memorySize(0), codeLength(0), fallback(NULL) {
+  if (!e) throw invalid_argument("null expression in JitExpression");
+  CompiledExpression program(e);
+#ifdef JITEXPRESSION_X86_64
+  Assembler as;
+  if (assemble(program, as)) {
+    const vector<unsigned char> &bytes = as.bytes();
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (bytes.size() + page - 1) / page * page;
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) {
+      memcpy(p, bytes.data(), bytes.size());
+      if (mprotect(p, size, PROT_READ | PROT_EXEC) == 0) {
+        memory = p;
+        memorySize = size;
+        entry = reinterpret_cast<JitFunction>(p);
+        codeLength = bytes.size();
+        return;
+      }
+      munmap(p, size);
+    }
+  }
+#endif
+  fallback = e->clone();
+}
+
+JitExpression::~JitExpression() {
+#ifdef JITEXPRESSION_X86_64
+  if (memory)
+    munmap(memory, memorySize);
+#endif
+  delete fallback;
+}
@@ -0,0 +1,42 @@
+#ifndef JITEXPRESSION_H
+#define JITEXPRESSION_H
+
+#include "CompiledExpression.h"
+
+typedef double (*JitFunction)(double);
+
+// Native x86-64 code for an Expression. The instructions of its
+// CompiledExpression are translated one by one into SSE2 scalar code
+// working on a stack frame of slots, elementary functions are calls to the
+// C library. The code lives in its own executable mapping, released with
+// the JitExpression.
+// On other architectures, or if the executable mapping can't be created,
+// nothing is compiled: function() returns NULL and operator() evaluates
+// the expression tree instead.
+class JitExpression {
+  JitFunction entry;
+  void *memory;
+  size_t memorySize;
+  size_t codeLength;
+  Expression *fallback;
+
+  JitExpression(const JitExpression &);
+  JitExpression &operator=(const JitExpression &);
+ public:
+  explicit JitExpression(const Expression *e);
+  ~JitExpression();
+
+  bool compiled() const { return entry != NULL; }
+
+  // the generated code, NULL when not compiled
+  JitFunction function() const { return entry; }
+
+  double operator()(double x) const {
+    return entry ? entry(x) : (*fallback)(x);
+  }
+
+  // bytes of generated code
+  size_t codeSize() const { return codeLength; }
+};
+
+#endif // JITEXPRESSION_H
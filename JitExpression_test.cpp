@@ -0,0 +1,51 @@
+#include "catch.hpp"
+#include <cmath>
+#include <vector>
+#include "function.h"
+#include "ExpressionEvaluator.h"
+#include "JitExpression.h"
+using namespace std;
+
+TEST_CASE("JitExpression matches the tree evaluator", "[jit]") {
+  const char *corpus[] = {
+      "1", "x", "-x", "2*x*x+3*x", "(2*x*x+3*x)*x-7", "1/x/-x/x/x/x",
+      "(2/x)/(sin(x)/exp(x))", "sin(x)/x+cos(x)*x/3", "sin(cos(x))",
+      "exp(sin(x)*x)-log(x+2)", "tan(x)/(1+x*x)", "log(exp(cos(x*x)+1)*x)"
+  };
+  double xs[] = {-2.5, -0.3, 0.1, 0.7, 1.234, 3.0};
+  ExpressionEvaluator evaluator;
+  for (auto s : corpus) {
+    Expression *e = evaluator.evaluate(s);
+    JitExpression jit(e);
+#if defined(__x86_64__) && defined(__linux__)
+    REQUIRE(jit.compiled());
+#endif
+    for (double x : xs) {
+      double expected = (*e)(x);
+      if (std::isnan(expected)) {
+        REQUIRE(std::isnan(jit(x)));
+      } else {
+        REQUIRE(jit(x) == expected);
+        if (jit.compiled())
+          REQUIRE(jit.function()(x) == expected);
+      }
+    }
+    delete e;
+  }
+}
+
+TEST_CASE("JitExpression of a deep composition", "[jit]") {
+  vector<double> a;
+  a.push_back(0.5);
+  a.push_back(-1);
+  a.push_back(0.25);
+  Expression *e = new VariableX;
+  for (int i = 0; i < 20; i++) {
+    Expression *layer = i % 2 ? static_cast<Expression *>(new Trigo(Trigo::Cos)) : new Polynomial(a);
+    e = new Addition(new Composition(layer, e), new Constant(i));
+  }
+  JitExpression jit(e);
+  for (double x = -2; x < 2; x += 0.1)
+    REQUIRE(jit(x) == (*e)(x));
+  delete e;
+}
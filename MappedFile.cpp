@@ -0,0 +1,51 @@
+#include "MappedFile.h"
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPEDFILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+using namespace std;
+
+MappedFile::MappedFile(const string &path, Access access) : data(NULL), length(0), mapping(NULL) {
+#ifdef MAPPEDFILE_MMAP
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw runtime_error("can't open " + path);
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    throw runtime_error("can't read " + path);
+  }
+  length = status.st_size;
+  if (length > 0) {
+    mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      throw runtime_error("can't map " + path);
+    }
+    madvise(mapping, length, access == Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    data = static_cast<const char *>(mapping);
+  }
+  close(fd);
+#else
+  ifstream in(path.c_str(), ios::binary);
+  if (!in) throw runtime_error("can't open " + path);
+  buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  length = buffer.size();
+  data = buffer.empty() ? NULL : &buffer[0];
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef MAPPEDFILE_MMAP
+  if (mapping)
+    munmap(mapping, length);
+#endif
+}
@@ -0,0 +1,35 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file, mapped where possible, read into a
+// buffer elsewhere. Either way the data is aligned for any type.
+class MappedFile {
+  const char *data;
+  size_t length;
+  void *mapping;
+  std::vector<char> buffer;
+
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+ public:
+  // how the file will be read, a hint for the pager
+  enum Access {
+    Sequential,
+    Random
+  };
+
+  // throws runtime_error when the file can't be read
+  explicit MappedFile(const std::string &path, Access access = Random);
+  ~MappedFile();
+
+  const char *begin() const { return data; }
+
+  const char *end() const { return data + length; }
+
+  size_t size() const { return length; }
+};
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,141 @@
+#include "NewtonSolver.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// lanes iterated together, a few batches of the batch evaluator
+const size_t BlockLanes = 256;
+// lanes taken by one worker of the pool at a time
+const size_t PoolChunk = 4096;
+
+CompiledExpression withDerivative(const Expression *f) {
+  if (!f) throw invalid_argument("null expression in NewtonSolver");
+  unique_ptr<Expression> derivative(f->diffSimplify());
+  vector<const Expression *> outputs;
+  outputs.push_back(f);
+  outputs.push_back(derivative.get());
+  return CompiledExpression(outputs, CompiledExpression::KeepAllSlots);
+}
+
+} // namespace
+
+NewtonSolver::NewtonSolver(const Expression *f, double tolerance, int maxIterations) :
+    program(withDerivative(f)), tolerance(tolerance),
+    maxIterations(maxIterations) { }
+
+double NewtonSolver::solve(double x0, double target) const {
+  // on the stack like ProgramView::operator(), the solver is shared
+  // between threads and owns no buffer
+  double buffer[64];
+  vector<double> heapBuffer;
+  double *slots = buffer;
+  if (program.slotCount() > 64) {
+    heapBuffer.resize(program.slotCount());
+    slots = heapBuffer.data();
+  }
+  int fSlot = program.resultSlots()[0], dfSlot = program.resultSlots()[1];
+  double x = x0;
+  for (int iteration = 0; iteration < maxIterations; iteration++) {
+    double last = x;
+    program.evaluate(last, slots);
+    x = last + (target - slots[fSlot]) / slots[dfSlot];
+    if (fabs(last - x) < tolerance || !std::isfinite(x))
+      break;
+  }
+  return x;
+}
+
+// n <= BlockLanes. The running lanes are kept packed at the front of x,
+// lane[k] is the pair x[k] belongs to.
+size_t NewtonSolver::solveBlock(const double *x0s, const double *targets, double *roots,
+                                size_t n, unsigned char *converged) const {
+  double x[BlockLanes], fx[BlockLanes], dfx[BlockLanes];
+  double *const outputs[] = {fx, dfx};
+  // the rows of the batch evaluator, allocated by the first iteration
+  vector<double> scratch;
+  size_t lane[BlockLanes];
+  for (size_t k = 0; k < n; k++) {
+    lane[k] = k;
+    x[k] = x0s[k];
+  }
+  if (converged)
+    memset(converged, 0, n);
+  size_t running = n;
+  size_t count = 0;
+  for (int iteration = 0; iteration < maxIterations && running > 0; iteration++) {
+    program.evaluate(x, outputs, running, scratch);
+    size_t kept = 0;
+    for (size_t k = 0; k < running; k++) {
+      size_t i = lane[k];
+      double last = x[k];
+      double next = last + (targets[i] - fx[k]) / dfx[k];
+      if (fabs(last - next) < tolerance) {
+        roots[i] = next;
+        if (converged)
+          converged[i] = 1;
+        count++;
+      } else if (!std::isfinite(next)) {
+        roots[i] = next;
+      } else {
+        lane[kept] = i;
+        x[kept] = next;
+        kept++;
+      }
+    }
+    running = kept;
+  }
+  for (size_t k = 0; k < running; k++)
+    roots[lane[k]] = x[k];
+  return count;
+}
+
+size_t NewtonSolver::solve(const double *x0s, const double *targets, double *roots, size_t n,
+                           unsigned char *converged) const {
+  size_t count = 0;
+  for (size_t first = 0; first < n; first += BlockLanes) {
+    size_t m = min(BlockLanes, n - first);
+    count += solveBlock(x0s + first, targets + first, roots + first, m,
+                        converged ? converged + first : NULL);
+  }
+  return count;
+}
+
+size_t NewtonSolver::solve(const double *x0s, const double *targets, double *roots, size_t n,
+                           unsigned char *converged, ThreadPool &pool) const {
+  // workers take chunks of consecutive lanes until none is left
+  atomic<size_t> next(0);
+  atomic<size_t> count(0);
+  function<void()> worker = [&]() {
+    for (;;) {
+      size_t first = next.fetch_add(PoolChunk);
+      if (first >= n)
+        return;
+      size_t m = min(PoolChunk, n - first);
+      count += solve(x0s + first, targets + first, roots + first, m,
+                     converged ? converged + first : NULL);
+    }
+  };
+  size_t chunks = (n + PoolChunk - 1) / PoolChunk;
+  size_t tasks = min(static_cast<size_t>(pool.size()), chunks);
+  vector<future<void> > done;
+  for (size_t k = 0; k < tasks; k++)
+    done.push_back(pool.submit(worker));
+  // every worker must be finished before anything is rethrown, they use
+  // the locals of this frame
+  for (auto it = done.begin(); it != done.end(); it++)
+    it->wait();
+  for (auto it = done.begin(); it != done.end(); it++)
+    it->get();
+  return count;
+}
@@ -0,0 +1,47 @@
+#ifndef NEWTONSOLVER_H
+#define NEWTONSOLVER_H
+
+#include "function.h"
+#include "CompiledExpression.h"
+#include <cstddef>
+
+class ThreadPool;
+
+// Newton's method for f(x) = target over many (x0, target) pairs.
+// f and f' = f->diffSimplify() are compiled once by the constructor, into
+// one program where their common subexpressions are computed once. The
+// pairs are solved by blocks of lanes: every iteration evaluates f and f'
+// over the lanes still running in one pass of the batch evaluator of
+// CompiledExpression, then updates them; a lane leaves the block when its
+// step falls under the tolerance, when x stops being finite, or after
+// maxIterations, so converged lanes cost nothing more. The pool version
+// hands blocks to the workers, lanes are independent, so the roots don't
+// depend on the number of threads.
+// The constructor differentiates and compiles f, which pays off over many
+// targets; a one-off solve is cheaper on the tree with Dual numbers.
+// A NewtonSolver is immutable, it can be shared between threads.
+class NewtonSolver {
+  // outputs f and f'
+  CompiledExpression program;
+  double tolerance;
+  int maxIterations;
+
+  size_t solveBlock(const double *x0s, const double *targets, double *roots, size_t n,
+                    unsigned char *converged) const;
+ public:
+  explicit NewtonSolver(const Expression *f, double tolerance = 1e-10, int maxIterations = 100);
+
+  // the root, or the last iterate if it didn't converge
+  double solve(double x0, double target) const;
+
+  // roots[i] solves f(x) = targets[i] from x0s[i]; roots may be x0s.
+  // converged, if not NULL, gets 1 for the lanes that converged, 0 for the
+  // others. Returns the number of lanes that converged.
+  size_t solve(const double *x0s, const double *targets, double *roots, size_t n,
+               unsigned char *converged = NULL) const;
+  // the same on the workers of pool; must not be called from one of its tasks
+  size_t solve(const double *x0s, const double *targets, double *roots, size_t n,
+               unsigned char *converged, ThreadPool &pool) const;
+};
+
+#endif // NEWTONSOLVER_H
@@ -0,0 +1,72 @@
+#include "catch.hpp"
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "function.h"
+#include "ExpressionEvaluator.h"
+#include "NewtonSolver.h"
+#include "ThreadPool.h"
+using namespace std;
+
+TEST_CASE("NewtonSolver solves every lane", "[newton]") {
+  ExpressionEvaluator evaluator;
+  unique_ptr<Expression> f(evaluator.evaluate("x*x*x"));
+  NewtonSolver solver(f.get());
+  REQUIRE(solver.solve(10, 27) == Approx(3));
+  const size_t n = 1000;
+  vector<double> x0s(n, 10), targets(n), roots(n);
+  vector<unsigned char> converged(n, 7);
+  for (size_t i = 0; i < n; i++)
+    targets[i] = 1 + i;
+  REQUIRE(solver.solve(x0s.data(), targets.data(), roots.data(), n, converged.data()) == n);
+  for (size_t i = 0; i < n; i++) {
+    REQUIRE(converged[i] == 1);
+    REQUIRE(roots[i] == Approx(cbrt(targets[i])));
+  }
+  // in place, without flags
+  REQUIRE(solver.solve(x0s.data(), targets.data(), x0s.data(), n) == n);
+  for (size_t i = 0; i < n; i++)
+    REQUIRE(x0s[i] == Approx(roots[i]));
+}
+
+TEST_CASE("NewtonSolver masks the lanes that don't converge", "[newton]") {
+  ExpressionEvaluator evaluator;
+  unique_ptr<Expression> f(evaluator.evaluate("x*x"));
+  NewtonSolver solver(f.get());
+  // x*x = -1 has no root, from 0 the first step divides by zero
+  double x0s[] = {3, 3, 0, 5};
+  double targets[] = {4, -1, 4, 16};
+  double roots[4];
+  unsigned char converged[4];
+  REQUIRE(solver.solve(x0s, targets, roots, 4, converged) == 2);
+  REQUIRE(converged[0] == 1);
+  REQUIRE(roots[0] == Approx(2));
+  REQUIRE(converged[1] == 0);
+  REQUIRE(std::isfinite(roots[1]));
+  REQUIRE(converged[2] == 0);
+  REQUIRE(!std::isfinite(roots[2]));
+  REQUIRE(converged[3] == 1);
+  REQUIRE(roots[3] == Approx(4));
+}
+
+TEST_CASE("NewtonSolver gives the same roots on a pool", "[newton]") {
+  ExpressionEvaluator evaluator;
+  unique_ptr<Expression> f(evaluator.evaluate("sin(x)/x+cos(x)*x/3"));
+  NewtonSolver solver(f.get());
+  const size_t n = 20000;
+  vector<double> x0s(n, 0.5), targets(n), single(n), pooled(n);
+  vector<unsigned char> singleFlags(n), pooledFlags(n);
+  for (size_t i = 0; i < n; i++)
+    targets[i] = 0.4 + 0.6 * i / n;
+  size_t count = solver.solve(x0s.data(), targets.data(), single.data(), n, singleFlags.data());
+  ThreadPool pool(3);
+  REQUIRE(solver.solve(x0s.data(), targets.data(), pooled.data(), n, pooledFlags.data(), pool)
+          == count);
+  REQUIRE(count > n / 2);
+  for (size_t i = 0; i < n; i++) {
+    REQUIRE(pooled[i] == single[i]);
+    REQUIRE(pooledFlags[i] == singleFlags[i]);
+    if (singleFlags[i])
+      REQUIRE((*f)(single[i]) == Approx(targets[i]));
+  }
+}
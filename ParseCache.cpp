@@ -0,0 +1,141 @@
+#include "ParseCache.h"
+
+using namespace std;
+
+namespace {
+
+// allocation header of every Expression, see Expression::operator new
+const size_t NodeOverhead = 16;
+// bookkeeping of an entry: list node, hash node, key copy headers
+const size_t EntryOverhead = 128;
+
+inline bool isWordChar(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+      || c == '.' || c == '_';
+}
+
+} // namespace
+
+size_t ParseCache::estimateBytes(const Expression *e) {
+  switch (e->nodeType()) {
+    case Expression::TypeAdd:
+    case Expression::TypeMulti: {
+      const ExpressionSet &children = static_cast<const CommutativeOperators *>(e)->getChildren();
+      size_t sum = sizeof(Addition) + NodeOverhead;
+      if (children.size() > 4)
+        sum += children.size() * sizeof(Expression *);
+      for (auto it = children.begin(); it != children.end(); it++)
+        sum += estimateBytes(*it);
+      return sum;
+    }
+    case Expression::TypeDivide: {
+      const Division *d = static_cast<const Division *>(e);
+      return sizeof(Division) + NodeOverhead + estimateBytes(d->getNumerator())
+          + estimateBytes(d->getDenominator());
+    }
+    case Expression::TypeCompo: {
+      const Composition *c = static_cast<const Composition *>(e);
+      return sizeof(Composition) + NodeOverhead + estimateBytes(c->getLeft())
+          + estimateBytes(c->getRight());
+    }
+    case Expression::TypePoly:
+      return sizeof(Polynomial) + NodeOverhead
+          + static_cast<const Polynomial *>(e)->getParameter().size() * sizeof(double);
+    case Expression::TypeConstant:
+      return sizeof(Constant) + NodeOverhead;
+    default:
+      return sizeof(Trigo) + NodeOverhead;
+  }
+}
+
+size_t ParseCache::estimateBytes(const CompiledExpression &program) {
+  return sizeof(CompiledExpression) + program.instructions().size() * sizeof(Instruction)
+      + program.polynomialCoefficients().size() * sizeof(double);
+}
+
+ParseCache::ParseCache(size_t byteLimit)
+    : limit(byteLimit), used(0), hitCount(0), missCount(0), evictionCount(0) { }
+
+string ParseCache::normalize(const string &formula) {
+  string key;
+  key.reserve(formula.size());
+  bool space = false;
+  for (auto it = formula.begin(); it != formula.end(); it++) {
+    if (*it == ' ') {
+      space = true;
+      continue;
+    }
+    // a space between two words keeps them apart
+    if (space && !key.empty() && isWordChar(key[key.size() - 1]) && isWordChar(*it))
+      key.push_back(' ');
+    space = false;
+    key.push_back(*it);
+  }
+  return key;
+}
+
+ParseCache::Entries::iterator ParseCache::lookup(const string &formula) {
+  string key = normalize(formula);
+  auto found = index.find(key);
+  if (found != index.end()) {
+    hitCount++;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second;
+  }
+  missCount++;
+  Entry entry;
+  {
+    // the tree outlives any arena of the caller
+    ExpressionArena::HeapScope heap;
+    entry.expression.reset(evaluator.evaluate(key));
+  }
+  // fills the structure caches of every node, so that readers of the
+  // shared tree never write to it
+  entry.expression->structuralHash();
+  entry.bytes = EntryOverhead + 2 * key.size() + estimateBytes(entry.expression.get());
+  entry.key.swap(key);
+  entries.push_front(entry);
+  index[entries.front().key] = entries.begin();
+  used += entries.front().bytes;
+  evict();
+  return entries.begin();
+}
+
+void ParseCache::evict() {
+  while (used > limit && entries.size() > 1) {
+    Entry &last = entries.back();
+    used -= last.bytes;
+    index.erase(last.key);
+    entries.pop_back();
+    evictionCount++;
+  }
+}
+
+shared_ptr<const Expression> ParseCache::expression(const string &formula) {
+  return lookup(formula)->expression;
+}
+
+shared_ptr<const CompiledExpression> ParseCache::compiled(const string &formula) {
+  Entries::iterator entry = lookup(formula);
+  if (!entry->program) {
+    entry->program = make_shared<CompiledExpression>(entry->expression.get());
+    size_t bytes = estimateBytes(*entry->program);
+    entry->bytes += bytes;
+    used += bytes;
+    shared_ptr<const CompiledExpression> program = entry->program;
+    evict();
+    return program;
+  }
+  return entry->program;
+}
+
+void ParseCache::setByteLimit(size_t byteLimit) {
+  limit = byteLimit;
+  evict();
+}
+
+void ParseCache::clear() {
+  entries.clear();
+  index.clear();
+  used = 0;
+}
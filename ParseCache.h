@@ -0,0 +1,76 @@
+#ifndef PARSECACHE_H
+#define PARSECACHE_H
+
+#include "function.h"
+#include "CompiledExpression.h"
+#include "ExpressionEvaluator.h"
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// LRU cache in front of ExpressionEvaluator::evaluate.
+// Formulas are keyed on their normalized text: spaces are dropped except
+// a single one between two characters of numbers or names, where it
+// separates symbols, so "x * x" and "x*x" share an entry but "2 3" stays
+// an error. The trees are parsed and simplified once, on the heap
+// whatever arena is current, and handed out as shared, immutable trees
+// (their structure caches are filled before they are handed out);
+// their CompiledExpression is built on first request and cached with
+// them. When the estimated size of the entries goes over the limit, the
+// least recently used ones are dropped, the trees themselves live as
+// long as someone holds them. The most recent entry is always kept.
+// Formulas that don't parse aren't cached, evaluate's invalid_argument
+// goes through.
+// A ParseCache isn't thread-safe.
+class ParseCache {
+  struct Entry {
+    std::string key;
+    std::shared_ptr<const Expression> expression;
+    std::shared_ptr<const CompiledExpression> program;
+    size_t bytes;
+  };
+  typedef std::list<Entry> Entries;
+
+  // most recently used first
+  Entries entries;
+  std::unordered_map<std::string, Entries::iterator> index;
+  ExpressionEvaluator evaluator;
+  size_t limit;
+  size_t used;
+  size_t hitCount, missCount, evictionCount;
+
+  Entries::iterator lookup(const std::string &formula);
+  void evict();
+ public:
+  explicit ParseCache(size_t byteLimit = 16 << 20);
+
+  std::shared_ptr<const Expression> expression(const std::string &formula);
+  std::shared_ptr<const CompiledExpression> compiled(const std::string &formula);
+
+  static std::string normalize(const std::string &formula);
+
+  // estimated bytes of a tree or a program, from the sizes of their parts
+  static size_t estimateBytes(const Expression *e);
+  static size_t estimateBytes(const CompiledExpression &program);
+
+  size_t hits() const { return hitCount; }
+
+  size_t misses() const { return missCount; }
+
+  size_t evictions() const { return evictionCount; }
+
+  // cached formulas
+  size_t size() const { return entries.size(); }
+
+  // estimated bytes held by the entries
+  size_t bytes() const { return used; }
+
+  size_t byteLimit() const { return limit; }
+
+  void setByteLimit(size_t byteLimit);
+
+  void clear();
+};
+
+#endif // PARSECACHE_H
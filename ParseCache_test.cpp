@@ -0,0 +1,73 @@
+#include "catch.hpp"
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "function.h"
+#include "ExpressionArena.h"
+#include "ParseCache.h"
+using namespace std;
+
+TEST_CASE("ParseCache normalizes the formulas", "[cache]") {
+  REQUIRE(ParseCache::normalize(" x *  sin( x ) ") == "x*sin(x)");
+  REQUIRE(ParseCache::normalize("2 3") == "2 3");
+  REQUIRE(ParseCache::normalize("1.5   +x") == "1.5+x");
+  ParseCache cache;
+  shared_ptr<const Expression> a = cache.expression("x * sin(x)");
+  shared_ptr<const Expression> b = cache.expression("x*sin( x )");
+  REQUIRE(a == b);
+  REQUIRE(a->stringPrint() == "x*sin(x)");
+  REQUIRE(cache.hits() == 1);
+  REQUIRE(cache.misses() == 1);
+  REQUIRE(cache.size() == 1);
+  REQUIRE_THROWS_AS(cache.expression("2 3"), invalid_argument);
+  REQUIRE(cache.size() == 1);
+  REQUIRE(cache.misses() == 2);
+}
+
+TEST_CASE("ParseCache compiles once", "[cache]") {
+  ParseCache cache;
+  size_t before = cache.bytes();
+  shared_ptr<const CompiledExpression> p = cache.compiled("sin(x)/x+cos(x)*x");
+  size_t treeOnly = cache.bytes();
+  REQUIRE(treeOnly > before);
+  REQUIRE(cache.compiled("sin(x)/x + cos(x)*x") == p);
+  REQUIRE(cache.bytes() == treeOnly);
+  REQUIRE((*p)(0.7) == Approx(sin(0.7) / 0.7 + cos(0.7) * 0.7));
+  REQUIRE((*cache.expression("sin(x)/x+cos(x)*x"))(0.7) == Approx((*p)(0.7)));
+  REQUIRE(cache.hits() == 2);
+}
+
+TEST_CASE("ParseCache drops the least recently used formulas", "[cache]") {
+  ParseCache cache;
+  cache.expression("x+1");
+  size_t oneEntry = cache.bytes();
+  cache.setByteLimit(oneEntry * 3);
+  cache.expression("x+2");
+  cache.expression("x+3");
+  // x+1 becomes the most recent, x+2 goes first
+  cache.expression("x+1");
+  cache.expression("x+4");
+  REQUIRE(cache.size() == 3);
+  REQUIRE(cache.evictions() == 1);
+  size_t misses = cache.misses();
+  cache.expression("x+1");
+  cache.expression("x+3");
+  REQUIRE(cache.misses() == misses);
+  cache.expression("x+2");
+  REQUIRE(cache.misses() == misses + 1);
+  REQUIRE(cache.bytes() <= cache.byteLimit());
+
+  // trees outlive their entry and the arena of the caller
+  shared_ptr<const Expression> kept;
+  {
+    ExpressionArena arena;
+    ExpressionArena::Scope scope(arena);
+    kept = cache.expression("exp(x)*x");
+    REQUIRE(arena.bytesUsed() == 0);
+  }
+  cache.clear();
+  REQUIRE(cache.size() == 0);
+  REQUIRE(cache.bytes() == 0);
+  REQUIRE((*kept)(1) == Approx(exp(1)));
+}
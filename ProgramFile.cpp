@@ -0,0 +1,326 @@
+#include "ProgramFile.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+const char Magic[8] = {'F', 'X', 'P', 'R', 'O', 'G', 0, 0};
+const uint32_t ByteOrderMark = 0x01020304;
+
+// offsets in the header
+const size_t VersionAt = 8;
+const size_t ByteOrderAt = 12;
+const size_t InstructionSizeAt = 16;
+const size_t CountAt = 20;
+const size_t FileSizeAt = 24;
+const size_t DirectoryAt = 32;
+const size_t NamesAt = 40;
+const size_t CodeAt = 48;
+const size_t ConstantsAt = 56;
+const size_t StringsAt = 64;
+const size_t ChecksumAt = 72;
+const size_t HeaderSize = 80;
+
+// offsets in a directory entry
+const size_t NameOffsetAt = 0;
+const size_t NameLengthAt = 4;
+const size_t FirstInstructionAt = 8;
+const size_t InstructionCountAt = 12;
+const size_t FirstConstantAt = 16;
+const size_t ConstantCountAt = 20;
+const size_t SlotsAt = 24;
+const size_t ResultAt = 28;
+const size_t EntrySize = 32;
+
+template<class T>
+T load(const char *p) {
+  T v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+template<class T>
+void store(string &image, size_t at, T v) {
+  memcpy(&image[at], &v, sizeof(v));
+}
+
+size_t align8(size_t n) {
+  return (n + 7) & ~static_cast<size_t>(7);
+}
+
+void fail(const char *message) {
+  throw invalid_argument(string("program file: ") + message);
+}
+
+unsigned long long fnv1a(unsigned long long hash, const char *begin, const char *end) {
+  for (const char *p = begin; p != end; p++) {
+    hash ^= static_cast<unsigned char>(*p);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// the instruction reads and writes slots below slots only, and
+// coefficients below constantCount
+bool validInstruction(const char *p, int slots, uint32_t constantCount) {
+  int32_t op = load<int32_t>(p + offsetof(Instruction, op));
+  int32_t dst = load<int32_t>(p + offsetof(Instruction, dst));
+  int32_t a = load<int32_t>(p + offsetof(Instruction, a));
+  int32_t b = load<int32_t>(p + offsetof(Instruction, b));
+  int32_t n = load<int32_t>(p + offsetof(Instruction, n));
+  if (dst < 1 || dst >= slots)
+    return false;
+  switch (op) {
+    case Instruction::Const:
+      return true;
+    case Instruction::Add:
+    case Instruction::Multi:
+    case Instruction::Divide:
+      return a >= 0 && a < slots && b >= 0 && b < slots;
+    case Instruction::Poly:
+      return a >= 0 && a < slots && b >= 0 && n >= 0
+          && static_cast<uint32_t>(b) <= constantCount
+          && static_cast<uint32_t>(n) <= constantCount - static_cast<uint32_t>(b);
+    case Instruction::Sin:
+    case Instruction::Cos:
+    case Instruction::Tan:
+    case Instruction::Exp:
+    case Instruction::Log:
+      return a >= 0 && a < slots;
+    default:
+      return false;
+  }
+}
+
+} // namespace
+
+void ProgramFile::Writer::add(const string &name, const CompiledExpression &program) {
+  if (program.resultSlots().size() > 1)
+    throw invalid_argument("program file: more than one output in " + name);
+  if (!names.insert(name).second)
+    throw invalid_argument("program file: duplicate name " + name);
+  Program p;
+  p.name = name;
+  p.slots = program.slotCount();
+  p.result = program.resultSlot();
+  p.code = program.instructions();
+  p.coefficients = program.polynomialCoefficients();
+  programs.push_back(p);
+}
+
+string ProgramFile::Writer::image() const {
+  size_t instructions = 0, constants = 0, characters = 0;
+  for (auto it = programs.begin(); it != programs.end(); it++) {
+    instructions += it->code.size();
+    constants += it->coefficients.size();
+    characters += it->name.size();
+  }
+  size_t directory = HeaderSize;
+  size_t sortedNames = directory + programs.size() * EntrySize;
+  size_t code = align8(sortedNames + programs.size() * sizeof(uint32_t));
+  size_t constantSection = code + instructions * sizeof(Instruction);
+  size_t strings = constantSection + constants * sizeof(double);
+  size_t fileSize = align8(strings + characters);
+  if (fileSize > 0xffffffffULL)
+    throw invalid_argument("program file: more than 4 GB");
+
+  // zeroed, padding included, so equal programs give equal files
+  string image(fileSize, '\0');
+  memcpy(&image[0], Magic, sizeof(Magic));
+  store<uint32_t>(image, VersionAt, Version);
+  store<uint32_t>(image, ByteOrderAt, ByteOrderMark);
+  store<uint32_t>(image, InstructionSizeAt, sizeof(Instruction));
+  store<uint32_t>(image, CountAt, programs.size());
+  store<uint64_t>(image, FileSizeAt, fileSize);
+  store<uint64_t>(image, DirectoryAt, directory);
+  store<uint64_t>(image, NamesAt, sortedNames);
+  store<uint64_t>(image, CodeAt, code);
+  store<uint64_t>(image, ConstantsAt, constantSection);
+  store<uint64_t>(image, StringsAt, strings);
+
+  size_t instruction = 0, constant = 0, character = 0;
+  for (size_t i = 0; i < programs.size(); i++) {
+    const Program &p = programs[i];
+    size_t entry = directory + i * EntrySize;
+    store<uint32_t>(image, entry + NameOffsetAt, character);
+    store<uint32_t>(image, entry + NameLengthAt, p.name.size());
+    store<uint32_t>(image, entry + FirstInstructionAt, instruction);
+    store<uint32_t>(image, entry + InstructionCountAt, p.code.size());
+    store<uint32_t>(image, entry + FirstConstantAt, constant);
+    store<uint32_t>(image, entry + ConstantCountAt, p.coefficients.size());
+    store<int32_t>(image, entry + SlotsAt, p.slots);
+    store<int32_t>(image, entry + ResultAt, p.result);
+    for (auto ins = p.code.begin(); ins != p.code.end(); ins++, instruction++) {
+      size_t at = code + instruction * sizeof(Instruction);
+      store<int32_t>(image, at + offsetof(Instruction, op), ins->op);
+      store<int32_t>(image, at + offsetof(Instruction, dst), ins->dst);
+      store<int32_t>(image, at + offsetof(Instruction, a), ins->a);
+      store<int32_t>(image, at + offsetof(Instruction, b), ins->b);
+      store<int32_t>(image, at + offsetof(Instruction, n), ins->n);
+      store<double>(image, at + offsetof(Instruction, value), ins->value);
+    }
+    if (!p.coefficients.empty())
+      memcpy(&image[constantSection + constant * sizeof(double)], p.coefficients.data(),
+             p.coefficients.size() * sizeof(double));
+    constant += p.coefficients.size();
+    if (!p.name.empty())
+      memcpy(&image[strings + character], p.name.data(), p.name.size());
+    character += p.name.size();
+  }
+
+  vector<uint32_t> order(programs.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return programs[a].name < programs[b].name;
+  });
+  if (!order.empty())
+    memcpy(&image[sortedNames], order.data(), order.size() * sizeof(uint32_t));
+
+  store<uint64_t>(image, ChecksumAt, checksum(image.data(), image.data() + image.size()));
+  return image;
+}
+
+void ProgramFile::Writer::save(const string &path) const {
+  string bytes = image();
+  ofstream out(path.c_str(), ios::binary);
+  if (!out) throw runtime_error("can't open " + path);
+  out.write(bytes.data(), bytes.size());
+  if (!out) throw runtime_error("can't write " + path);
+}
+
+unsigned long long ProgramFile::checksum(const char *begin, const char *end) {
+  if (static_cast<size_t>(end - begin) < HeaderSize)
+    fail("truncated header");
+  const char zero[8] = {0};
+  unsigned long long hash = 14695981039346656037ULL;
+  hash = fnv1a(hash, begin, begin + ChecksumAt);
+  hash = fnv1a(hash, zero, zero + 8);
+  return fnv1a(hash, begin + ChecksumAt + 8, end);
+}
+
+ProgramFile::ProgramFile(const string &path) : file(new MappedFile(path)) {
+  open(file->begin(), file->end());
+}
+
+ProgramFile::ProgramFile(const char *begin, const char *end) {
+  open(begin, end);
+}
+
+ProgramFile::~ProgramFile() { }
+
+void ProgramFile::open(const char *begin, const char *end) {
+  size_t length = end - begin;
+  if (length < HeaderSize)
+    fail("truncated header");
+  if (reinterpret_cast<uintptr_t>(begin) % 8 != 0)
+    fail("image not aligned to 8");
+  if (memcmp(begin, Magic, sizeof(Magic)) != 0)
+    fail("not a program file");
+  if (load<uint32_t>(begin + VersionAt) != Version)
+    fail("unsupported version");
+  if (load<uint32_t>(begin + ByteOrderAt) != ByteOrderMark
+      || load<uint32_t>(begin + InstructionSizeAt) != sizeof(Instruction))
+    fail("written by a host of another byte order or instruction layout");
+  if (load<uint64_t>(begin + FileSizeAt) != length)
+    fail("truncated file");
+  if (load<uint64_t>(begin + ChecksumAt) != checksum(begin, end))
+    fail("checksum mismatch");
+
+  uint64_t directory = load<uint64_t>(begin + DirectoryAt);
+  uint64_t sortedNames = load<uint64_t>(begin + NamesAt);
+  uint64_t codeAt = load<uint64_t>(begin + CodeAt);
+  uint64_t constantsAt = load<uint64_t>(begin + ConstantsAt);
+  uint64_t stringsAt = load<uint64_t>(begin + StringsAt);
+  uint64_t programs = load<uint32_t>(begin + CountAt);
+  if (directory < HeaderSize || sortedNames < directory + programs * EntrySize
+      || codeAt < sortedNames + programs * sizeof(uint32_t) || constantsAt < codeAt
+      || stringsAt < constantsAt || length < stringsAt
+      || directory % 8 || sortedNames % 8 || codeAt % 8 || constantsAt % 8)
+    fail("bad section offsets");
+  uint64_t instructions = (constantsAt - codeAt) / sizeof(Instruction);
+  uint64_t constantCount = (stringsAt - constantsAt) / sizeof(double);
+  uint64_t characters = length - stringsAt;
+
+  count = programs;
+  entries = begin + directory;
+  sorted = reinterpret_cast<const unsigned *>(begin + sortedNames);
+  code = reinterpret_cast<const Instruction *>(begin + codeAt);
+  constants = reinterpret_cast<const double *>(begin + constantsAt);
+  strings = begin + stringsAt;
+
+  for (size_t i = 0; i < count; i++) {
+    const char *entry = entries + i * EntrySize;
+    uint64_t first = load<uint32_t>(entry + FirstInstructionAt);
+    uint64_t size = load<uint32_t>(entry + InstructionCountAt);
+    uint64_t firstConstant = load<uint32_t>(entry + FirstConstantAt);
+    uint32_t constantsUsed = load<uint32_t>(entry + ConstantCountAt);
+    int32_t slots = load<int32_t>(entry + SlotsAt);
+    int32_t result = load<int32_t>(entry + ResultAt);
+    if (first + size > instructions || firstConstant + constantsUsed > constantCount
+        || static_cast<uint64_t>(load<uint32_t>(entry + NameOffsetAt))
+            + load<uint32_t>(entry + NameLengthAt) > characters)
+      fail("program out of the file");
+    // every instruction writes one slot at most
+    if (slots < 1 || static_cast<uint64_t>(slots) > size + 1 || result < 0 || result >= slots)
+      fail("bad slot count");
+    const char *p = reinterpret_cast<const char *>(code + first);
+    for (uint64_t k = 0; k < size; k++, p += sizeof(Instruction))
+      if (!validInstruction(p, slots, constantsUsed))
+        fail("bad instruction");
+    if (sorted[i] >= count)
+      fail("bad name index");
+  }
+}
+
+ProgramView ProgramFile::program(size_t index) const {
+  if (index >= count)
+    throw out_of_range("program file: no program " + to_string(index));
+  const char *entry = entries + index * EntrySize;
+  ProgramView v;
+  v.code = code + load<uint32_t>(entry + FirstInstructionAt);
+  v.codeSize = load<uint32_t>(entry + InstructionCountAt);
+  v.coefficients = constants + load<uint32_t>(entry + FirstConstantAt);
+  v.slots = load<int32_t>(entry + SlotsAt);
+  v.result = load<int32_t>(entry + ResultAt);
+  return v;
+}
+
+string ProgramFile::name(size_t index) const {
+  if (index >= count)
+    throw out_of_range("program file: no program " + to_string(index));
+  const char *entry = entries + index * EntrySize;
+  return string(strings + load<uint32_t>(entry + NameOffsetAt),
+                load<uint32_t>(entry + NameLengthAt));
+}
+
+long ProgramFile::find(const string &name) const {
+  size_t low = 0, high = count;
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    const char *entry = entries + sorted[middle] * EntrySize;
+    int order = name.compare(0, string::npos, strings + load<uint32_t>(entry + NameOffsetAt),
+                             load<uint32_t>(entry + NameLengthAt));
+    if (order == 0)
+      return sorted[middle];
+    if (order > 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return -1;
+}
+
+ProgramView ProgramFile::program(const string &name) const {
+  long index = find(name);
+  if (index < 0)
+    throw out_of_range("program file: no program " + name);
+  return program(index);
+}
@@ -0,0 +1,96 @@
+#ifndef PROGRAMFILE_H
+#define PROGRAMFILE_H
+
+#include "CompiledExpression.h"
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// File of named compiled programs, evaluated in place once mapped.
+// Everything is addressed by offsets from the start of the file, so the
+// image can be mapped anywhere; the instructions are stored in the layout
+// of Instruction, so a ProgramView points straight into the mapping and
+// nothing is decoded or copied.
+//
+//   Header      80 bytes: magic "FXPROG\0\0", version, byte order mark,
+//               sizeof(Instruction), program count, file size, offsets of
+//               the sections in file order, FNV-1a checksum
+//   Directory   one Entry of 32 bytes per program, in insertion order
+//   Names       program indexes sorted by name, for binary search
+//   Code        the instructions of all programs, one run per program
+//   Constants   the polynomial coefficients, one run per program
+//   Strings     the names, not terminated
+//
+// Sections start at multiples of 8. The checksum is a 64-bit FNV-1a of the
+// whole file with the checksum field itself read as zero. Files are in the
+// byte order and Instruction layout of the host that wrote them, a reader
+// with another one rejects them rather than convert.
+// Opening checks the header, the checksum and every instruction (opcode,
+// slots and coefficient ranges inside the program), so evaluating a
+// program of a file that opened can't read outside of it. Malformed files
+// throw invalid_argument, files that can't be read runtime_error.
+// Programs have a single output, multi-output ones are rejected.
+class ProgramFile {
+ public:
+  static const unsigned Version = 1;
+
+  // builds the image of a file
+  class Writer {
+    struct Program {
+      std::string name;
+      int slots;
+      int result;
+      std::vector<Instruction> code;
+      std::vector<double> coefficients;
+    };
+    std::vector<Program> programs;
+    std::set<std::string> names;
+   public:
+    // names must be unique and the program must have a single output,
+    // invalid_argument otherwise
+    void add(const std::string &name, const CompiledExpression &program);
+
+    size_t size() const { return programs.size(); }
+
+    std::string image() const;
+    // throws runtime_error when the file can't be written
+    void save(const std::string &path) const;
+  };
+
+ private:
+  std::unique_ptr<MappedFile> file;
+  size_t count;
+  const char *entries;
+  const unsigned *sorted;
+  const Instruction *code;
+  const double *constants;
+  const char *strings;
+
+  ProgramFile(const ProgramFile &);
+  ProgramFile &operator=(const ProgramFile &);
+  void open(const char *begin, const char *end);
+ public:
+  // maps the file
+  explicit ProgramFile(const std::string &path);
+  // over an image the caller keeps alive and doesn't move, aligned to 8
+  ProgramFile(const char *begin, const char *end);
+  ~ProgramFile();
+
+  size_t size() const { return count; }
+
+  ProgramView program(size_t index) const;
+  std::string name(size_t index) const;
+
+  // index of the program called name, -1 if there's none
+  long find(const std::string &name) const;
+  // throws out_of_range if there's none
+  ProgramView program(const std::string &name) const;
+
+  // checksum of a whole image, its checksum field read as zero
+  static unsigned long long checksum(const char *begin, const char *end);
+};
+
+#endif // PROGRAMFILE_H
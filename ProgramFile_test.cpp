@@ -0,0 +1,135 @@
+#include "catch.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "function.h"
+#include "CompiledExpression.h"
+#include "ExpressionEvaluator.h"
+#include "ProgramFile.h"
+using namespace std;
+
+namespace {
+
+const char *programCorpus[] = {
+    "2*x*x*x-x/3", "sin(x)/x+cos(x)*x/3", "exp(sin(x)*x)-log(x+2.5)", "(2/x)/(sin(x)/exp(x))",
+    "tan(x*x)/(1+x*x)", "sin(cos(x))*0.5+1e-3*x"
+};
+const int programKinds = sizeof(programCorpus) / sizeof(programCorpus[0]);
+
+// copy of an image at an address aligned for doubles
+vector<double> aligned(const string &image) {
+  vector<double> words((image.size() + 7) / 8);
+  memcpy(words.data(), image.data(), image.size());
+  return words;
+}
+
+const char *imageBegin(const vector<double> &words) {
+  return reinterpret_cast<const char *>(words.data());
+}
+
+} // namespace
+
+TEST_CASE("ProgramFile evaluates the programs in place", "[programfile]") {
+  ExpressionEvaluator evaluator;
+  vector<unique_ptr<Expression> > trees;
+  vector<unique_ptr<CompiledExpression> > programs;
+  ProgramFile::Writer writer;
+  for (int k = 0; k < programKinds; k++) {
+    trees.push_back(unique_ptr<Expression>(evaluator.evaluate(programCorpus[k])));
+    programs.push_back(unique_ptr<CompiledExpression>(new CompiledExpression(trees.back().get())));
+    writer.add(string("f") + char('a' + programKinds - 1 - k), *programs.back());
+  }
+  // with a polynomial composed with a function
+  vector<double> coefficients;
+  coefficients.push_back(1);
+  coefficients.push_back(-2);
+  coefficients.push_back(0.5);
+  trees.push_back(unique_ptr<Expression>(new Composition(new Polynomial(coefficients),
+                                                         new Trigo(Trigo::Sin))));
+  programs.push_back(unique_ptr<CompiledExpression>(new CompiledExpression(trees.back().get())));
+  writer.add("poly", *programs.back());
+  REQUIRE_THROWS_AS(writer.add("poly", *programs.back()), invalid_argument);
+  vector<const Expression *> outputs;
+  outputs.push_back(trees[0].get());
+  outputs.push_back(trees[1].get());
+  CompiledExpression pair(outputs);
+  REQUIRE_THROWS_AS(writer.add("pair", pair), invalid_argument);
+
+  string image = writer.image();
+  REQUIRE(writer.image() == image);
+  vector<double> words = aligned(image);
+  ProgramFile file(imageBegin(words), imageBegin(words) + image.size());
+  REQUIRE(file.size() == programs.size());
+  double xs[100], out[100];
+  for (int i = 0; i < 100; i++)
+    xs[i] = 0.1 + 0.03 * i;
+  for (size_t k = 0; k < programs.size(); k++) {
+    ProgramView view = file.program(k);
+    REQUIRE(reinterpret_cast<const char *>(view.code) > imageBegin(words));
+    REQUIRE(reinterpret_cast<const char *>(view.code) < imageBegin(words) + image.size());
+    for (double x = 0.15; x < 3; x += 0.35)
+      REQUIRE(view(x) == (*programs[k])(x));
+    view.evaluate(xs, out, 100);
+    for (int i = 0; i < 100; i++)
+      REQUIRE(out[i] == Approx((*programs[k])(xs[i])));
+    REQUIRE(file.find(file.name(k)) == static_cast<long>(k));
+  }
+  REQUIRE(file.name(programKinds) == "poly");
+  REQUIRE(file.program("poly")(0.4) == Approx(1 - 2 * sin(0.4) + 0.5 * sin(0.4) * sin(0.4)));
+  REQUIRE(file.find("missing") == -1);
+  REQUIRE_THROWS_AS(file.program("missing"), out_of_range);
+  REQUIRE_THROWS_AS(file.program(programs.size()), out_of_range);
+
+  string path = "ProgramFile_test.bin";
+  writer.save(path);
+  {
+    ProgramFile mapped(path);
+    REQUIRE(mapped.size() == programs.size());
+    REQUIRE(mapped.program("fa")(0.7) == (*programs[programKinds - 1])(0.7));
+  }
+  remove(path.c_str());
+  REQUIRE_THROWS_AS((ProgramFile(path)), runtime_error);
+}
+
+TEST_CASE("ProgramFile rejects damaged files", "[programfile]") {
+  ExpressionEvaluator evaluator;
+  unique_ptr<Expression> e(evaluator.evaluate("sin(x)/x+cos(x)*x/3"));
+  CompiledExpression program(e.get());
+  ProgramFile::Writer writer;
+  writer.add("f", program);
+  string image = writer.image();
+  vector<double> words = aligned(image);
+  REQUIRE_NOTHROW((ProgramFile(imageBegin(words), imageBegin(words) + image.size())));
+
+  // any flipped byte is caught by the checksum
+  for (size_t i = 0; i < image.size(); i += 7) {
+    string damaged = image;
+    damaged[i] ^= 0x10;
+    vector<double> w = aligned(damaged);
+    REQUIRE_THROWS_AS((ProgramFile(imageBegin(w), imageBegin(w) + damaged.size())), invalid_argument);
+  }
+  REQUIRE_THROWS_AS((ProgramFile(imageBegin(words), imageBegin(words) + image.size() - 8)), invalid_argument);
+  REQUIRE_THROWS_AS((ProgramFile(imageBegin(words), imageBegin(words) + 40)), invalid_argument);
+
+  // an instruction writing past its slots, with a checksum to match
+  string forged = image;
+  size_t codeAt;
+  memcpy(&codeAt, &forged[48], sizeof(codeAt));
+  int slot = 1000;
+  memcpy(&forged[codeAt + offsetof(Instruction, dst)], &slot, sizeof(slot));
+  unsigned long long sum = ProgramFile::checksum(forged.data(), forged.data() + forged.size());
+  memcpy(&forged[72], &sum, sizeof(sum));
+  vector<double> w = aligned(forged);
+  string message;
+  try {
+    ProgramFile file(imageBegin(w), imageBegin(w) + forged.size());
+  } catch (const invalid_argument &error) {
+    message = error.what();
+  }
+  REQUIRE(message == "program file: bad instruction");
+}
@@ -0,0 +1,336 @@
+#include "SimdMath.h"
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMDMATH_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// named wrappers, std::sin etc. are overloaded and can't be passed around
+double libmSin(double x) { return std::sin(x); }
+double libmCos(double x) { return std::cos(x); }
+double libmTan(double x) { return std::tan(x); }
+double libmExp(double x) { return std::exp(x); }
+double libmLog(double x) { return std::log(x); }
+
+void libmLoop(double (*f)(double), const double *a, double *dst, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = f(a[i]);
+}
+
+#ifdef SIMDMATH_X86
+
+#define SIMDMATH_AVX2 __attribute__((target("avx2")))
+
+// pi/2 split in four parts, the first three have 32 significant bits so
+// q * part is exact for |q| < 2^21
+const double PiOver2_1 = 1.5707963267341256;        // 0x1.921fb544p+0
+const double PiOver2_2 = 6.077100506303966e-11;     // 0x1.0b4611a6p-34
+const double PiOver2_3 = 2.0222662487111665e-21;    // 0x1.3198a2ep-69
+const double PiOver2_4 = 8.4784276603689e-32;       // 0x1.b839a252049c1p-104
+const double TwoOverPi = 0.6366197723675814;
+const double TrigoLimit = 1e5;
+
+// fdlibm __kernel_sin and __kernel_cos on [-pi/4, pi/4]
+const double S1 = -1.66666666666666324348e-01;
+const double S2 = 8.33333333332248946124e-03;
+const double S3 = -1.98412698298579493134e-04;
+const double S4 = 2.75573137070700676789e-06;
+const double S5 = -2.50507602534068634195e-08;
+const double S6 = 1.58969099521155010221e-10;
+const double C1 = 4.16666666666666019037e-02;
+const double C2 = -1.38888888888741095749e-03;
+const double C3 = 2.48015872894767294178e-05;
+const double C4 = -2.75573143513906633035e-07;
+const double C5 = 2.08757232129817482790e-09;
+const double C6 = -1.13596475577881948265e-11;
+
+// ln(2) split so that k * Ln2Hi is exact for the exponents of a double
+const double Ln2Hi = 6.93147180369123816490e-01;
+const double Ln2Lo = 1.90821492927058770002e-10;
+const double Log2e = 1.4426950408889634;
+const double ExpMin = -708;
+const double ExpMax = 709;
+
+// fdlibm __ieee754_log on [sqrt(2)/2, sqrt(2)]
+const double Lg1 = 6.666666666666735130e-01;
+const double Lg2 = 3.999999999940941908e-01;
+const double Lg3 = 2.857142874366239149e-01;
+const double Lg4 = 2.222219843214978396e-01;
+const double Lg5 = 1.818357216161805012e-01;
+const double Lg6 = 1.531383769920937332e-01;
+const double Lg7 = 1.479819860511658591e-01;
+const double Sqrt2 = 1.4142135623730951;
+const double DoubleMin = 2.2250738585072014e-308;
+const double DoubleMax = 1.7976931348623157e308;
+
+// adding 1.5 * 2^52 to an integral double |v| < 2^51 leaves v, in two's
+// complement, in the low bits of the result
+const double RoundingMagic = 6755399441055744.0;
+
+SIMDMATH_AVX2 inline __m256d mul(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+
+SIMDMATH_AVX2 inline __m256d add(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+
+SIMDMATH_AVX2 inline __m256d sub(__m256d a, __m256d b) { return _mm256_sub_pd(a, b); }
+
+SIMDMATH_AVX2 inline __m256d set(double v) { return _mm256_set1_pd(v); }
+
+// multiply-add without fusing, c + a * b
+SIMDMATH_AVX2 inline __m256d madd(__m256d a, __m256d b, __m256d c) {
+  return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+}
+
+SIMDMATH_AVX2 inline __m256d absolute(__m256d x) {
+  return _mm256_andnot_pd(set(-0.0), x);
+}
+
+// the lanes sin, cos and tan leave to the C library: |x| > TrigoLimit,
+// zero, subnormals, infinities and NaN
+SIMDMATH_AVX2 inline __m256d trigoOutOfDomain(__m256d x) {
+  __m256d ax = absolute(x);
+  return _mm256_or_pd(_mm256_cmp_pd(ax, set(TrigoLimit), _CMP_NLE_UQ),
+                      _mm256_cmp_pd(ax, set(DoubleMin), _CMP_LT_OQ));
+}
+
+// stores y into dst, after recomputing with f the lanes selected by
+// outOfDomain from the original arguments x
+SIMDMATH_AVX2 inline void store(double *dst, __m256d y, __m256d x, __m256d outOfDomain,
+                                double (*f)(double)) {
+  int mask = _mm256_movemask_pd(outOfDomain);
+  if (mask) {
+    double in[4], out[4];
+    _mm256_storeu_pd(in, x);
+    _mm256_storeu_pd(out, y);
+    for (int k = 0; k < 4; k++)
+      if (mask & (1 << k))
+        out[k] = f(in[k]);
+    y = _mm256_loadu_pd(out);
+  }
+  _mm256_storeu_pd(dst, y);
+}
+
+// x = q * pi/2 + r with |r| <= pi/4, returns r and the quadrant q
+SIMDMATH_AVX2 inline __m256d reduce(__m256d x, __m256i &quadrant) {
+  __m256d q = _mm256_round_pd(mul(x, set(TwoOverPi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256d r = sub(x, mul(q, set(PiOver2_1)));
+  r = sub(r, mul(q, set(PiOver2_2)));
+  r = sub(r, mul(q, set(PiOver2_3)));
+  r = sub(r, mul(q, set(PiOver2_4)));
+  quadrant = _mm256_castpd_si256(add(q, set(RoundingMagic)));
+  return r;
+}
+
+SIMDMATH_AVX2 inline __m256d sinKernel(__m256d r, __m256d z) {
+  __m256d p = madd(z, set(S6), set(S5));
+  p = madd(z, p, set(S4));
+  p = madd(z, p, set(S3));
+  p = madd(z, p, set(S2));
+  p = madd(z, p, set(S1));
+  return add(r, mul(mul(z, r), p));
+}
+
+SIMDMATH_AVX2 inline __m256d cosKernel(__m256d z) {
+  __m256d p = madd(z, set(C6), set(C5));
+  p = madd(z, p, set(C4));
+  p = madd(z, p, set(C3));
+  p = madd(z, p, set(C2));
+  p = madd(z, p, set(C1));
+  p = mul(z, p);
+  __m256d hz = mul(set(0.5), z);
+  __m256d w = sub(set(1), hz);
+  return add(w, add(sub(sub(set(1), w), hz), mul(z, p)));
+}
+
+// lanes of the quadrant with the given bit set, as a double mask
+SIMDMATH_AVX2 inline __m256d quadrantBit(__m256i quadrant, long long bit) {
+  __m256i b = _mm256_set1_epi64x(bit);
+  return _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(quadrant, b), b));
+}
+
+// sin(x) for offset 0, cos(x) = sin(x + pi/2) for offset 1
+SIMDMATH_AVX2 void sinCosAvx2(const double *a, double *dst, size_t n, long long offset,
+                              double (*f)(double)) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(a + i);
+    __m256d outOfDomain = trigoOutOfDomain(x);
+    __m256i quadrant;
+    __m256d r = reduce(x, quadrant);
+    quadrant = _mm256_add_epi64(quadrant, _mm256_set1_epi64x(offset));
+    __m256d z = mul(r, r);
+    __m256d s = sinKernel(r, z);
+    __m256d c = cosKernel(z);
+    __m256d y = _mm256_blendv_pd(s, c, quadrantBit(quadrant, 1));
+    y = _mm256_xor_pd(y, _mm256_and_pd(quadrantBit(quadrant, 2), set(-0.0)));
+    store(dst + i, y, x, outOfDomain, f);
+  }
+  libmLoop(f, a + i, dst + i, n - i);
+}
+
+SIMDMATH_AVX2 void tanAvx2(const double *a, double *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(a + i);
+    __m256d outOfDomain = trigoOutOfDomain(x);
+    __m256i quadrant;
+    __m256d r = reduce(x, quadrant);
+    __m256d z = mul(r, r);
+    __m256d s = sinKernel(r, z);
+    __m256d c = cosKernel(z);
+    // tan(r) in even quadrants, -cot(r) in odd ones
+    __m256d odd = quadrantBit(quadrant, 1);
+    __m256d num = _mm256_blendv_pd(s, _mm256_xor_pd(c, set(-0.0)), odd);
+    __m256d den = _mm256_blendv_pd(c, s, odd);
+    store(dst + i, _mm256_div_pd(num, den), x, outOfDomain, libmTan);
+  }
+  libmLoop(libmTan, a + i, dst + i, n - i);
+}
+
+SIMDMATH_AVX2 void expAvx2(const double *a, double *dst, size_t n) {
+  // Taylor coefficients 1/k!, k = 2..13, enough for |r| <= ln(2)/2
+  static const double InverseFactorial[] = {
+      1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320,
+      1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600, 1.0 / 6227020800
+  };
+  const __m256i magicBits = _mm256_castpd_si256(set(RoundingMagic));
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(a + i);
+    __m256d inDomain = _mm256_and_pd(_mm256_cmp_pd(x, set(ExpMin), _CMP_GE_OQ),
+                                     _mm256_cmp_pd(x, set(ExpMax), _CMP_LE_OQ));
+    // keep the out of domain lanes finite, they are recomputed anyway
+    __m256d xr = _mm256_blendv_pd(set(0), x, inDomain);
+    // x = k * ln(2) + r
+    __m256d k = _mm256_round_pd(mul(xr, set(Log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = sub(sub(xr, mul(k, set(Ln2Hi))), mul(k, set(Ln2Lo)));
+    __m256d p = set(InverseFactorial[11]);
+    for (int j = 10; j >= 0; j--)
+      p = madd(p, r, set(InverseFactorial[j]));
+    // exp(r) = 1 + (r + r^2 * p)
+    __m256d er = add(set(1), add(r, mul(mul(r, r), p)));
+    // 2^k built from the exponent bits
+    __m256i ki = _mm256_sub_epi64(_mm256_castpd_si256(add(k, set(RoundingMagic))), magicBits);
+    __m256i bits = _mm256_slli_epi64(_mm256_add_epi64(ki, _mm256_set1_epi64x(1023)), 52);
+    __m256d y = mul(er, _mm256_castsi256_pd(bits));
+    store(dst + i, y, x, _mm256_xor_pd(inDomain, _mm256_castsi256_pd(_mm256_set1_epi64x(-1))), libmExp);
+  }
+  libmLoop(libmExp, a + i, dst + i, n - i);
+}
+
+SIMDMATH_AVX2 void logAvx2(const double *a, double *dst, size_t n) {
+  const __m256i mantissaMask = _mm256_set1_epi64x(0x000fffffffffffffLL);
+  const __m256i oneBits = _mm256_set1_epi64x(0x3ff0000000000000LL);
+  const __m256i twoPow52Bits = _mm256_set1_epi64x(0x4330000000000000LL);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(a + i);
+    __m256d inDomain = _mm256_and_pd(_mm256_cmp_pd(x, set(DoubleMin), _CMP_GE_OQ),
+                                     _mm256_cmp_pd(x, set(DoubleMax), _CMP_LE_OQ));
+    __m256d xr = _mm256_blendv_pd(set(1), x, inDomain);
+    // x = 2^e * m, m in [1, 2)
+    __m256i bits = _mm256_castpd_si256(xr);
+    __m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, mantissaMask), oneBits));
+    __m256d e = sub(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), twoPow52Bits)),
+                    set(4503599627370496.0 + 1023));
+    // bring m into [sqrt(2)/2, sqrt(2)]
+    __m256d big = _mm256_cmp_pd(m, set(Sqrt2), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, mul(m, set(0.5)), big);
+    e = add(e, _mm256_and_pd(big, set(1)));
+    // log(m) = f - hfsq + s * (hfsq + R), s = f / (2 + f)
+    __m256d f = sub(m, set(1));
+    __m256d s = _mm256_div_pd(f, add(set(2), f));
+    __m256d z = mul(s, s);
+    __m256d w = mul(z, z);
+    __m256d t1 = mul(w, madd(w, madd(w, set(Lg6), set(Lg4)), set(Lg2)));
+    __m256d t2 = mul(z, madd(w, madd(w, madd(w, set(Lg7), set(Lg5)), set(Lg3)), set(Lg1)));
+    __m256d R = add(t2, t1);
+    __m256d hfsq = mul(mul(set(0.5), f), f);
+    __m256d y = sub(mul(e, set(Ln2Hi)),
+                    sub(sub(hfsq, add(mul(s, add(hfsq, R)), mul(e, set(Ln2Lo)))), f));
+    store(dst + i, y, x, _mm256_xor_pd(inDomain, _mm256_castsi256_pd(_mm256_set1_epi64x(-1))), libmLog);
+  }
+  libmLoop(libmLog, a + i, dst + i, n - i);
+}
+
+#endif
+
+} // namespace
+
+bool simdMathUsesAvx2() {
+#ifdef SIMDMATH_X86
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+#ifdef SIMDMATH_X86
+
+void simdSinAvx2(const double *a, double *dst, size_t n) {
+  sinCosAvx2(a, dst, n, 0, libmSin);
+}
+
+void simdCosAvx2(const double *a, double *dst, size_t n) {
+  sinCosAvx2(a, dst, n, 1, libmCos);
+}
+
+void simdTanAvx2(const double *a, double *dst, size_t n) {
+  tanAvx2(a, dst, n);
+}
+
+void simdExpAvx2(const double *a, double *dst, size_t n) {
+  expAvx2(a, dst, n);
+}
+
+void simdLogAvx2(const double *a, double *dst, size_t n) {
+  logAvx2(a, dst, n);
+}
+
+#else
+
+void simdSinAvx2(const double *a, double *dst, size_t n) { libmLoop(libmSin, a, dst, n); }
+void simdCosAvx2(const double *a, double *dst, size_t n) { libmLoop(libmCos, a, dst, n); }
+void simdTanAvx2(const double *a, double *dst, size_t n) { libmLoop(libmTan, a, dst, n); }
+void simdExpAvx2(const double *a, double *dst, size_t n) { libmLoop(libmExp, a, dst, n); }
+void simdLogAvx2(const double *a, double *dst, size_t n) { libmLoop(libmLog, a, dst, n); }
+
+#endif
+
+void simdSin(const double *a, double *dst, size_t n) {
+  if (simdMathUsesAvx2())
+    simdSinAvx2(a, dst, n);
+  else
+    libmLoop(libmSin, a, dst, n);
+}
+
+void simdCos(const double *a, double *dst, size_t n) {
+  if (simdMathUsesAvx2())
+    simdCosAvx2(a, dst, n);
+  else
+    libmLoop(libmCos, a, dst, n);
+}
+
+void simdTan(const double *a, double *dst, size_t n) {
+  if (simdMathUsesAvx2())
+    simdTanAvx2(a, dst, n);
+  else
+    libmLoop(libmTan, a, dst, n);
+}
+
+void simdExp(const double *a, double *dst, size_t n) {
+  if (simdMathUsesAvx2())
+    simdExpAvx2(a, dst, n);
+  else
+    libmLoop(libmExp, a, dst, n);
+}
+
+void simdLog(const double *a, double *dst, size_t n) {
+  if (simdMathUsesAvx2())
+    simdLogAvx2(a, dst, n);
+  else
+    libmLoop(libmLog, a, dst, n);
+}
@@ -0,0 +1,71 @@
+#include "catch.hpp"
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+#include "SimdMath.h"
+using namespace std;
+
+// largest error of f over n random arguments in [lo, hi] (or [e^lo, e^hi]),
+// in units in the last place of the long double reference
+static double maxUlpError(void (*f)(const double *, double *, size_t),
+                          long double (*reference)(long double),
+                          double lo, double hi, bool logScale) {
+  const size_t n = 100000;
+  mt19937_64 generator(42);
+  uniform_real_distribution<double> distribution(lo, hi);
+  vector<double> xs(n), ys(n);
+  for (size_t i = 0; i < n; i++)
+    xs[i] = logScale ? exp(distribution(generator)) : distribution(generator);
+  f(xs.data(), ys.data(), n);
+  double worst = 0;
+  for (size_t i = 0; i < n; i++) {
+    long double expected = reference(xs[i]);
+    double rounded = static_cast<double>(expected);
+    double ulp = nextafter(fabs(rounded), numeric_limits<double>::infinity()) - fabs(rounded);
+    worst = max(worst, static_cast<double>(fabsl(ys[i] - expected) / ulp));
+  }
+  return worst;
+}
+
+TEST_CASE("SIMD math error bounds", "[simdmath]") {
+  REQUIRE(maxUlpError(simdSin, sinl, -10, 10, false) <= 1.5);
+  REQUIRE(maxUlpError(simdSin, sinl, -1e5, 1e5, false) <= 2.5);
+  REQUIRE(maxUlpError(simdCos, cosl, -10, 10, false) <= 1.5);
+  REQUIRE(maxUlpError(simdCos, cosl, -1e5, 1e5, false) <= 2.5);
+  REQUIRE(maxUlpError(simdTan, tanl, -10, 10, false) <= 3);
+  REQUIRE(maxUlpError(simdTan, tanl, -1e5, 1e5, false) <= 4);
+  REQUIRE(maxUlpError(simdExp, expl, -708, 709, false) <= 1);
+  REQUIRE(maxUlpError(simdExp, expl, -1, 1, false) <= 1);
+  REQUIRE(maxUlpError(simdLog, logl, -700, 700, true) <= 1);
+  REQUIRE(maxUlpError(simdLog, logl, -0.5, 0.5, true) <= 1);
+}
+
+TEST_CASE("SIMD math special values", "[simdmath]") {
+  const double inf = numeric_limits<double>::infinity();
+  const double nan = numeric_limits<double>::quiet_NaN();
+  double xs[] = {0.0, -0.0, 1.0, -1.0, 1e300, -1e300, 1e-310, 710, -746, inf, -inf, nan};
+  const size_t n = sizeof(xs) / sizeof(xs[0]);
+  double ys[n];
+  void (*functions[])(const double *, double *, size_t) = {simdSin, simdCos, simdTan, simdExp, simdLog};
+  double (*references[])(double) = {sin, cos, tan, exp, log};
+  for (int f = 0; f < 5; f++) {
+    functions[f](xs, ys, n);
+    for (size_t i = 0; i < n; i++) {
+      double expected = references[f](xs[i]);
+      if (std::isnan(expected))
+        REQUIRE(std::isnan(ys[i]));
+      else if (std::isinf(expected))
+        REQUIRE(ys[i] == expected);
+      else if (expected == 0)
+        REQUIRE((ys[i] == 0 && std::signbit(ys[i]) == std::signbit(expected)));
+      else
+        REQUIRE(ys[i] == Approx(expected));
+    }
+  }
+  // in place, with a length that leaves a scalar tail
+  vector<double> v(7, 0.5);
+  simdExp(v.data(), v.data(), v.size());
+  for (double y : v)
+    REQUIRE(y == Approx(exp(0.5)));
+}
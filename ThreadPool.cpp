@@ -0,0 +1,55 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <memory>
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threads) : stopping(false) {
+  if (threads <= 0)
+    threads = max(1u, thread::hardware_concurrency());
+  for (int i = 0; i < threads; i++)
+    workers.push_back(thread(&ThreadPool::work, this));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  ready.notify_all();
+  for (auto it = workers.begin(); it != workers.end(); it++)
+    it->join();
+}
+
+void ThreadPool::work() {
+  for (;;) {
+    function<void()> task;
+    {
+      unique_lock<std::mutex> lock(mutex);
+      while (!stopping && tasks.empty())
+        ready.wait(lock);
+      if (tasks.empty())
+        return;
+      task.swap(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+future<void> ThreadPool::submit(const function<void()> &task) {
+  // the packaged task stores what the task throws into the future
+  shared_ptr<packaged_task<void()> > packaged = make_shared<packaged_task<void()> >(task);
+  future<void> result = packaged->get_future();
+  {
+    lock_guard<std::mutex> lock(mutex);
+    tasks.push_back([packaged]() { (*packaged)(); });
+  }
+  ready.notify_one();
+  return result;
+}
+
+ThreadPool &ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
@@ -0,0 +1,40 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running submitted tasks in FIFO order.
+// The future of a task becomes ready when it has run, and rethrows what
+// it threw. A task must not wait for another task of the same pool, the
+// workers could all be waiting.
+class ThreadPool {
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()> > tasks;
+  std::mutex mutex;
+  std::condition_variable ready;
+  bool stopping;
+
+  ThreadPool(const ThreadPool &);
+  ThreadPool &operator=(const ThreadPool &);
+  void work();
+ public:
+  // threads <= 0 means one per hardware thread
+  explicit ThreadPool(int threads = 0);
+  // runs the tasks still queued, then joins the workers
+  ~ThreadPool();
+
+  std::future<void> submit(const std::function<void()> &task);
+
+  int size() const { return static_cast<int>(workers.size()); }
+
+  // one per hardware thread, created on first use
+  static ThreadPool &shared();
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,35 @@
+#include "catch.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+#include "ThreadPool.h"
+using namespace std;
+
+TEST_CASE("ThreadPool runs every task", "[pool]") {
+  atomic<int> sum(0);
+  {
+    ThreadPool pool(3);
+    REQUIRE(pool.size() == 3);
+    vector<future<void> > done;
+    for (int i = 1; i <= 100; i++)
+      done.push_back(pool.submit([&sum, i]() { sum += i; }));
+    for (auto it = done.begin(); it != done.end(); it++)
+      it->get();
+    REQUIRE(sum == 5050);
+    // queued tasks still run when the pool is destroyed
+    for (int i = 0; i < 10; i++)
+      pool.submit([&sum]() { sum += 1; });
+  }
+  REQUIRE(sum == 5060);
+  REQUIRE(ThreadPool::shared().size() >= 1);
+}
+
+TEST_CASE("ThreadPool passes exceptions to the future", "[pool]") {
+  ThreadPool pool(2);
+  future<void> failed = pool.submit([]() { throw runtime_error("task failed"); });
+  REQUIRE_THROWS_AS(failed.get(), runtime_error);
+  // the worker survived
+  bool ran = false;
+  pool.submit([&ran]() { ran = true; }).get();
+  REQUIRE(ran);
+}
@@ -0,0 +1,161 @@
+#include "VectorKernels.h"
+#include "SimdMath.h"
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTORKERNELS_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+void scalarAdd(const double *a, const double *b, double *dst, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = a[i] + b[i];
+}
+
+void scalarMulti(const double *a, const double *b, double *dst, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = a[i] * b[i];
+}
+
+void scalarDivide(const double *a, const double *b, double *dst, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = a[i] / b[i];
+}
+
+void scalarPoly(const double *a, const double *coef, int nCoef, double *dst, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    double t = a[i];
+    double xPowerK = 1;
+    double sum = 0;
+    for (int k = 0; k < nCoef; k++) {
+      sum += coef[k] * xPowerK;
+      xPowerK *= t;
+    }
+    dst[i] = sum;
+  }
+}
+
+void scalarSin(const double *a, double *dst, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = sin(a[i]);
+}
+
+void scalarCos(const double *a, double *dst, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = cos(a[i]);
+}
+
+void scalarTan(const double *a, double *dst, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = tan(a[i]);
+}
+
+void scalarExp(const double *a, double *dst, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = exp(a[i]);
+}
+
+void scalarLog(const double *a, double *dst, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = log(a[i]);
+}
+
+const VectorKernels scalar = {
+    "scalar",
+    scalarAdd, scalarMulti, scalarDivide, scalarPoly,
+    scalarSin, scalarCos, scalarTan, scalarExp, scalarLog
+};
+
+#ifdef VECTORKERNELS_X86
+
+// two registers per iteration, the tail is left to the scalar loops
+
+__attribute__((target("avx2")))
+void avx2Add(const double *a, const double *b, double *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256d r0 = _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+    __m256d r1 = _mm256_add_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4));
+    _mm256_storeu_pd(dst + i, r0);
+    _mm256_storeu_pd(dst + i + 4, r1);
+  }
+  scalarAdd(a + i, b + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void avx2Multi(const double *a, const double *b, double *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256d r0 = _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+    __m256d r1 = _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4));
+    _mm256_storeu_pd(dst + i, r0);
+    _mm256_storeu_pd(dst + i + 4, r1);
+  }
+  scalarMulti(a + i, b + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void avx2Divide(const double *a, const double *b, double *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256d r0 = _mm256_div_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+    __m256d r1 = _mm256_div_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4));
+    _mm256_storeu_pd(dst + i, r0);
+    _mm256_storeu_pd(dst + i + 4, r1);
+  }
+  scalarDivide(a + i, b + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void avx2Poly(const double *a, const double *coef, int nCoef, double *dst, size_t n) {
+  // no fused multiply-add, the result stays identical to Polynomial::operator()
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256d t0 = _mm256_loadu_pd(a + i);
+    __m256d t1 = _mm256_loadu_pd(a + i + 4);
+    __m256d p0 = _mm256_set1_pd(1), p1 = _mm256_set1_pd(1);
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    for (int k = 0; k < nCoef; k++) {
+      __m256d c = _mm256_set1_pd(coef[k]);
+      s0 = _mm256_add_pd(s0, _mm256_mul_pd(c, p0));
+      s1 = _mm256_add_pd(s1, _mm256_mul_pd(c, p1));
+      p0 = _mm256_mul_pd(p0, t0);
+      p1 = _mm256_mul_pd(p1, t1);
+    }
+    _mm256_storeu_pd(dst + i, s0);
+    _mm256_storeu_pd(dst + i + 4, s1);
+  }
+  scalarPoly(a + i, coef, nCoef, dst + i, n - i);
+}
+
+const VectorKernels avx2 = {
+    "avx2",
+    avx2Add, avx2Multi, avx2Divide, avx2Poly,
+    simdSinAvx2, simdCosAvx2, simdTanAvx2, simdExpAvx2, simdLogAvx2
+};
+
+#endif
+
+} // namespace
+
+const VectorKernels &scalarKernels() {
+  return scalar;
+}
+
+const VectorKernels *avx2Kernels() {
+#ifdef VECTORKERNELS_X86
+  static const bool supported = __builtin_cpu_supports("avx2");
+  if (supported)
+    return &avx2;
+#endif
+  return NULL;
+}
+
+const VectorKernels &vectorKernels() {
+  const VectorKernels *k = avx2Kernels();
+  return k ? *k : scalar;
+}
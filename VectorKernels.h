@@ -0,0 +1,30 @@
+#ifndef VECTORKERNELS_H
+#define VECTORKERNELS_H
+
+#include <cstddef>
+
+// Element-wise kernels used by the batch evaluator of CompiledExpression.
+// Every kernel processes n lanes, dst may alias any of the inputs.
+struct VectorKernels {
+  const char *name;
+  void (*add)(const double *a, const double *b, double *dst, size_t n);
+  void (*multi)(const double *a, const double *b, double *dst, size_t n);
+  void (*divide)(const double *a, const double *b, double *dst, size_t n);
+  // dst = sum of coef[k] * a^k, k < nCoef
+  void (*poly)(const double *a, const double *coef, int nCoef, double *dst, size_t n);
+  void (*sin)(const double *a, double *dst, size_t n);
+  void (*cos)(const double *a, double *dst, size_t n);
+  void (*tan)(const double *a, double *dst, size_t n);
+  void (*exp)(const double *a, double *dst, size_t n);
+  void (*log)(const double *a, double *dst, size_t n);
+};
+
+// plain loops, available everywhere
+const VectorKernels &scalarKernels();
+// AVX2 kernels working on 4 doubles per register, NULL if the host or the
+// compiler doesn't support AVX2
+const VectorKernels *avx2Kernels();
+// the fastest kernels supported by the host
+const VectorKernels &vectorKernels();
+
+#endif // VECTORKERNELS_H
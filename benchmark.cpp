@@ -0,0 +1,503 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "function.h"
+#include "ExpressionEvaluator.h"
+#include "ExpressionArena.h"
+#include "CostModel.h"
+#include "EGraph.h"
+#include "ExpressionLoader.h"
+#include "ThreadPool.h"
+#include "ParseCache.h"
+#include "ConcurrentParseCache.h"
+#include "ExpressionSerializer.h"
+#include "ProgramFile.h"
+#include "NewtonSolver.h"
+
+using namespace std;
+
+namespace {
+
+double secondsSince(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// name in the temporary directory
+string temporaryPath(const char *name) {
+  const char *dir = getenv("TMPDIR");
+  if (!dir || !*dir)
+    dir = getenv("TEMP");
+  return string(dir && *dir ? dir : "/tmp") + "/" + name;
+}
+
+// exp(sin(cos(tan(k*x)))) for k = 1..n, built directly rather than
+// parsed. The terms have the same shape and only differ in their
+// innermost coefficient, so a full comparison walks down the whole term.
+Expression *wideSum(int n) {
+  ExpressionSet terms;
+  for (int k = 1; k <= n; k++) {
+    Expression *t = new Composition(new Trigo(Trigo::Tan), new Polynomial(k, 0));
+    t = new Composition(new Trigo(Trigo::Cos), t);
+    t = new Composition(new Trigo(Trigo::Sin), t);
+    terms.insert(new Composition(new Exponential, t));
+  }
+  return new Addition(terms);
+}
+
+void benchmarkWideSum(int n) {
+  Expression *e = wideSum(n);
+
+  auto start = chrono::steady_clock::now();
+  bool changed;
+  Expression *simplified = e->simplify(changed);
+  if (simplified) {
+    delete e;
+    e = simplified;
+  }
+  double simplifySeconds = secondsSince(start);
+
+  vector<Expression *> terms;
+  if (e->nodeType() == Expression::TypeAdd) {
+    const ExpressionSet &children = static_cast<CommutativeOperators *>(e)->getChildren();
+    terms.assign(children.begin(), children.end());
+  }
+
+  printf("wide sum, %d terms: simplify %.3f ms\n", n, simplifySeconds * 1e3);
+  // the pairwise loops are quadratic, only timed on the smaller sums
+  if (terms.size() > 3000) {
+    delete e;
+    return;
+  }
+
+  // CanonicalEqualTo rejects on the cached hash, CanonicalEqualToSameType
+  // is the full structural walk
+  int equal = 0;
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < terms.size(); i++)
+    for (size_t j = i + 1; j < terms.size(); j++)
+      equal += terms[i]->CanonicalEqualTo(terms[j]);
+  double cachedSeconds = secondsSince(start);
+
+  start = chrono::steady_clock::now();
+  for (size_t i = 0; i < terms.size(); i++)
+    for (size_t j = i + 1; j < terms.size(); j++)
+      equal += terms[i]->CanonicalEqualToSameType(terms[j]);
+  double walkSeconds = secondsSince(start);
+
+  double pairs = terms.size() * (terms.size() - 1) / 2.0;
+  printf("  pairwise equality, hashed %.1f ns/pair, full walk %.1f ns/pair (%d equal)\n",
+         cachedSeconds / pairs * 1e9, walkSeconds / pairs * 1e9, equal);
+  delete e;
+}
+
+// n terms c*exp(sin(j*x)) with 100 distinct j, every tenth term a
+// polynomial, like the expanded sums coming out of diff()
+void benchmarkLikeTerms(int n) {
+  vector<Expression *> terms;
+  for (int k = 0; k < n; k++) {
+    if (k % 10 == 0) {
+      terms.push_back(new Polynomial(k % 7 + 1, k));
+    } else {
+      Expression *f = new Composition(new Trigo(Trigo::Sin), new Polynomial(k % 100 + 1, 0));
+      f = new Composition(new Exponential, f);
+      terms.push_back(new Multiplication(new Constant(k % 5 + 1), f));
+    }
+  }
+  ExpressionSet set;
+  set.insert(terms.begin(), terms.end());
+  Expression *e = new Addition(set);
+  auto start = chrono::steady_clock::now();
+  bool changed;
+  Expression *simplified = e->simplify(changed);
+  if (simplified) {
+    delete e;
+    e = simplified;
+  }
+  printf("like terms, %d terms: simplify %.3f ms\n", n, secondsSince(start) * 1e3);
+  delete e;
+}
+
+// the strings of the ExpressionEvaluator test case, parsed (which
+// simplifies) and differentiated
+void benchmarkCorpus(int iterations) {
+  const char *corpus[] = {
+      "1", "1+2", "-1", "-3+1", "-1+1", "1+2+3", "1+(2+3)", "1+2-3", "-1-2-3.5", "-1-x+1",
+      "1*2*3*4*5", "2*x*3", "2*x*x+3*x", "(2*x*x+3*x)*x", "1/x/x", "1/x/x/x/x/x",
+      "1/x/-x/x/x/x", "x/3-x/3", "x/1", "(2/x)/(sin(x)/exp(x))", "sin(x)/x+cos(x)/x",
+      "sin(x)-sin(x)", "sin(x)*x*x-sin(x)*x*x*x/x"
+  };
+  ExpressionEvaluator evaluator;
+  double parseSeconds = 0, diffSeconds = 0;
+  for (int i = 0; i < iterations; i++) {
+    for (auto s : corpus) {
+      auto start = chrono::steady_clock::now();
+      Expression *e = evaluator.evaluate(s);
+      parseSeconds += secondsSince(start);
+      start = chrono::steady_clock::now();
+      Expression *d = e->diffSimplify();
+      diffSeconds += secondsSince(start);
+      delete d;
+      delete e;
+    }
+  }
+  printf("ExpressionEvaluator corpus: evaluate %.2f us, diffSimplify %.2f us per pass\n",
+         parseSeconds / iterations * 1e6, diffSeconds / iterations * 1e6);
+}
+
+// derivative of sin(...)*x+1/(x+k) nested depth times, the simplification
+// of large, deep trees
+void benchmarkDeepDiff(int depth, int iterations) {
+  string s = "x";
+  for (int k = 1; k <= depth; k++) {
+    ostringstream next;
+    next << "sin(" << s << ")*x+1/(x+" << k << ")";
+    s = next.str();
+  }
+  ExpressionEvaluator evaluator;
+  Expression *e = evaluator.evaluate(s);
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++)
+    delete e->diffSimplify();
+  printf("depth %d: diffSimplify %.3f ms\n", depth, secondsSince(start) / iterations * 1e3);
+  delete e;
+}
+
+// parse, differentiate and simplify in a loop, nodes from the heap or
+// from an arena reset at every iteration
+void benchmarkArena(int iterations) {
+  const char *s = "sin(x)/x+cos(x)*x*x*exp(x)-log(x+2)/(x*x+1)";
+  ExpressionEvaluator evaluator;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    Expression *e = evaluator.evaluate(s);
+    Expression *d = e->diffSimplify();
+    delete d;
+    delete e;
+  }
+  double heapSeconds = secondsSince(start);
+
+  ExpressionArena arena;
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    ExpressionArena::Scope scope(arena);
+    Expression *e = evaluator.evaluate(s);
+    e->diffSimplify();
+    arena.reset();
+  }
+  double arenaSeconds = secondsSince(start);
+  printf("parse + diffSimplify: heap %.2f us, arena %.2f us, %d arena blocks\n",
+         heapSeconds / iterations * 1e6, arenaSeconds / iterations * 1e6,
+         static_cast<int>(arena.blockCount()));
+}
+
+// evaluation time of derivatives simplified greedily and by equality
+// saturation
+void benchmarkEGraph(int points) {
+  const char *corpus[] = {
+      "sin(x)*exp(x)*cos(x)", "exp(x*x)*sin(x)", "sin(x)/cos(x)+x*log(x)",
+      "exp(2*x)*exp(x)/x", "sin(x)*sin(x)*x+cos(x)*x"
+  };
+  ExpressionEvaluator evaluator;
+  double greedySeconds = 0, egraphSeconds = 0, saturateSeconds = 0;
+  double sink = 0, scale = 0;
+  double greedyCycles = 0, egraphCycles = 0;
+  const CostModel &model = CostModel::host();
+  for (auto s : corpus) {
+    Expression *e = evaluator.evaluate(s);
+    Expression *greedy = e->diffSimplify();
+    auto start = chrono::steady_clock::now();
+    Expression *best = EGraph::simplify(greedy);
+    saturateSeconds += secondsSince(start);
+    greedyCycles += model.estimate(greedy);
+    egraphCycles += model.estimate(best);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < points; i++)
+      sink += (*greedy)(0.5 + i * 1e-5);
+    scale += fabs(sink);
+    greedySeconds += secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < points; i++)
+      sink -= (*best)(0.5 + i * 1e-5);
+    egraphSeconds += secondsSince(start);
+    delete best;
+    delete greedy;
+    delete e;
+  }
+  printf("derivative corpus: estimated greedy %.0f, e-graph %.0f cycles per point\n",
+         greedyCycles, egraphCycles);
+  printf("derivative corpus: evaluate greedy %.3f ms, e-graph %.3f ms, saturation %.2f ms"
+         " (relative difference %g)\n", greedySeconds * 1e3, egraphSeconds * 1e3, saturateSeconds * 1e3,
+         sink / scale);
+}
+
+// bytes of formulas parsed per second, lines like those of a formula file
+void benchmarkParse(int lines) {
+  const char *corpus[] = {
+      "2*x*x*x-x/3", "sin(x)/x+cos(x)*x/3", "exp(sin(x)*x)-log(x+2.5)",
+      "(2/x)/(sin(x)/exp(x))", "tan(x*x)/(1+x*x)", "3.14159*x*x+2.71828*x-1.41421",
+      "sin(cos(x))*0.5+1e-3*x"
+  };
+  vector<string> formulas;
+  size_t bytes = 0;
+  for (int i = 0; i < lines; i++) {
+    formulas.push_back(corpus[i % (sizeof(corpus) / sizeof(corpus[0]))]);
+    bytes += formulas.back().size() + 1;
+  }
+  ExpressionEvaluator evaluator;
+  size_t symbols = 0;
+  auto start = chrono::steady_clock::now();
+  for (auto it = formulas.begin(); it != formulas.end(); it++)
+    symbols += evaluator.tokenize(*it).size();
+  double tokenizeSeconds = secondsSince(start);
+  start = chrono::steady_clock::now();
+  for (auto it = formulas.begin(); it != formulas.end(); it++)
+    delete evaluator.evaluate(*it);
+  double seconds = secondsSince(start);
+  printf("parse %d lines: tokenize %.2f MB/s (%d symbols), evaluate %.2f MB/s\n", lines,
+         bytes / tokenizeSeconds / 1e6, static_cast<int>(symbols), bytes / seconds / 1e6);
+}
+
+// a formula file loaded through ExpressionLoader with 1 to 4 threads
+void benchmarkLoader(int lines) {
+  const char *corpus[] = {
+      "2*x*x*x-x/3", "sin(x)/x+cos(x)*x/3", "exp(sin(x)*x)-log(x+2.5)",
+      "(2/x)/(sin(x)/exp(x))", "tan(x*x)/(1+x*x)", "3.14159*x*x+2.71828*x-1.41421"
+  };
+  string path = temporaryPath("benchmark_formulas.txt");
+  size_t bytes = 0;
+  {
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+      printf("load: can't write %s\n", path.c_str());
+      return;
+    }
+    for (int i = 0; i < lines; i++)
+      bytes += fprintf(out, "%s\n", corpus[i % (sizeof(corpus) / sizeof(corpus[0]))]);
+    fclose(out);
+  }
+  for (int threads = 1; threads <= 4; threads *= 2) {
+    auto start = chrono::steady_clock::now();
+    ExpressionLoader::Batch batch = ExpressionLoader::loadFile(path, threads);
+    double seconds = secondsSince(start);
+    printf("load %d lines, %d threads: %.2f MB/s, %d errors\n", lines, threads,
+           bytes / seconds / 1e6, static_cast<int>(batch.errors.size()));
+  }
+  remove(path.c_str());
+}
+
+// formulas in memory parsed by pools of 1 to 4 threads
+void benchmarkParseAll(int count) {
+  const char *corpus[] = {
+      "2*x*x*x-x/3", "sin(x)/x+cos(x)*x/3", "exp(sin(x)*x)-log(x+2.5)",
+      "(2/x)/(sin(x)/exp(x))", "tan(x*x)/(1+x*x)", "3.14159*x*x+2.71828*x-1.41421"
+  };
+  vector<string> formulas;
+  for (int i = 0; i < count; i++)
+    formulas.push_back(corpus[i % (sizeof(corpus) / sizeof(corpus[0]))]);
+  double single = 0;
+  for (int threads = 1; threads <= 4; threads *= 2) {
+    ThreadPool pool(threads);
+    auto start = chrono::steady_clock::now();
+    ExpressionLoader::Batch batch = ExpressionLoader::parseAll(formulas, pool);
+    double seconds = secondsSince(start);
+    if (threads == 1)
+      single = seconds;
+    printf("parseAll %d formulas, %d threads: %.0f formulas/s, speedup %.2f\n", count, threads,
+           batch.expressions.size() / seconds, single / seconds);
+  }
+}
+
+// the same few hundred formulas requested over and over, parsed each
+// time or through a ParseCache
+void benchmarkParseCache(int requests) {
+  vector<string> formulas;
+  for (int k = 1; k <= 300; k++) {
+    ostringstream s;
+    s << "sin(x)/x+cos(" << k << " * x)*x/3 - exp(x)/" << k;
+    formulas.push_back(s.str());
+  }
+  ExpressionEvaluator evaluator;
+  double sink = 0;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < requests; i++) {
+    Expression *e = evaluator.evaluate(formulas[i * 7919 % formulas.size()]);
+    sink += (*e)(0.5);
+    delete e;
+  }
+  double parseSeconds = secondsSince(start);
+  ParseCache cache;
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < requests; i++)
+    sink -= (*cache.expression(formulas[i * 7919 % formulas.size()]))(0.5);
+  double cacheSeconds = secondsSince(start);
+  printf("%d requests: parse %.2f us, cached %.2f us per request, %d hits, %d misses,"
+         " %d bytes (difference %g)\n", requests, parseSeconds / requests * 1e6,
+         cacheSeconds / requests * 1e6, static_cast<int>(cache.hits()),
+         static_cast<int>(cache.misses()), static_cast<int>(cache.bytes()), sink);
+}
+
+// the same trees read back from their binary form instead of parsed
+void benchmarkSerializer(int lines) {
+  const char *corpus[] = {
+      "2*x*x*x-x/3", "sin(x)/x+cos(x)*x/3", "exp(sin(x)*x)-log(x+2.5)",
+      "(2/x)/(sin(x)/exp(x))", "tan(x*x)/(1+x*x)", "3.14159*x*x+2.71828*x-1.41421",
+      "sin(cos(x))*0.5+1e-3*x"
+  };
+  const int kinds = sizeof(corpus) / sizeof(corpus[0]);
+  ExpressionEvaluator evaluator;
+  vector<string> binary;
+  size_t text = 0, bytes = 0;
+  for (int k = 0; k < kinds; k++) {
+    Expression *e = evaluator.evaluate(corpus[k]);
+    binary.push_back(ExpressionSerializer::serialize(e));
+    delete e;
+  }
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < lines; i++) {
+    text += strlen(corpus[i % kinds]) + 1;
+    delete evaluator.evaluate(corpus[i % kinds]);
+  }
+  double parseSeconds = secondsSince(start);
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < lines; i++) {
+    bytes += binary[i % kinds].size();
+    delete ExpressionSerializer::deserialize(binary[i % kinds]);
+  }
+  double readSeconds = secondsSince(start);
+  printf("%d trees: evaluate %.2f us, deserialize %.2f us per tree, %d text bytes,"
+         " %d binary bytes\n", lines, parseSeconds / lines * 1e6, readSeconds / lines * 1e6,
+         static_cast<int>(text), static_cast<int>(bytes));
+}
+
+// programs ready to evaluate: parsed and compiled, or opened from a file
+void benchmarkProgramFile(int programs) {
+  vector<string> formulas;
+  for (int k = 1; k <= programs; k++) {
+    ostringstream s;
+    s << "sin(x)/x+cos(" << k << " * x)*x/3 - exp(x)/" << k;
+    formulas.push_back(s.str());
+  }
+  ExpressionEvaluator evaluator;
+  vector<unique_ptr<CompiledExpression> > compiled;
+  double sink = 0;
+  auto start = chrono::steady_clock::now();
+  for (auto it = formulas.begin(); it != formulas.end(); it++) {
+    unique_ptr<Expression> e(evaluator.evaluate(*it));
+    compiled.push_back(unique_ptr<CompiledExpression>(new CompiledExpression(e.get())));
+  }
+  for (auto it = compiled.begin(); it != compiled.end(); it++)
+    sink += (**it)(0.5);
+  double compileSeconds = secondsSince(start);
+  ProgramFile::Writer writer;
+  for (size_t k = 0; k < compiled.size(); k++)
+    writer.add(formulas[k], *compiled[k]);
+  string path = temporaryPath("benchmark_programs.bin");
+  writer.save(path);
+  start = chrono::steady_clock::now();
+  {
+    ProgramFile file(path);
+    for (size_t k = 0; k < file.size(); k++)
+      sink -= file.program(k)(0.5);
+  }
+  double fileSeconds = secondsSince(start);
+  remove(path.c_str());
+  printf("%d programs: parse and compile %.2f ms, open file %.2f ms (difference %g)\n",
+         programs, compileSeconds * 1e3, fileSeconds * 1e3, sink);
+}
+
+// the same targets solved one by one with dual numbers on the tree, and
+// by lanes, on one thread and on the shared pool
+void benchmarkNewton(int targets) {
+  ExpressionEvaluator evaluator;
+  unique_ptr<Expression> f(evaluator.evaluate("sin(x)/x+cos(x)*x/3"));
+  vector<double> x0s(targets, 0.5), goals(targets), scalar(targets), lanes(targets), pooled(targets);
+  for (int i = 0; i < targets; i++)
+    goals[i] = 0.4 + 0.6 * i / targets;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < targets; i++) {
+    double x = x0s[i];
+    for (int iteration = 0; iteration < 100; iteration++) {
+      double last = x;
+      Dual fx = (*f)(Dual(x, 1));
+      x += (goals[i] - fx.value) / fx.derivative;
+      if (fabs(last - x) < 1e-10)
+        break;
+    }
+    scalar[i] = x;
+  }
+  double scalarSeconds = secondsSince(start);
+  start = chrono::steady_clock::now();
+  NewtonSolver solver(f.get());
+  size_t converged = solver.solve(x0s.data(), goals.data(), lanes.data(), targets);
+  double laneSeconds = secondsSince(start);
+  start = chrono::steady_clock::now();
+  solver.solve(x0s.data(), goals.data(), pooled.data(), targets, NULL, ThreadPool::shared());
+  double poolSeconds = secondsSince(start);
+  // lanes far from a root may wander to another one from rounding alone
+  int different = 0;
+  for (int i = 0; i < targets; i++)
+    if (!(fabs(scalar[i] - lanes[i]) < 1e-6))
+      different++;
+  printf("newton %d targets: dual %.1f ms, lanes %.1f ms, pool of %d %.1f ms,"
+         " %d converged, %d other roots\n", targets, scalarSeconds * 1e3, laneSeconds * 1e3,
+         ThreadPool::shared().size(), poolSeconds * 1e3, static_cast<int>(converged), different);
+}
+
+void benchmarkConcurrentCache(int requests, int threads) {
+  vector<string> formulas;
+  for (int k = 1; k <= 300; k++) {
+    ostringstream s;
+    s << "sin(x)/x+cos(" << k << " * x)*x/3 - exp(x)/" << k;
+    formulas.push_back(s.str());
+  }
+  ConcurrentParseCache cache;
+  vector<double> sinks(threads, 0);
+  vector<thread> workers;
+  auto start = chrono::steady_clock::now();
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(thread([&cache, &formulas, &sinks, requests, threads, t]() {
+      for (int i = t; i < requests; i += threads)
+        sinks[t] += (*cache.compiled(formulas[i * 7919 % formulas.size()]))(0.5);
+    }));
+  }
+  for (auto it = workers.begin(); it != workers.end(); it++)
+    it->join();
+  double seconds = secondsSince(start);
+  printf("%d requests on %d threads: %.2f us per request, %d hits, %d misses (sum %g)\n",
+         requests, threads, seconds / requests * 1e6, static_cast<int>(cache.hits()),
+         static_cast<int>(cache.misses()), accumulate(sinks.begin(), sinks.end(), 0.0));
+}
+
+} // namespace
+
+int main() {
+  benchmarkWideSum(100);
+  benchmarkWideSum(1000);
+  benchmarkWideSum(3000);
+  benchmarkWideSum(10000);
+  benchmarkLikeTerms(1000);
+  benchmarkLikeTerms(10000);
+  benchmarkCorpus(2000);
+  benchmarkDeepDiff(4, 50);
+  benchmarkDeepDiff(12, 50);
+  benchmarkArena(20000);
+  benchmarkEGraph(100000);
+  benchmarkParse(100000);
+  benchmarkLoader(200000);
+  benchmarkParseAll(100000);
+  benchmarkParseCache(100000);
+  benchmarkSerializer(100000);
+  benchmarkProgramFile(10000);
+  benchmarkNewton(200000);
+  benchmarkConcurrentCache(100000, 1);
+  benchmarkConcurrentCache(100000, 4);
+  return 0;
+}
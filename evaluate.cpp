@@ -0,0 +1,322 @@
+// Evaluate: streams x values from stdin to f(x) on stdout.
+//
+//   Evaluate [--binary | --binary-in | --binary-out] [--chunk N] expression
+//
+// Text input is numbers separated by white space, text output one value
+// per line with 17 significant digits, so values round-trip. Binary is raw
+// little-endian doubles, 8 bytes per value, in and out.
+// Three stages overlap on chunks of N values (65536 by default, 1 to
+// 2^20): a reader thread fills chunks from stdin, the main thread
+// evaluates them in place with CompiledExpression's batch evaluator, a
+// writer thread empties them to stdout. A few chunks circulate between
+// the stages, so reading, evaluating and writing go on at the same time.
+// Exit status: 0, 1 for a read or write error, 2 for bad arguments or an
+// expression that doesn't parse.
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "function.h"
+#include "CompiledExpression.h"
+#include "ExpressionEvaluator.h"
+
+using namespace std;
+
+namespace {
+
+// chunks in flight between the three stages
+const int ChunkCount = 4;
+// values per chunk at most; the chunks and the text buffers take about
+// 80 bytes per value
+const long MaxChunkSize = 1 << 20;
+
+struct Chunk {
+  vector<double> values;
+  size_t count;
+};
+
+// queue of chunks handed from one stage to the next; pop() returns NULL
+// once the queue is closed and empty
+class Channel {
+  deque<Chunk *> chunks;
+  mutex lock;
+  condition_variable ready;
+  bool closed;
+ public:
+  Channel() : closed(false) { }
+
+  void push(Chunk *chunk) {
+    {
+      lock_guard<mutex> guard(lock);
+      chunks.push_back(chunk);
+    }
+    ready.notify_one();
+  }
+
+  Chunk *pop() {
+    unique_lock<mutex> guard(lock);
+    while (chunks.empty() && !closed)
+      ready.wait(guard);
+    if (chunks.empty())
+      return NULL;
+    Chunk *chunk = chunks.front();
+    chunks.pop_front();
+    return chunk;
+  }
+
+  void close() {
+    {
+      lock_guard<mutex> guard(lock);
+      closed = true;
+    }
+    ready.notify_all();
+  }
+};
+
+bool littleEndian() {
+  const uint16_t probe = 1;
+  return *reinterpret_cast<const unsigned char *>(&probe) == 1;
+}
+
+void swapBytes(double *values, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    unsigned char *p = reinterpret_cast<unsigned char *>(values + i);
+    for (int k = 0; k < 4; k++)
+      swap(p[k], p[7 - k]);
+  }
+}
+
+struct Options {
+  bool binaryIn, binaryOut;
+  size_t chunkSize;
+  string expression;
+};
+
+// the first error of the reader or the writer, reported by main
+class Failure {
+  mutex lock;
+  string message;
+ public:
+  void set(const string &what) {
+    lock_guard<mutex> guard(lock);
+    if (message.empty())
+      message = what;
+  }
+
+  string get() {
+    lock_guard<mutex> guard(lock);
+    return message;
+  }
+};
+
+void readBinary(const Options &options, Channel &empty, Channel &full, Failure &failure) {
+  bool swapped = !littleEndian();
+  while (Chunk *chunk = empty.pop()) {
+    size_t bytes = fread(chunk->values.data(), 1, options.chunkSize * sizeof(double), stdin);
+    if (bytes % sizeof(double) != 0)
+      failure.set("input isn't a whole number of doubles");
+    chunk->count = bytes / sizeof(double);
+    if (swapped)
+      swapBytes(chunk->values.data(), chunk->count);
+    if (chunk->count > 0)
+      full.push(chunk);
+    if (bytes < options.chunkSize * sizeof(double)) {
+      if (ferror(stdin))
+        failure.set("can't read the input");
+      break;
+    }
+  }
+  full.close();
+}
+
+// The text is read by blocks; the number cut at the end of a block, and
+// whatever doesn't fit in the chunk, is carried over to the next one.
+void readText(const Options &options, Channel &empty, Channel &full, Failure &failure) {
+  const size_t blockSize = max<size_t>(16 * options.chunkSize, 1 << 16);
+  vector<char> text(blockSize + 1);
+  size_t carried = 0;
+  bool end = false;
+  while (!end) {
+    size_t got = fread(text.data() + carried, 1, blockSize - carried, stdin);
+    size_t length = carried + got;
+    end = got < blockSize - carried;
+    if (end && ferror(stdin)) {
+      failure.set("can't read the input");
+      break;
+    }
+    // the last white space ends the part parsed now
+    size_t parsed = length;
+    if (!end) {
+      while (parsed > 0 && !isspace(static_cast<unsigned char>(text[parsed - 1])))
+        parsed--;
+      if (parsed == 0) {
+        failure.set("number too long in the input");
+        break;
+      }
+    }
+    char saved = text[parsed];
+    text[parsed] = '\0';
+    Chunk *chunk = empty.pop();
+    if (!chunk)
+      break;
+    chunk->count = 0;
+    const char *p = text.data();
+    while (chunk->count < options.chunkSize) {
+      while (isspace(static_cast<unsigned char>(*p)))
+        p++;
+      if (!*p)
+        break;
+      char *next;
+      double x = strtod(p, &next);
+      if (next == p || (*next && !isspace(static_cast<unsigned char>(*next)))) {
+        const char *token = p;
+        while (*p && !isspace(static_cast<unsigned char>(*p)))
+          p++;
+        failure.set("not a number: " + string(token, p));
+        end = true;
+        break;
+      }
+      chunk->values[chunk->count++] = x;
+      p = next;
+    }
+    if (chunk->count > 0)
+      full.push(chunk);
+    else
+      empty.push(chunk);
+    text[parsed] = saved;
+    size_t consumed = p - text.data();
+    carried = length - consumed;
+    memmove(text.data(), text.data() + consumed, carried);
+    // a full chunk may leave numbers behind even at the end of the input
+    if (end && carried > 0 && chunk->count == options.chunkSize && failure.get().empty())
+      end = false;
+  }
+  full.close();
+}
+
+void writeOutput(const Options &options, Channel &evaluated, Channel &empty, Failure &failure) {
+  bool swapped = !littleEndian();
+  // 17 digits, sign, point, exponent and a newline per value
+  vector<char> text(options.binaryOut ? 0 : options.chunkSize * 32);
+  bool failed = false;
+  while (Chunk *chunk = evaluated.pop()) {
+    if (!failed) {
+      if (options.binaryOut) {
+        if (swapped)
+          swapBytes(chunk->values.data(), chunk->count);
+        failed = fwrite(chunk->values.data(), sizeof(double), chunk->count, stdout) != chunk->count;
+      } else {
+        char *p = text.data();
+        for (size_t i = 0; i < chunk->count; i++)
+          p += snprintf(p, 32, "%.17g\n", chunk->values[i]);
+        size_t length = p - text.data();
+        failed = fwrite(text.data(), 1, length, stdout) != length;
+      }
+      if (failed)
+        failure.set("can't write the output");
+    }
+    // after a failure the chunks still go round, the other stages finish
+    empty.push(chunk);
+  }
+  if (!failed && fflush(stdout) != 0)
+    failure.set("can't write the output");
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: Evaluate [--binary | --binary-in | --binary-out] [--chunk N] expression\n"
+          "  reads x values from stdin and writes f(x) to stdout, as text or as\n"
+          "  raw little-endian doubles, by chunks of N values, 1 <= N <= %ld\n",
+          MaxChunkSize);
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+  options.binaryIn = options.binaryOut = false;
+  options.chunkSize = 65536;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--binary") {
+      options.binaryIn = options.binaryOut = true;
+    } else if (arg == "--binary-in") {
+      options.binaryIn = true;
+    } else if (arg == "--binary-out") {
+      options.binaryOut = true;
+    } else if (arg == "--chunk" && i + 1 < argc) {
+      const char *text = argv[++i];
+      char *end;
+      errno = 0;
+      long n = strtol(text, &end, 10);
+      if (end == text || *end || errno == ERANGE || n <= 0 || n > MaxChunkSize)
+        return false;
+      options.chunkSize = n;
+    } else if (arg.size() > 1 && arg[0] == '-' && arg[1] == '-') {
+      return false;
+    } else if (options.expression.empty()) {
+      options.expression = arg;
+    } else {
+      return false;
+    }
+  }
+  return !options.expression.empty();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    usage();
+    return 2;
+  }
+  unique_ptr<CompiledExpression> program;
+  try {
+    ExpressionEvaluator evaluator;
+    unique_ptr<Expression> e(evaluator.evaluate(options.expression));
+    program.reset(new CompiledExpression(e.get()));
+  } catch (const invalid_argument &error) {
+    fprintf(stderr, "Evaluate: %s\n", error.what());
+    return 2;
+  }
+
+  // the stdio buffers would only add a copy, the chunks are large
+  setvbuf(stdin, NULL, _IONBF, 0);
+  setvbuf(stdout, NULL, _IONBF, 0);
+
+  vector<Chunk> chunks(ChunkCount);
+  Channel empty, full, evaluated;
+  for (auto it = chunks.begin(); it != chunks.end(); it++) {
+    it->values.resize(options.chunkSize);
+    empty.push(&*it);
+  }
+  Failure failure;
+  thread reader(options.binaryIn ? readBinary : readText, cref(options), ref(empty), ref(full),
+                ref(failure));
+  thread writer(writeOutput, cref(options), ref(evaluated), ref(empty), ref(failure));
+  while (Chunk *chunk = full.pop()) {
+    program->evaluate(chunk->values.data(), chunk->values.data(), chunk->count);
+    evaluated.push(chunk);
+  }
+  evaluated.close();
+  writer.join();
+  // the reader may wait for a chunk the writer no longer returns
+  empty.close();
+  reader.join();
+
+  string message = failure.get();
+  if (!message.empty()) {
+    fprintf(stderr, "Evaluate: %s\n", message.c_str());
+    return 1;
+  }
+  return 0;
+}
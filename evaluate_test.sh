@@ -0,0 +1,35 @@
+#!/bin/sh
+# Pipes text through the Evaluate binary given as $1.
+evaluate=$1
+out=${TMPDIR:-/tmp}/evaluate_test.$$
+trap 'rm -f "$out" "$out.err"' EXIT
+status=0
+
+fail() {
+  echo "evaluate_test: $1" >&2
+  status=1
+}
+
+# chunks shorter than the input
+printf '1 2\n3\t4   5\n' | "$evaluate" --chunk 2 'x*x' > "$out" || fail "short chunks: exit status"
+[ "$(tr '\n' ' ' < "$out")" = "1 4 9 16 25 " ] || fail "short chunks: $(tr '\n' ' ' < "$out")"
+
+# a number cut by the end of the first 65536-byte block of text
+{
+  printf '%65530s\n' ''
+  printf '1234567.25\n2\n'
+} | "$evaluate" --chunk 3 'x+1' > "$out" || fail "split number: exit status"
+[ "$(tr '\n' ' ' < "$out")" = "1234568.25 3 " ] || fail "split number: $(tr '\n' ' ' < "$out")"
+
+# a bad token stops the stream with status 1
+printf '1 2 abc 4\n' | "$evaluate" x > "$out" 2> "$out.err"
+[ $? -eq 1 ] || fail "bad token: exit status"
+grep -q 'not a number: abc' "$out.err" || fail "bad token: $(cat "$out.err")"
+
+# bad chunk sizes are rejected with status 2
+for n in 0 -1 10x '' 99999999999999999999 2000000; do
+  echo 1 | "$evaluate" --chunk "$n" x > "$out" 2> "$out.err"
+  [ $? -eq 2 ] || fail "--chunk '$n' accepted"
+done
+
+exit $status
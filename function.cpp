@@ -3,10 +3,63 @@
 #include <sstream>
 #include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <map>
 using namespace std;
 
+namespace {
+
+size_t hashCombine(size_t seed, size_t v) {
+  return seed ^ (v + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+// 0 and -0 are equal constants, they must hash the same
+size_t hashDouble(double v) {
+  if (v == 0) return 0;
+  unsigned long long bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return static_cast<size_t>(bits);
+}
+
+} // namespace
+
+namespace {
+
+// placed in front of every node, the arena owning it or NULL for the heap
+const size_t NodeHeader = ExpressionArena::Alignment;
+
+} // namespace
+
+void *Expression::operator new(size_t size) {
+  ExpressionArena *arena = ExpressionArena::current();
+  char *block = static_cast<char *>(
+      arena ? arena->allocate(size + NodeHeader) : ::operator new(size + NodeHeader));
+  *reinterpret_cast<ExpressionArena **>(block) = arena;
+  return block + NodeHeader;
+}
+
+void Expression::operator delete(void *p) {
+  if (!p) return;
+  char *block = static_cast<char *>(p) - NodeHeader;
+  // arena nodes are released by ExpressionArena::reset()
+  if (!*reinterpret_cast<ExpressionArena **>(block))
+    ::operator delete(block);
+}
+
+void Expression::updateStructure() const {
+  size_t hash;
+  computeStructure(hash, cachedNodeCount, cachedDepth);
+  cachedHash = hashCombine(type, hash);
+  structureValid = true;
+}
+
 bool Expression::CanonicalEqualTo(Expression *other) {
   if (this->nodeType() != other->nodeType()) return false;
+  // constant time rejection of most unequal pairs
+  if (this->structuralHash() != other->structuralHash()
+      || this->nodeCount() != other->nodeCount()
+      || this->depth() != other->depth())
+    return false;
   return this->CanonicalEqualToSameType(other);
 }
 
@@ -25,16 +78,57 @@ string Expression::stringPrint() const {
   return s;
 }
 
-Expression *Expression::diffSimplify() const {
-  Expression *d = this->diff();
+unique_ptr<Expression> Expression::simplified(unique_ptr<Expression> e) {
   bool changed;
-  Expression *dsim = d->simplify(changed);
-  if (dsim) {
-    delete d;
-    return dsim;
-  } else {
-    return d;
+  Expression *s = e->simplify(changed);
+  if (s)
+    return unique_ptr<Expression>(s);
+  return e;
+}
+
+namespace {
+
+// the normal form of e, which is consumed
+Expression *normalForm(Expression *e) {
+  bool changed;
+  Expression *s = e->simplify(changed);
+  if (!s)
+    return e;
+  delete e;
+  return s;
+}
+
+bool isConstant(const Expression *e, double c) {
+  return e->nodeType() == Expression::TypeConstant && static_cast<const Constant *>(e)->value() == c;
+}
+
+// a+b as one term, NULL if they don't combine. Otherwise the caller
+// deletes a and b, a+a = 2*a moves a into the result and sets it to NULL.
+Expression *combineTerms(Expression *&a, Expression *&b) {
+  // the smaller type first, like the pairs of a sorted set
+  if (b->nodeType() < a->nodeType())
+    swap(a, b);
+  if (a->CanonicalEqualTo(b)) {
+    Expression *r = new Multiplication(new Constant(2), a);
+    a = NULL;
+    return r;
   }
+  Expression *r = a->TrySimplifyAdding(b);
+  return r ? r : b->TrySimplifyAdding(a);
+}
+
+// a*b as one factor, NULL if they don't combine
+Expression *combineFactors(Expression *a, Expression *b) {
+  if (b->nodeType() < a->nodeType())
+    swap(a, b);
+  Expression *r = a->TrySimplifyMultiplying(b);
+  return r ? r : b->TrySimplifyMultiplying(a);
+}
+
+} // namespace
+
+Expression *Expression::diffSimplify() const {
+  return simplified(unique_ptr<Expression>(this->diff())).release();
 }
 
 void CommutativeOperators::recursivePrintCommutative(string &output,
@@ -58,7 +152,62 @@ void CommutativeOperators::recursivePrintCommutative(string &output,
   if (closeParenthese) output.push_back(')');
 }
 
-void CommutativeOperators::construct(ExpressionSet children) {
+ExpressionSet::ExpressionSet(const ExpressionSet &other) :
+    items(inlineItems), count(0), capacity(InlineCapacity) {
+  insert(other.begin(), other.end());
+}
+
+ExpressionSet &ExpressionSet::operator=(const ExpressionSet &other) {
+  if (this != &other) {
+    count = 0;
+    insert(other.begin(), other.end());
+  }
+  return *this;
+}
+
+void ExpressionSet::reserve(size_t minCapacity) {
+  if (minCapacity <= capacity)
+    return;
+  Expression **grown = allocator.allocate(minCapacity);
+  copy(items, items + count, grown);
+  if (items != inlineItems)
+    allocator.deallocate(items, capacity);
+  items = grown;
+  capacity = minCapacity;
+}
+
+void ExpressionSet::mergeTail(size_t sortedCount) {
+  ExpressionComparator smaller;
+  if (count - sortedCount <= 8) {
+    // insertion, no temporary buffer for the usual few elements
+    for (size_t k = sortedCount; k < count; k++) {
+      Expression *e = items[k];
+      Expression **position = upper_bound(items, items + k, e, smaller);
+      copy_backward(position, items + k, items + k + 1);
+      *position = e;
+    }
+  } else {
+    stable_sort(items + sortedCount, items + count, smaller);
+    inplace_merge(items, items + sortedCount, items + count, smaller);
+  }
+}
+
+ExpressionSet::iterator ExpressionSet::insert(Expression *e) {
+  if (count == capacity) reserve(2 * capacity);
+  Expression **position = upper_bound(items, items + count, e, ExpressionComparator());
+  copy_backward(position, items + count, items + count + 1);
+  *position = e;
+  count++;
+  return position;
+}
+
+ExpressionSet::iterator ExpressionSet::erase(iterator it) {
+  copy(it + 1, items + count, it);
+  count--;
+  return it;
+}
+
+void CommutativeOperators::construct(const ExpressionSet &children) {
   if (children.size() <= 1)
     throw invalid_argument("childrenSet should have more than 1 element");
   for (auto i = children.begin(); i != children.end(); i++)
@@ -73,33 +222,36 @@ void CommutativeOperators::construct(Expression *a, Expression *b) {
   construct(two);
 }
 
+void CommutativeOperators::computeStructure(size_t &hash, int &nodeCount, int &depth) const {
+  // order independent, equal sets may be stored in different orders
+  hash = 0;
+  nodeCount = 1;
+  depth = 0;
+  for (auto i = childrenSet.begin(); i != childrenSet.end(); i++) {
+    hash += hashCombine(0, (*i)->structuralHash());
+    nodeCount += (*i)->nodeCount();
+    depth = max(depth, (*i)->depth());
+  }
+  depth++;
+}
+
+// one pass, what simplify() returns is already in normal form
 bool CommutativeOperators::simplifyChildren() {
-  bool needContinue = true;
   bool changed = false;
-  while (needContinue) {
-    needContinue = false;
-    for (auto i = childrenSet.begin(); i != childrenSet.end(); i++) {
-      bool childChanged;
-      Expression *simplified = (*i)->simplify(childChanged);
-      if (simplified) {
-        changed = true;
-        needContinue = true;
-        delete *i;
-        i = childrenSet.erase(i);
-        childrenSet.insert(simplified);
-        if (i == childrenSet.end())
-          break;
-      } else if (childChanged) {
-        changed = true;
-        needContinue = true;
-        Expression *afterChange = *i;
-        i = childrenSet.erase(i);
-        childrenSet.insert(afterChange);
-        if (i == childrenSet.end())
-          break;
-      }
+  // children are replaced in place, then sorted again once
+  for (auto i = childrenSet.begin(); i != childrenSet.end(); i++) {
+    bool childChanged;
+    Expression *simplified = (*i)->simplify(childChanged);
+    if (simplified) {
+      changed = true;
+      delete *i;
+      *i = simplified;
+    } else if (childChanged) {
+      changed = true;
     }
   }
+  if (changed)
+    childrenSet.sort();
   return changed;
 }
 
@@ -134,8 +286,12 @@ bool CommutativeOperators::CanonicalSmallerThanSameType(Expression *other) {
     auto i = childrenSet.begin();
     auto j = p->childrenSet.begin();
     for (; i != childrenSet.end(); i++, j++) {
+      // lexicographic, the equality test rejects in constant time where
+      // the reverse comparison would walk the subtrees again
       if ((*i)->CanonicalSmallerThan(*j))
         return true;
+      if (!(*i)->CanonicalEqualTo(*j))
+        return false;
     }
     return false;
   }
@@ -165,12 +321,22 @@ double Addition::operator()(double x) const {
   return sum;
 }
 
+Dual Addition::operator()(const Dual &x) const {
+  Dual sum(0, 0);
+  for (auto it = childrenSet.begin(); it != childrenSet.end(); it++) {
+    Dual term = (**it)(x);
+    sum.value += term.value;
+    sum.derivative += term.derivative;
+  }
+  return sum;
+}
+
 void Addition::recursivePrint(string &output, OperatorPrecedence::Order order) const {
   recursivePrintCommutative(output, order, OperatorPrecedence::AddSub, '+');
 }
 
 Expression *Addition::diff() const {
-  multiset<Expression *, ExpressionComparator> d;
+  ExpressionSet d;
   for (auto it = childrenSet.begin(); it != childrenSet.end(); it++)
     d.insert((*it)->diff());
   return new Addition(d);
@@ -185,99 +351,361 @@ Expression *Addition::TrySimplifyMultiplying(Expression *right) {
   return nullptr;
 }
 
-Expression *Addition::simplify(bool &changed) {
-  bool needContinue = true;
-  changed = false;
-  while (needContinue) {
-    needContinue = false;
-    if (this->simplifyChildren()) {
-      changed = true;
-      //needContinue = true;
-    }
-    for (auto it = childrenSet.begin(); it != childrenSet.end(); it++) {
-      switch ((*it)->nodeType()) {
-        case TypeAdd: {
-          Addition *p = static_cast<Addition *>(*it);
-          //pointer ownership changed
-          childrenSet.insert(p->childrenSet.begin(), p->childrenSet.end());
-          p->childrenSet.clear();
-          delete *it;
-          it = childrenSet.erase(it);
-          changed = true;
-          needContinue = true;
-          break;
-        }
-        case TypeConstant: {
-          Constant *p = static_cast<Constant *>(*it);
-          if (p->value() == 0) {
-            changed = true;
-            needContinue = true;
-            delete *it;
-            it = childrenSet.erase(it);
-          }
-          break;
+namespace {
+
+// a child of a sum seen as coefficient * factors
+struct LikeTerm {
+  double coefficient;
+  Expression *const *factors;
+  size_t factorCount;
+  size_t child;
+};
+
+// orders the terms by their factors, compared like the children of two
+// products, and by position for equal factors
+bool smallerFactors(const LikeTerm &a, const LikeTerm &b) {
+  if (a.factorCount != b.factorCount)
+    return a.factorCount < b.factorCount;
+  for (size_t k = 0; k < a.factorCount; k++) {
+    if (a.factors[k]->CanonicalSmallerThan(b.factors[k]))
+      return true;
+    if (!a.factors[k]->CanonicalEqualTo(b.factors[k]))
+      return false;
+  }
+  return a.child < b.child;
+}
+
+bool sameFactors(const LikeTerm &a, const LikeTerm &b) {
+  if (a.factorCount != b.factorCount)
+    return false;
+  for (size_t k = 0; k < a.factorCount; k++)
+    if (!a.factors[k]->CanonicalEqualTo(b.factors[k]))
+      return false;
+  return true;
+}
+
+void addCoefficient(vector<double> &para, size_t k, double c) {
+  if (para.size() <= k)
+    para.resize(k + 1, 0);
+  para[k] += c;
+}
+
+} // namespace
+
+// 2*a + b + 3*a = 5*a + b, and constants, x and polynomials add up into
+// one polynomial. The terms are sorted by their non constant factors so
+// that like terms end up next to each other, n log n comparisons in all.
+bool Addition::collectLikeTerms() {
+  vector<double> para;
+  vector<size_t> polynomialTerms;
+  vector<LikeTerm> terms;
+  terms.reserve(childrenSet.size());
+  for (size_t k = 0; k < childrenSet.size(); k++) {
+    Expression *child = childrenSet[k];
+    LikeTerm t;
+    t.coefficient = 1;
+    t.factors = childrenSet.begin() + k;
+    t.factorCount = 1;
+    t.child = k;
+    switch (child->nodeType()) {
+      case TypeConstant:
+        addCoefficient(para, 0, static_cast<Constant *>(child)->value());
+        polynomialTerms.push_back(k);
+        continue;
+      case TypeVariable:
+        addCoefficient(para, 1, 1);
+        polynomialTerms.push_back(k);
+        continue;
+      case TypePoly: {
+        vector<double> p = static_cast<Polynomial *>(child)->getParameter();
+        for (size_t i = 0; i < p.size(); i++)
+          addCoefficient(para, i, p[i]);
+        polynomialTerms.push_back(k);
+        continue;
+      }
+      case TypeMulti: {
+        // a simplified product holds at most one constant, sorted first
+        const ExpressionSet &factors = static_cast<Multiplication *>(child)->getChildren();
+        if (factors[0]->nodeType() == TypeConstant) {
+          t.coefficient = static_cast<Constant *>(factors[0])->value();
+          t.factors = factors.begin() + 1;
+          t.factorCount = factors.size() - 1;
+        } else {
+          t.factors = factors.begin();
+          t.factorCount = factors.size();
         }
-        default:
-          break;
+        break;
       }
+      default:
+        break;
+    }
+    terms.push_back(t);
+  }
+  sort(terms.begin(), terms.end(), smallerFactors);
+  bool merging = polynomialTerms.size() > 1;
+  for (size_t k = 1; k < terms.size() && !merging; k++)
+    merging = sameFactors(terms[k - 1], terms[k]);
+  if (!merging)
+    return false;
 
-      if (it == childrenSet.end())
+  vector<Expression *> kept;
+  vector<Expression *> merged;
+  for (size_t begin = 0, end; begin < terms.size(); begin = end) {
+    double coefficient = terms[begin].coefficient;
+    for (end = begin + 1; end < terms.size() && sameFactors(terms[begin], terms[end]); end++)
+      coefficient += terms[end].coefficient;
+    Expression *first = childrenSet[terms[begin].child];
+    if (end == begin + 1) {
+      kept.push_back(first);
+      continue;
+    }
+    if (coefficient != 0) {
+      if (first->nodeType() != TypeMulti) {
+        // moved, the factor is the term itself
+        merged.push_back(coefficient == 1 ? first
+                         : normalForm(new Multiplication(new Constant(coefficient), first)));
+        begin++;
+      } else {
+        ExpressionSet product;
+        if (coefficient != 1)
+          product.insert(new Constant(coefficient));
+        for (size_t i = 0; i < terms[begin].factorCount; i++)
+          product.insert(terms[begin].factors[i]->clone());
+        merged.push_back(product.size() == 1 ? product[0] : normalForm(new Multiplication(product)));
+      }
+    }
+    for (size_t i = begin; i < end; i++)
+      delete childrenSet[terms[i].child];
+  }
+  if (polynomialTerms.size() == 1) {
+    kept.push_back(childrenSet[polynomialTerms[0]]);
+  } else if (polynomialTerms.size() > 1) {
+    for (size_t i = 0; i < polynomialTerms.size(); i++)
+      delete childrenSet[polynomialTerms[i]];
+    Expression *p = Polynomial::create(para);
+    if (p->nodeType() == TypeConstant && static_cast<Constant *>(p)->value() == 0)
+      delete p;
+    else
+      merged.push_back(p);
+  }
+  // sorted again once
+  childrenSet.clear();
+  childrenSet.insert(kept.begin(), kept.end());
+  childrenSet.insert(merged.begin(), merged.end());
+  return true;
+}
+
+namespace {
+
+// The kept terms of a sum, filed under the parts through which another
+// term may combine with them: the factors of a product, or the term
+// itself, the denominator of a quotient, and one key shared by the
+// constants, x and the polynomials. A term combines only with terms
+// sharing one of these parts, equal parts have equal structural hashes,
+// so the terms filed under the hashes of its parts include all of those
+// it combines with; the pairs without a common part are never tried.
+// sums up to this size try every pair
+const size_t SmallSum = 8;
+
+class TermIndex {
+  multimap<size_t, Expression *> terms;
+  vector<size_t> scratch;
+
+  static void keys(const Expression *e, vector<size_t> &out) {
+    out.clear();
+    switch (e->nodeType()) {
+      case Expression::TypeConstant:
+      case Expression::TypeVariable:
+      case Expression::TypePoly:
+        // any value, a collision only adds candidates
+        out.push_back(0);
         break;
-      auto next = it;
-      next++;
-      if (next == childrenSet.end())
-        continue;
+      case Expression::TypeMulti: {
+        const ExpressionSet &factors = static_cast<const Multiplication *>(e)->getChildren();
+        for (auto it = factors.begin(); it != factors.end(); it++)
+          out.push_back((*it)->structuralHash());
+        return;
+      }
+      case Expression::TypeDivide:
+        out.push_back(static_cast<const Division *>(e)->getDenominator()->structuralHash());
+        break;
+      default:
+        break;
+    }
+    out.push_back(e->structuralHash());
+  }
 
-      //simplify two by two
-      for (; next != childrenSet.end(); next++) {
-        assert(it != next);
-        if ((*it)->CanonicalEqualTo(*next)) {
-          //a+a=2*a
-          changed = true;
-          needContinue = true;
-          Expression *r = new Multiplication(new Constant(2), (*it)->clone());
-          delete *it;
-          delete *next;
-          childrenSet.insert(r);
-          childrenSet.erase(it);
-          it = childrenSet.erase(next);
+ public:
+  void add(Expression *e) {
+    keys(e, scratch);
+    for (auto k = scratch.begin(); k != scratch.end(); k++)
+      terms.insert(make_pair(*k, e));
+  }
+
+  void remove(Expression *e) {
+    keys(e, scratch);
+    for (auto k = scratch.begin(); k != scratch.end(); k++) {
+      auto range = terms.equal_range(*k);
+      for (auto it = range.first; it != range.second; it++)
+        if (it->second == e) {
+          terms.erase(it);
           break;
-        } else {
-          Expression *p = (*it)->TrySimplifyAdding(*next);
-          if (p) {
-            changed = true;
-            needContinue = true;
-            delete *it;
-            delete *next;
-            childrenSet.insert(p);
-            childrenSet.erase(it);
-            it = childrenSet.erase(next);
-            break;
-          } else {
-            Expression *pp = (*next)->TrySimplifyAdding(*it);
-            if (pp) {
-              changed = true;
-              needContinue = true;
-              delete *it;
-              delete *next;
-              childrenSet.insert(pp);
-              childrenSet.erase(it);
-              it = childrenSet.erase(next);
-              break;
-            }
-          }
         }
+    }
+  }
 
+  // the kept terms e may combine with, in the order of the sum
+  void candidates(const Expression *e, vector<Expression *> &out) {
+    out.clear();
+    keys(e, scratch);
+    for (auto k = scratch.begin(); k != scratch.end(); k++) {
+      auto range = terms.equal_range(*k);
+      for (auto it = range.first; it != range.second; it++)
+        out.push_back(it->second);
+    }
+    if (out.size() > 1) {
+      sort(out.begin(), out.end(), ExpressionComparator());
+      out.erase(unique(out.begin(), out.end()), out.end());
+    }
+  }
+};
+
+} // namespace
+
+// A term is tried against the kept terms it shares a part with, the
+// smaller ones first, like a scan of the sorted pairs; a combined term is
+// brought to its normal form and merged in turn. n log n when nothing
+// combines.
+bool Addition::mergeTerms(size_t kept, Expression *r) {
+  // smallest last
+  vector<Expression *> pending(childrenSet.begin() + kept, childrenSet.end());
+  reverse(pending.begin(), pending.end());
+  if (r)
+    pending.push_back(r);
+  while (childrenSet.size() > kept)
+    childrenSet.erase(childrenSet.end() - 1);
+  // a few terms are cheaper to pair than to file
+  bool filed = kept + pending.size() > SmallSum;
+  TermIndex index;
+  if (filed)
+    for (auto it = childrenSet.begin(); it != childrenSet.end(); it++)
+      index.add(*it);
+  vector<Expression *> candidates;
+  bool merged = false;
+  while (!pending.empty()) {
+    Expression *e = pending.back();
+    pending.pop_back();
+    // (a+b)+c = a+b+c, 0+a = a
+    if (e->nodeType() == TypeAdd) {
+      Addition *p = static_cast<Addition *>(e);
+      pending.insert(pending.end(), p->childrenSet.begin(), p->childrenSet.end());
+      p->childrenSet.clear();
+      delete p;
+      continue;
+    }
+    if (isConstant(e, 0)) {
+      delete e;
+      continue;
+    }
+    if (filed)
+      index.candidates(e, candidates);
+    else
+      candidates.assign(childrenSet.begin(), childrenSet.end());
+    Expression *combined = NULL;
+    for (size_t i = 0; i < candidates.size() && !combined; i++) {
+      Expression *c = candidates[i];
+      Expression *a = c;
+      Expression *b = e;
+      combined = combineTerms(a, b);
+      if (combined) {
+        if (filed)
+          index.remove(c);
+        ExpressionSet::iterator it = lower_bound(childrenSet.begin(), childrenSet.end(), c,
+                                                 ExpressionComparator());
+        while (*it != c)
+          it++;
+        childrenSet.erase(it);
+        delete a;
+        delete b;
+      }
+    }
+    if (combined) {
+      pending.push_back(normalForm(combined));
+      merged = true;
+    } else {
+      childrenSet.insert(e);
+      if (filed)
+        index.add(e);
+    }
+  }
+  return merged;
+}
+
+// Bottom-up, in one pass: the children reach their normal form first,
+// like terms are collected, then every term is tried against the smaller
+// ones it may combine with, once. A few terms are scanned in place until
+// a pair combines, larger sums go to mergeTerms at once. No subtree is
+// simplified twice.
+Expression *Addition::simplify(bool &changed) {
+  changed = false;
+  if (normalized)
+    return NULL;
+  changed = simplifyChildren();
+  // (a+b)+c = a+b+c, 0+a = a; a normal sum is flat and free of zeros
+  for (size_t i = 0; i < childrenSet.size();) {
+    Expression *child = childrenSet[i];
+    bool nested = child->nodeType() == TypeAdd;
+    if (!nested && !isConstant(child, 0)) {
+      i++;
+      continue;
+    }
+    childrenSet.erase(childrenSet.begin() + i);
+    if (nested) {
+      Addition *p = static_cast<Addition *>(child);
+      //pointer ownership changed
+      childrenSet.insert(p->childrenSet.begin(), p->childrenSet.end());
+      p->childrenSet.clear();
+    }
+    delete child;
+    changed = true;
+  }
+  if (collectLikeTerms())
+    changed = true;
+
+  if (childrenSet.size() > SmallSum) {
+    if (mergeTerms(0, NULL))
+      changed = true;
+  } else {
+    bool merged = false;
+    for (size_t j = 1; j < childrenSet.size() && !merged; j++) {
+      for (size_t i = 0; i < j && !merged; i++) {
+        Expression *a = childrenSet[i];
+        Expression *b = childrenSet[j];
+        Expression *r = combineTerms(a, b);
+        if (!r)
+          continue;
+        childrenSet.erase(childrenSet.begin() + j);
+        childrenSet.erase(childrenSet.begin() + i);
+        delete a;
+        delete b;
+        // the j - 1 terms left before j were already tried against each
+        // other, only r and the terms after j are still to be merged
+        mergeTerms(j - 1, normalForm(r));
+        changed = merged = true;
       }
-      if (it == childrenSet.end())
-        break;
     }
   }
+  if (changed)
+    invalidateStructure();
   if (childrenSet.size() == 0) {
     return new Constant(0);
   } else if (childrenSet.size() == 1) {
-    return (*childrenSet.begin())->clone();
+    // handed over, this is left empty
+    Expression *last = childrenSet[0];
+    childrenSet.clear();
+    return last;
   } else {
+    normalized = true;
     return NULL;
   }
 }
@@ -289,6 +717,17 @@ double Multiplication::operator()(double x) const {
   return prod;
 }
 
+Dual Multiplication::operator()(const Dual &x) const {
+  // (uv)' = u'v + uv'
+  Dual prod(1, 0);
+  for (auto it = childrenSet.begin(); it != childrenSet.end(); it++) {
+    Dual factor = (**it)(x);
+    prod.derivative = prod.derivative * factor.value + prod.value * factor.derivative;
+    prod.value *= factor.value;
+  }
+  return prod;
+}
+
 void Multiplication::recursivePrint(string &output, OperatorPrecedence::Order order) const {
   recursivePrintCommutative(output, order, OperatorPrecedence::MultiDivide,
                             '*');
@@ -392,85 +831,122 @@ Expression *Multiplication::TrySimplifyMultiplying(Expression *right) {
   return nullptr;
 }
 
+// every pending factor is tried against all the kept ones, products are
+// short
+bool Multiplication::mergeFactors(size_t kept, Expression *r) {
+  // smallest last
+  vector<Expression *> pending(childrenSet.begin() + kept, childrenSet.end());
+  reverse(pending.begin(), pending.end());
+  pending.push_back(r);
+  while (childrenSet.size() > kept)
+    childrenSet.erase(childrenSet.end() - 1);
+  while (!pending.empty()) {
+    Expression *e = pending.back();
+    pending.pop_back();
+    // (a*b)*c = a*b*c, 1*a = a, 0*a = 0
+    if (e->nodeType() == TypeMulti) {
+      Multiplication *p = static_cast<Multiplication *>(e);
+      pending.insert(pending.end(), p->childrenSet.begin(), p->childrenSet.end());
+      p->childrenSet.clear();
+      delete p;
+      continue;
+    }
+    if (isConstant(e, 1)) {
+      delete e;
+      continue;
+    }
+    if (isConstant(e, 0)) {
+      delete e;
+      for (auto item : pending)
+        delete item;
+      for (auto item : childrenSet)
+        delete item;
+      childrenSet.clear();
+      return false;
+    }
+    Expression *combined = NULL;
+    for (size_t i = 0; i < childrenSet.size() && !combined; i++) {
+      Expression *a = childrenSet[i];
+      combined = combineFactors(a, e);
+      if (combined) {
+        childrenSet.erase(childrenSet.begin() + i);
+        delete a;
+        delete e;
+      }
+    }
+    if (combined)
+      pending.push_back(normalForm(combined));
+    else
+      childrenSet.insert(e);
+  }
+  return true;
+}
+
+// bottom-up in one pass, like Addition::simplify
 Expression *Multiplication::simplify(bool &changed) {
-  bool needContinue = true;
   changed = false;
-  while (needContinue) {
-    needContinue = false;
-    if (this->simplifyChildren()) {
+  if (normalized)
+    return NULL;
+  changed = simplifyChildren();
+  // (a*b)*c = a*b*c, 1*a = a, 0*a = 0; a normal product is flat and free
+  // of ones
+  for (size_t i = 0; i < childrenSet.size();) {
+    Expression *child = childrenSet[i];
+    if (child->nodeType() == TypeMulti) {
+      Multiplication *p = static_cast<Multiplication *>(child);
+      childrenSet.erase(childrenSet.begin() + i);
+      //pointer ownership changed
+      childrenSet.insert(p->childrenSet.begin(), p->childrenSet.end());
+      p->childrenSet.clear();
+      delete p;
+      changed = true;
+    } else if (isConstant(child, 1)) {
+      childrenSet.erase(childrenSet.begin() + i);
+      delete child;
       changed = true;
-      //needContinue = true;
+    } else if (isConstant(child, 0)) {
+      for (auto item : childrenSet)
+        delete item;
+      childrenSet.clear();
+      changed = true;
+      invalidateStructure();
+      return new Constant(0);
+    } else {
+      i++;
     }
+  }
 
-    for (auto it = childrenSet.begin(); it != childrenSet.end(); it++) {
-      switch ((*it)->nodeType()) {
-        case TypeMulti: {
-          Multiplication *p = static_cast<Multiplication *>(*it);
-          it = childrenSet.erase(it);
-          childrenSet.insert(p->childrenSet.begin(), p->childrenSet.end());
-          p->childrenSet.clear();
-          delete p;
-          changed = true;
-          needContinue = true;
-          break;
-        }
-        case TypeConstant: {
-          Constant *p = static_cast<Constant *>(*it);
-          if (p->value() == 1) {
-            changed = true;
-            needContinue = true;
-            delete *it;
-            it = childrenSet.erase(it);
-          } else if (p->value() == 0) {
-            for (auto item : childrenSet)
-              delete item;
-            childrenSet.clear();
-            changed = true;
-            return new Constant(0);
-          }
-          break;
-        }
-      }
-
-      if (it == childrenSet.end())
-        break;
-      auto next = it;
-      next++;
-      if (next == childrenSet.end())
+  bool merged = false;
+  for (size_t j = 1; j < childrenSet.size() && !merged; j++) {
+    for (size_t i = 0; i < j && !merged; i++) {
+      Expression *a = childrenSet[i];
+      Expression *b = childrenSet[j];
+      Expression *r = combineFactors(a, b);
+      if (!r)
         continue;
-      //simplify two by two
-      for (; next != childrenSet.end(); next++) {
-        Expression *p = (*it)->TrySimplifyMultiplying(*next);
-        if (p) {
-          changed = true;
-          needContinue = true;
-          delete *it;
-          delete *next;
-          childrenSet.insert(p);
-          childrenSet.erase(it);
-          it = childrenSet.erase(next);
-          break;
-        } else {
-          Expression *pp = (*next)->TrySimplifyMultiplying(*it);
-          if (pp) {
-            changed = true;
-            needContinue = true;
-            delete *it;
-            delete *next;
-            childrenSet.insert(pp);
-            childrenSet.erase(it);
-            it = childrenSet.erase(next);
-            break;
-          }
-        }
+      childrenSet.erase(childrenSet.begin() + j);
+      childrenSet.erase(childrenSet.begin() + i);
+      delete a;
+      delete b;
+      changed = merged = true;
+      // as in Addition::simplify, only r and the factors after j are left
+      if (!mergeFactors(j - 1, normalForm(r))) {
+        invalidateStructure();
+        return new Constant(0);
       }
     }
   }
+  if (changed)
+    invalidateStructure();
   if (childrenSet.size() == 0) {
-    return new Constant(0);
+    return new Constant(1);
   } else if (childrenSet.size() == 1) {
-    return (*childrenSet.begin())->clone();
+    // handed over, this is left empty
+    Expression *last = childrenSet[0];
+    childrenSet.clear();
+    return last;
   } else {
+    normalized = true;
     return NULL;
   }
 }
@@ -506,6 +982,12 @@ Division::Division(Expression *numerator, Expression *denominator) :
     throw invalid_argument("null argument in Division");
 }
 
+void Division::computeStructure(size_t &hash, int &nodeCount, int &depth) const {
+  hash = hashCombine(numerator->structuralHash(), denominator->structuralHash());
+  nodeCount = 1 + numerator->nodeCount() + denominator->nodeCount();
+  depth = 1 + max(numerator->depth(), denominator->depth());
+}
+
 bool Division::CanonicalEqualToSameType(Expression *other) {
   assert(other->nodeType() == TypeDivide);
   Division *p = static_cast<Division *>(other);
@@ -518,16 +1000,24 @@ bool Division::CanonicalSmallerThanSameType(Expression *other) {
   Division *p = static_cast<Division *>(other);
   if (this->denominator->CanonicalSmallerThan(p->denominator))
     return true;
-  else if (this->numerator->CanonicalSmallerThan(p->denominator))
-    return true;
-  else
+  else if (!this->denominator->CanonicalEqualTo(p->denominator))
     return false;
+  else
+    return this->numerator->CanonicalSmallerThan(p->numerator);
 }
 
 double Division::operator()(double x) const {
   return (*numerator)(x) / (*denominator)(x);
 }
 
+Dual Division::operator()(const Dual &x) const {
+  // (u/v)' = (u' - (u/v)v') / v
+  Dual u = (*numerator)(x);
+  Dual v = (*denominator)(x);
+  double q = u.value / v.value;
+  return Dual(q, (u.derivative - q * v.derivative) / v.value);
+}
+
 void Division::recursivePrint(string &output, OperatorPrecedence::Order order) const {
   bool closeParenthese = false;
   OperatorPrecedence::Order nextOrder;
@@ -615,56 +1105,57 @@ Expression *Division::TrySimplifyMultiplying(Expression *right) {
   return NULL;
 }
 
+// bottom-up: the operands reach their normal form first, once
 Expression *Division::simplify(bool &changed) {
   changed = false;
-  changed = simplifyChildren() || changed;
+  if (normalized)
+    return NULL;
+  changed = simplifyChildren();
   // 0/a = 0
-  if (numerator->nodeType() == TypeConstant) {
-    Constant *p = static_cast<Constant *>(numerator);
-    if (p->value() == 0) {
-      return new Constant(0);
-    }
+  if (isConstant(numerator, 0)) {
+    changed = true;
+    return new Constant(0);
   }
-  // a/1 = a
-  if (denominator->nodeType() == TypeConstant) {
-    Constant *p = static_cast<Constant *>(denominator);
-    if (p->value() == 1) {
-      return numerator->clone();
-    }
+  // (a/b)/(c/d) = ad/bc; normal operands hold no division at their top,
+  // so neither do the new products, brought to their normal form at once
+  Expression *b = 0, *d = 0;
+  if (numerator->nodeType() == TypeDivide && !isConstant(denominator, 1)) {
+    Division *p = static_cast<Division *>(numerator);
+    //change ownership
+    numerator = p->numerator;
+    b = p->denominator;
+    p->numerator = NULL;
+    p->denominator = NULL;
+    delete p;
   }
-  // (a/b)/(c/d) = ad/bc
-  {
-    bool numeDivision = numerator->nodeType() == TypeDivide;
-    bool denoDivision = denominator->nodeType() == TypeDivide;
-    Expression *a = 0, *b = 0, *c = 0, *d = 0;
-    if (numeDivision) {
-      changed = true;
-      Division *p = static_cast<Division *>(numerator);
-      //change ownership
-      a = p->numerator;
-      b = p->denominator;
-      p->numerator = NULL;
-      p->denominator = NULL;
-      delete p;
-      numerator = a;
-    }
-    if (denoDivision) {
-      changed = true;
-      Division *p = static_cast<Division *>(denominator);
-      //change ownership
-      c = p->numerator;
-      d = p->denominator;
-      p->numerator = NULL;
-      p->denominator = NULL;
-      delete p;
-      denominator = c;
-    }
-    if (b)
-      denominator = new Multiplication(denominator, b);
-    if (d)
-      numerator = new Multiplication(numerator, d);
+  if (denominator->nodeType() == TypeDivide) {
+    Division *p = static_cast<Division *>(denominator);
+    //change ownership
+    denominator = p->numerator;
+    d = p->denominator;
+    p->numerator = NULL;
+    p->denominator = NULL;
+    delete p;
+  }
+  if (b) {
+    changed = true;
+    denominator = normalForm(new Multiplication(denominator, b));
+  }
+  if (d) {
+    changed = true;
+    numerator = normalForm(new Multiplication(numerator, d));
+  }
+  // a/1 = a, a/(1/d) = ad/1 included
+  if (isConstant(denominator, 1)) {
+    changed = true;
+    // handed over, this is left without numerator
+    Expression *a = numerator;
+    numerator = NULL;
+    return a;
   }
-  changed = simplifyChildren() || changed;
+  if (changed)
+    invalidateStructure();
+  normalized = true;
   return NULL;
 }
 
@@ -673,6 +1164,12 @@ Composition::Composition(Expression *left, Expression *right) :
   if (!left || !right) throw invalid_argument("null pointer in Composition");
 }
 
+void Composition::computeStructure(size_t &hash, int &nodeCount, int &depth) const {
+  hash = hashCombine(left->structuralHash(), right->structuralHash());
+  nodeCount = 1 + left->nodeCount() + right->nodeCount();
+  depth = 1 + max(left->depth(), right->depth());
+}
+
 bool Composition::CanonicalEqualToSameType(Expression *other) {
   assert(other->nodeType() == TypeCompo);
   Composition *p = static_cast<Composition *>(other);
@@ -685,10 +1182,10 @@ bool Composition::CanonicalSmallerThanSameType(Expression *other) {
   Composition *p = static_cast<Composition *>(other);
   if (this->left->CanonicalSmallerThan(p->left))
     return true;
-  else if (this->right->CanonicalSmallerThan(p->right))
-    return true;
-  else
+  else if (!this->left->CanonicalEqualTo(p->left))
     return false;
+  else
+    return this->right->CanonicalSmallerThan(p->right);
 }
 
 void Composition::recursivePrint(string &output, OperatorPrecedence::Order order) const {
@@ -731,12 +1228,22 @@ Expression *Composition::TrySimplifyMultiplying(Expression *right) {
 Expression *Composition::simplify(bool &changed) {
   if (this->right->nodeType() == TypeVariable) {
     changed = true;
-    return this->left->clone();
+    // handed over, this is left without left side
+    Expression *f = left;
+    left = NULL;
+    return normalForm(f);
   }
   changed = false;
+  normalized = true;
   return nullptr;
 }
 
+void Constant::computeStructure(size_t &hash, int &nodeCount, int &depth) const {
+  hash = hashDouble(c);
+  nodeCount = 1;
+  depth = 1;
+}
+
 bool Constant::CanonicalEqualToSameType(Expression *other) {
   assert(other->nodeType() == TypeConstant);
   const Constant *p = static_cast<const Constant *>(other);
@@ -847,7 +1354,7 @@ Expression *VariableX::TrySimplifyMultiplying(Expression *right) {
 
 Polynomial::Polynomial(const vector<double> &parametre) :
     Expression(TypePoly) {
-  this->para = parametre;
+  this->para.assign(parametre.begin(), parametre.end());
   // clear zeros at the end of list
   for (int i = para.size() - 1; i >= 0; i--) {
     if (para[i] == 0)
@@ -897,6 +1404,14 @@ Expression *Polynomial::create(double a, double b) {
     return new Polynomial(a, b);
 }
 
+void Polynomial::computeStructure(size_t &hash, int &nodeCount, int &depth) const {
+  hash = 0;
+  for (auto it = para.begin(); it != para.end(); it++)
+    hash = hashCombine(hash, hashDouble(*it));
+  nodeCount = 1;
+  depth = 1;
+}
+
 bool Polynomial::CanonicalEqualToSameType(Expression *other) {
   assert(other->nodeType() == TypePoly);
   Polynomial *p = static_cast<Polynomial *>(other);
@@ -914,6 +1429,8 @@ bool Polynomial::CanonicalSmallerThanSameType(Expression *other) {
   Polynomial *p = static_cast<Polynomial *>(other);
   if (para.size() < p->para.size()) {
     return true;
+  } else if (para.size() > p->para.size()) {
+    return false;
   } else {
     for (int i = para.size() - 1; i >= 0; i--)
       if (para[i] < p->para[i]) return true;
@@ -925,7 +1442,7 @@ double Polynomial::operator()(double x) const {
   assert(para.size() > 0);
   double xPowerK = 1;
   double sum = 0;
-  for (vector<double>::const_iterator it = para.begin(); it != para.end();
+  for (auto it = para.begin(); it != para.end();
        it++) {
     sum += (*it) * xPowerK;
     xPowerK *= x;
@@ -933,6 +1450,23 @@ double Polynomial::operator()(double x) const {
   return sum;
 }
 
+Dual Polynomial::operator()(const Dual &x) const {
+  assert(para.size() > 0);
+  double xPowerK = 1;
+  double xPowerKMinus1 = 0;
+  double sum = 0;
+  double dsum = 0;
+  int k = 0;
+  for (auto it = para.begin(); it != para.end();
+       it++, k++) {
+    sum += (*it) * xPowerK;
+    dsum += k * (*it) * xPowerKMinus1;
+    xPowerKMinus1 = xPowerK;
+    xPowerK *= x.value;
+  }
+  return Dual(sum, dsum * x.derivative);
+}
+
 void Polynomial::recursivePrint(string &output, OperatorPrecedence::Order order) const {
   stringstream ss;
   bool firstItem = true;
@@ -979,7 +1513,7 @@ void Polynomial::recursivePrint(string &output, OperatorPrecedence::Order order)
 Expression *Polynomial::diff() const {
   assert(para.size() >= 2);
   vector<double> temp;
-  vector<double>::const_iterator it = para.begin();
+  auto it = para.begin();
   it++;
   int k = 1;
   for (; it != para.end(); it++) {
@@ -1004,9 +1538,10 @@ Expression *Polynomial::TrySimplifyAdding(Expression *right) {
       assert(p->para.size() > 1);
       int n = max(this->para.size(), p->para.size());
       vector<double> newPara(n, 0);
-      for (int i = 0; i < n; i++) {
-        newPara[i] = this->para[i] + p->para[i];
-      }
+      for (int i = 0; i < this->para.size(); i++)
+        newPara[i] += this->para[i];
+      for (int i = 0; i < p->para.size(); i++)
+        newPara[i] += p->para[i];
       for (int i = newPara.size() - 1; i >= 0; i--) {
         if (newPara[i] == 0)
           newPara.pop_back();
@@ -1112,6 +1647,21 @@ double Trigo::operator()(double x) const {
   }
 }
 
+Dual Trigo::operator()(const Dual &x) const {
+  switch (trigoType) {
+    case Sin:
+      return Dual(sin(x.value), cos(x.value) * x.derivative);
+    case Cos:
+      return Dual(cos(x.value), -sin(x.value) * x.derivative);
+    case Tan: {
+      double t = tan(x.value);
+      return Dual(t, (1 + t * t) * x.derivative);
+    }
+    default:
+      assert(false);
+  }
+}
+
 string Trigo::functionName() const {
   switch (trigoType) {
     case Sin:
@@ -1138,6 +1688,10 @@ double Logarithm::operator()(double x) const {
   return log(x);
 }
 
+Dual Logarithm::operator()(const Dual &x) const {
+  return Dual(log(x.value), x.derivative / x.value);
+}
+
 string Logarithm::functionName() const {
   return string("ln");
 }
@@ -1171,11 +1725,16 @@ double Exponential::operator()(double x) const {
   return exp(x);
 }
 
+Dual Exponential::operator()(const Dual &x) const {
+  double e = exp(x.value);
+  return Dual(e, e * x.derivative);
+}
+
 string Exponential::functionName() const {
   return string("exp");
 }
 
-bool ExpressionComparator::operator()(Expression *left, Expression *right) {
+bool ExpressionComparator::operator()(Expression *left, Expression *right) const {
   return left->CanonicalSmallerThan(right);
 }
 
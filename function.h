@@ -8,6 +8,8 @@
 #include <vector>
 #include <set>
 #include <cmath>
+#include <memory>
+#include "ExpressionArena.h"
 
 struct OperatorPrecedence {
   enum Order {
@@ -22,8 +24,17 @@ struct OperatorPrecedence {
 
 class Expression;
 
+// a value together with its derivative with respect to x, evaluating an
+// Expression on Dual(x, 1) gives f(x) and f'(x) in one pass
+struct Dual {
+  double value;
+  double derivative;
+
+  Dual(double value, double derivative) : value(value), derivative(derivative) { }
+};
+
 struct ExpressionComparator {
-  bool operator()(Expression *left, Expression *right);
+  bool operator()(Expression *left, Expression *right) const;
 };
 
 class Expression {
@@ -43,11 +54,49 @@ class Expression {
   };
   NodeType type;
 
+ private:
+  // structural hash, node count and depth, computed on first use and
+  // cleared by the simplifications changing the node in place
+  mutable size_t cachedHash;
+  mutable int cachedNodeCount;
+  mutable int cachedDepth;
+  mutable bool structureValid;
+
+  void updateStructure() const;
+ protected:
+  // hash of the node without its type, number of nodes and depth of the
+  // subtree; equal expressions must give equal hashes
+  virtual void computeStructure(size_t &hash, int &nodeCount, int &depth) const = 0;
+
+  void invalidateStructure() { structureValid = false; }
+
+  // set when simplify() reached the normal form of the node, a later
+  // simplify() then returns at once instead of visiting the subtree again
+  bool normalized;
  public:
-  Expression(NodeType type) : type(type) { }
+  Expression(NodeType type) : type(type), structureValid(false), normalized(false) { }
+
+  // nodes come from the current ExpressionArena if any, see ExpressionArena
+  static void *operator new(size_t size);
+  static void operator delete(void *p);
 
   NodeType nodeType() const { return type; }
 
+  size_t structuralHash() const {
+    if (!structureValid) updateStructure();
+    return cachedHash;
+  }
+
+  int nodeCount() const {
+    if (!structureValid) updateStructure();
+    return cachedNodeCount;
+  }
+
+  int depth() const {
+    if (!structureValid) updateStructure();
+    return cachedDepth;
+  }
+
   bool CanonicalEqualTo(Expression *other);
   bool CanonicalSmallerThan(Expression *other);
   virtual bool CanonicalEqualToSameType(Expression *other) = 0;
@@ -55,6 +104,7 @@ class Expression {
   virtual Expression *diff() const = 0;
   virtual Expression *clone() const = 0;
   virtual double operator()(double x) const = 0;
+  virtual Dual operator()(const Dual &x) const = 0;
   virtual void recursivePrint(std::string &output, OperatorPrecedence::Order order) const = 0;
   virtual std::string stringPrint() const;
   Expression *diffSimplify() const;
@@ -82,24 +132,92 @@ class Expression {
   // virtual Expression *TrySimplifyPowering(Expression *left) const = 0;
   // virtual Expression *TrySimplifyComposed(Expression *right) const = 0;
   // virtual Expression *TrySimplifyComposing(Expression *left) const = 0;
+  // When the result is not NULL, the simplification may have moved
+  // subtrees of this expression into the result: this must then only be
+  // deleted, like every caller does.
   virtual Expression *simplify(bool &changed) = 0;
+
+  // simplified form of e, built from the nodes of e: a node collapsing
+  // into one of its children hands that child over instead of copying it
+  static std::unique_ptr<Expression> simplified(std::unique_ptr<Expression> e);
 };
 
-typedef std::multiset<Expression *, ExpressionComparator> ExpressionSet;
+// Children of a commutative operator, kept sorted by ExpressionComparator
+// in a contiguous array. Up to InlineCapacity children are stored in the
+// set itself, larger sets spill to the current ExpressionArena or the heap.
+// Iterators are plain pointers, invalidated by insert() and erase(). The
+// elements may be replaced in place through an iterator, sort() then
+// restores the order in one pass.
+class ExpressionSet {
+ public:
+  typedef Expression *value_type;
+  typedef Expression **iterator;
+  typedef Expression *const *const_iterator;
+  static const size_t InlineCapacity = 4;
+ private:
+  Expression **items;
+  size_t count;
+  size_t capacity;
+  Expression *inlineItems[InlineCapacity];
+  ArenaAllocator<Expression *> allocator;
+
+  void reserve(size_t minCapacity);
+  // merges the unsorted elements from sortedCount on into the sorted prefix
+  void mergeTail(size_t sortedCount);
+ public:
+  ExpressionSet() : items(inlineItems), count(0), capacity(InlineCapacity) { }
+  ExpressionSet(const ExpressionSet &other);
+  ExpressionSet &operator=(const ExpressionSet &other);
+
+  ~ExpressionSet() {
+    if (items != inlineItems)
+      allocator.deallocate(items, capacity);
+  }
+
+  iterator begin() { return items; }
+  iterator end() { return items + count; }
+  const_iterator begin() const { return items; }
+  const_iterator end() const { return items + count; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  Expression *operator[](size_t i) const { return items[i]; }
+
+  // after the elements it is equal to, like std::multiset
+  iterator insert(Expression *e);
+
+  template<class InputIterator>
+  void insert(InputIterator first, InputIterator last) {
+    size_t sortedCount = count;
+    for (; first != last; ++first) {
+      if (count == capacity) reserve(2 * capacity);
+      items[count++] = *first;
+    }
+    mergeTail(sortedCount);
+  }
+
+  iterator erase(iterator it);
+
+  void clear() { count = 0; }
+
+  void sort() { mergeTail(0); }
+};
 
 class CommutativeOperators: public Expression {
  protected:
   ExpressionSet childrenSet;
   void recursivePrintCommutative
       (std::string &output, OperatorPrecedence::Order order, OperatorPrecedence::Order selfOrder, char symbol) const;
-  void construct(ExpressionSet children);
+  void construct(const ExpressionSet &children);
   void construct(Expression *a, Expression *b);
   //return true if children changed
   bool simplifyChildren();
+  void computeStructure(size_t &hash, int &nodeCount, int &depth) const;
  public:
   CommutativeOperators(NodeType type) : Expression(type) {
   }
 
+  const ExpressionSet &getChildren() const { return childrenSet; }
+
   bool CanonicalEqualToSameType(Expression *other);
   bool CanonicalSmallerThanSameType(Expression *other);
   Expression *clone() const;
@@ -107,6 +225,11 @@ class CommutativeOperators: public Expression {
 };
 
 class Addition: public CommutativeOperators {
+  // return true if children changed
+  bool collectLikeTerms();
+  // merges r, if not NULL, and the children from kept on into the
+  // children before kept; true if a pair combined
+  bool mergeTerms(size_t kept, Expression *r);
  public:
   Addition(ExpressionSet &exprs) : CommutativeOperators(TypeAdd) {
     construct(exprs);
@@ -117,6 +240,7 @@ class Addition: public CommutativeOperators {
   }
 
   double operator()(double x) const;
+  Dual operator()(const Dual &x) const;
   void recursivePrint(std::string &output, OperatorPrecedence::Order order) const;
   Expression *diff() const;
   virtual Expression *TrySimplifyAdding(Expression *right);
@@ -131,6 +255,9 @@ class Addition: public CommutativeOperators {
 };
 
 class Multiplication: public CommutativeOperators {
+  // merges r and the children from kept on into the children before kept;
+  // false if a zero came up, the children are deleted then
+  bool mergeFactors(size_t kept, Expression *r);
  public:
   Multiplication(ExpressionSet &exprs) : CommutativeOperators(TypeMulti) {
     construct(exprs);
@@ -141,6 +268,7 @@ class Multiplication: public CommutativeOperators {
   }
 
   double operator()(double x) const;
+  Dual operator()(const Dual &x) const;
   void recursivePrint(std::string &output, OperatorPrecedence::Order order) const;
   Expression *diff() const;
   virtual Expression *TrySimplifyAdding(Expression *right);
@@ -157,11 +285,18 @@ class Multiplication: public CommutativeOperators {
 class Division: public Expression {
   Expression *numerator, *denominator;
   bool simplifyChildren();
+  void computeStructure(size_t &hash, int &nodeCount, int &depth) const;
  public:
   Division(Expression *numerator, Expression *denominator);
+
+  const Expression *getNumerator() const { return numerator; }
+
+  const Expression *getDenominator() const { return denominator; }
+
   bool CanonicalEqualToSameType(Expression *other);
   bool CanonicalSmallerThanSameType(Expression *other);
   double operator()(double x) const;
+  Dual operator()(const Dual &x) const;
   void recursivePrint(std::string &output, OperatorPrecedence::Order order) const;
   Expression *diff() const;
   Expression *clone() const;
@@ -179,8 +314,14 @@ class Division: public Expression {
 
 class Composition: public Expression {
   Expression *left, *right;
+  void computeStructure(size_t &hash, int &nodeCount, int &depth) const;
  public:
   Composition(Expression *left, Expression *right);
+
+  const Expression *getLeft() const { return left; }
+
+  const Expression *getRight() const { return right; }
+
   bool CanonicalEqualToSameType(Expression *other);
   bool CanonicalSmallerThanSameType(Expression *other);
 
@@ -188,6 +329,10 @@ class Composition: public Expression {
     return (*left)((*right)(x));
   }
 
+  Dual operator()(const Dual &x) const {
+    return (*left)((*right)(x));
+  }
+
   void recursivePrint(std::string &output, OperatorPrecedence::Order order) const;
   Expression *diff() const;
   Expression *clone() const;
@@ -210,6 +355,7 @@ class Composition: public Expression {
 
 class Constant: public Expression {
   double c;
+  void computeStructure(size_t &hash, int &nodeCount, int &depth) const;
  public:
   Constant(double c) : Expression(TypeConstant), c(c) {
   }
@@ -223,6 +369,10 @@ class Constant: public Expression {
     return c;
   }
 
+  Dual operator()(const Dual &x) const {
+    return Dual(c, 0);
+  }
+
   void recursivePrint(std::string &output, OperatorPrecedence::Order order) const;
 
   Expression *diff() const {
@@ -249,6 +399,11 @@ class Constant: public Expression {
 };
 
 class VariableX: public Expression {
+  void computeStructure(size_t &hash, int &nodeCount, int &depth) const {
+    hash = 0;
+    nodeCount = 1;
+    depth = 1;
+  }
  public:
   VariableX() : Expression(TypeVariable) { }
 
@@ -258,6 +413,8 @@ class VariableX: public Expression {
 
   double operator()(double x) const { return x; }
 
+  Dual operator()(const Dual &x) const { return x; }
+
   void recursivePrint(std::string &output, OperatorPrecedence::Order order) const {
     output.push_back('x');
   }
@@ -282,7 +439,8 @@ class VariableX: public Expression {
 };
 
 class Polynomial: public Expression {
-  std::vector<double> para;
+  std::vector<double, ArenaAllocator<double> > para;
+  void computeStructure(size_t &hash, int &nodeCount, int &depth) const;
  public:
   Polynomial(const std::vector<double> &parametre);
   Polynomial(double a, double b);
@@ -291,11 +449,14 @@ class Polynomial: public Expression {
   bool CanonicalEqualToSameType(Expression *other);
   bool CanonicalSmallerThanSameType(Expression *other);
   double operator()(double x) const;
+  Dual operator()(const Dual &x) const;
   void recursivePrint(std::string &output, OperatorPrecedence::Order order) const;
   Expression *diff() const;
   Expression *clone() const;
 
-  std::vector<double> getParameter() const { return para; }
+  std::vector<double> getParameter() const {
+    return std::vector<double>(para.begin(), para.end());
+  }
 
   virtual Expression *TrySimplifyAdding(Expression *right);
   virtual Expression *TrySimplifyMultiplying(Expression *right);
@@ -314,6 +475,12 @@ class Polynomial: public Expression {
 };
 
 class ElementryFunction: public Expression {
+ protected:
+  void computeStructure(size_t &hash, int &nodeCount, int &depth) const {
+    hash = 0;
+    nodeCount = 1;
+    depth = 1;
+  }
  public:
   ElementryFunction(NodeType type) : Expression(type) {
   }
@@ -331,15 +498,23 @@ class Trigo: public ElementryFunction {
   };
  private:
   TrigoType trigoType;
+  void computeStructure(size_t &hash, int &nodeCount, int &depth) const {
+    hash = trigoType;
+    nodeCount = 1;
+    depth = 1;
+  }
  public:
   Trigo(TrigoType trigoType) : ElementryFunction(TypeTrigo), trigoType(trigoType) {
   }
 
+  TrigoType getTrigoType() const { return trigoType; }
+
   bool CanonicalEqualToSameType(Expression *other);
   bool CanonicalSmallerThanSameType(Expression *other);
   virtual Expression *diff() const;
   virtual Expression *clone() const;
   virtual double operator()(double x) const;
+  virtual Dual operator()(const Dual &x) const;
   std::string functionName() const;
 
   virtual Expression *TrySimplifyAdding(Expression *right) { return NULL; }
@@ -374,6 +549,7 @@ class Logarithm: public ElementryFunction {
   virtual Expression *diff() const;
   virtual Expression *clone() const;
   virtual double operator()(double x) const;
+  virtual Dual operator()(const Dual &x) const;
   std::string functionName() const;
   virtual Expression *TrySimplifyAdding(Expression *right);
   virtual Expression *TrySimplifyMultiplying(Expression *right);
@@ -402,6 +578,7 @@ class Exponential: public ElementryFunction {
   virtual Expression *diff() const;
   virtual Expression *clone() const;
   virtual double operator()(double x) const;
+  virtual Dual operator()(const Dual &x) const;
   std::string functionName() const;
   virtual Expression *TrySimplifyAdding(Expression *right);
   virtual Expression *TrySimplifyMultiplying(Expression *right);
@@ -1,6 +1,10 @@
 #include <cmath>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
 #include "catch.hpp"
 #include "function.h"
 #include "ExpressionEvaluator.h"
@@ -242,4 +246,231 @@ TEST_CASE("Diff") {
   delete e1;
   delete d;
 
-}
\ No newline at end of file
+}
+
+TEST_CASE("Dual numbers") {
+  ExpressionEvaluator evaluator;
+  const char *corpus[] = {
+      "1", "x", "2-x", "x+x*x", "2*x*x*x-x/3", "x*sin(x)", "sin(x)/x", "log(x)", "exp(x)",
+      "tan(x)", "cos(x)*exp(x)", "sin(cos(x))", "exp(sin(x)*x)-log(x+2)",
+      "(2/x)/(sin(x)/exp(x))", "tan(x*x)/(1+x*x)"
+  };
+  for (auto s : corpus) {
+    Expression *e = evaluator.evaluate(s);
+    Expression *d = e->diffSimplify();
+    for (double x = 0.15; x < 3; x += 0.35) {
+      Dual fx = (*e)(Dual(x, 1));
+      REQUIRE(fx.value == (*e)(x));
+      REQUIRE(fx.derivative == Approx((*d)(x)));
+    }
+    delete e;
+    delete d;
+  }
+  // chain rule through a non elementary composition, (1+2x+3x^2) o sin
+  vector<double> a;
+  a.push_back(1);
+  a.push_back(2);
+  a.push_back(3);
+  Expression *c = new Composition(new Polynomial(a), new Trigo(Trigo::Sin));
+  Dual y = (*c)(Dual(0.4, 1));
+  REQUIRE(y.derivative == Approx((2 + 6 * sin(0.4)) * cos(0.4)));
+  delete c;
+}
+
+TEST_CASE("ExpressionSet") {
+  ExpressionEvaluator evaluator;
+  const char *corpus[] = {
+      "1", "2", "x", "x*x", "x+x*x", "2*x*x*x-x/3", "x*sin(x)", "sin(x)/x", "x/sin(x)", "log(x)",
+      "exp(x)", "tan(x)", "cos(x)*exp(x)", "sin(cos(x))", "cos(sin(x))", "exp(sin(x)*x)-log(x+2)",
+      "(2/x)/(sin(x)/exp(x))", "tan(x*x)/(1+x*x)", "sin(x)/x"
+  };
+  vector<Expression *> all;
+  for (auto s : corpus)
+    all.push_back(evaluator.evaluate(s));
+  // the comparator is a strict weak ordering, equivalence being equality
+  ExpressionComparator smaller;
+  for (auto a : all) {
+    for (auto b : all) {
+      REQUIRE(!(smaller(a, b) && smaller(b, a)));
+      REQUIRE((!smaller(a, b) && !smaller(b, a)) == a->CanonicalEqualTo(b));
+    }
+  }
+  ExpressionSet set;
+  for (auto e : all)
+    set.insert(e);
+  REQUIRE(set.size() == all.size());
+  for (auto it = set.begin(); it + 1 != set.end(); it++)
+    REQUIRE(!smaller(*(it + 1), *it));
+  ExpressionSet copy = set;
+  copy.erase(copy.begin() + 3);
+  REQUIRE(copy.size() == set.size() - 1);
+  copy.insert(set[3]);
+  for (size_t k = 0; k < set.size(); k++)
+    REQUIRE(copy[k]->CanonicalEqualTo(set[k]));
+  // batch re-sort after replacing in place
+  std::reverse(copy.begin(), copy.end());
+  copy.sort();
+  for (size_t k = 0; k < set.size(); k++)
+    REQUIRE(copy[k]->CanonicalEqualTo(set[k]));
+  for (auto e : all)
+    delete e;
+}
+
+TEST_CASE("Simplify hands over the surviving subtree") {
+  ExpressionEvaluator evaluator;
+  // a quotient, sums and products would be flattened into the parent
+  Expression *s = evaluator.evaluate("exp(x*x)/sin(x)");
+  unique_ptr<Expression> r = Expression::simplified(
+      unique_ptr<Expression>(new Addition(new Constant(0), s)));
+  REQUIRE(r.get() == s);
+  r.release();
+  r = Expression::simplified(unique_ptr<Expression>(new Multiplication(s, new Constant(1))));
+  REQUIRE(r.get() == s);
+  r.release();
+  r = Expression::simplified(unique_ptr<Expression>(new Division(s, new Constant(1))));
+  REQUIRE(r.get() == s);
+  r.release();
+  r = Expression::simplified(unique_ptr<Expression>(new Composition(s, new VariableX)));
+  REQUIRE(r.get() == s);
+  // not collapsing, the root itself comes back
+  Expression *sum = new Addition(s, new Trigo(Trigo::Cos));
+  r.release();
+  r = Expression::simplified(unique_ptr<Expression>(sum));
+  REQUIRE(r.get() == sum);
+  REQUIRE(r->stringPrint() == "exp(x*x)/sin(x)+cos(x)");
+}
+
+TEST_CASE("Like terms") {
+  ExpressionEvaluator evaluator;
+  const char *cases[][2] = {
+      {"2*sin(x)+x+3*sin(x)+1+x*x-5*sin(x)", "Poly[1+x+x^2]"},
+      {"sin(x)*exp(x)*2+cos(x)+exp(x)*sin(x)-cos(x)*3", "-2*cos(x)+3*sin(x)*exp(x)"},
+      {"x/sin(x)+1/sin(x)+2*(x/sin(x))", "Poly[1+3x]/sin(x)"},
+      {"1+x-1-x", "0"}
+  };
+  for (auto c : cases) {
+    Expression *e = evaluator.evaluate(c[0]);
+    REQUIRE(e->stringPrint() == c[1]);
+    delete e;
+  }
+  // a wide sum with few distinct factors
+  ExpressionSet terms;
+  for (int k = 0; k < 300; k++) {
+    Expression *f = new Composition(new Trigo(Trigo::Sin), new Polynomial(k % 3 + 1, 0));
+    terms.insert(new Multiplication(new Constant(k % 2 ? 1 : -2), f));
+    terms.insert(new Polynomial(1, k));
+  }
+  unique_ptr<Expression> sum = Expression::simplified(unique_ptr<Expression>(new Addition(terms)));
+  REQUIRE(sum->nodeType() == Expression::TypeAdd);
+  REQUIRE(sum->stringPrint() == "-50*(sin(Poly[x])+sin(Poly[2x])+sin(Poly[3x]))+Poly[44850+300x]");
+  double x = 0.3;
+  double expected = 300 * x + 299 * 300 / 2;
+  for (int k = 0; k < 300; k++)
+    expected += (k % 2 ? 1 : -2) * sin((k % 3 + 1) * x);
+  REQUIRE((*sum)(x) == Approx(expected));
+}
+
+TEST_CASE("Simplify reaches the normal form in one call") {
+  ExpressionEvaluator evaluator;
+  const char *corpus[] = {
+      "((1/x)/x)/(x/(1/x))", "(2/x)/(sin(x)/exp(x))", "1/x/-x/x/x/x", "sin(x)/x+cos(x)/x",
+      "(x/(1/(x/(1/x))))*sin(x)", "2*x*x+3*x-(x/2)/(1/x)"
+  };
+  for (auto s : corpus) {
+    Expression *e = evaluator.evaluate(s);
+    string printed = e->stringPrint();
+    bool changed = true;
+    REQUIRE(e->simplify(changed) == NULL);
+    REQUIRE(!changed);
+    REQUIRE(e->stringPrint() == printed);
+    delete e;
+  }
+}
+
+TEST_CASE("Simplify keeps the value") {
+  ExpressionEvaluator evaluator;
+  Expression *e = evaluator.evaluate("2*0.5");
+  REQUIRE(e->stringPrint() == "1");
+  delete e;
+  e = evaluator.evaluate("3--1");
+  REQUIRE((*e)(0) == Approx(4));
+  delete e;
+  e = evaluator.evaluate("1/x");
+  Expression *d = e->diffSimplify();
+  REQUIRE((*d)(2) == Approx(-0.25));
+  delete d;
+  delete e;
+}
+
+TEST_CASE("Simplify merges the terms of wide sums") {
+  ExpressionEvaluator evaluator;
+  Expression *e = evaluator.evaluate("sin(x)/x+cos(x)/x+exp(x)+2*sin(x)*cos(x)+3*sin(x)+x+x*x"
+                                     "+tan(x)+log(x)+1/(x+1)+5/(x+1)+exp(x)*tan(x)");
+  string printed = e->stringPrint();
+  REQUIRE(printed.find("(sin(x)+cos(x))/x") != string::npos);
+  REQUIRE(printed.find("6/Poly[1+x]") != string::npos);
+  REQUIRE(printed.find("(1+exp(x))*tan(x)") != string::npos);
+  double x = 0.7;
+  REQUIRE((*e)(x) == Approx(sin(x) / x + cos(x) / x + exp(x) + 2 * sin(x) * cos(x) + 3 * sin(x) + x
+                            + x * x + tan(x) + log(x) + 6 / (x + 1) + exp(x) * tan(x)));
+  delete e;
+
+  // sin(k*x) for k = 1..2000, and sin(5*x) once more
+  ExpressionSet terms;
+  double expected = sin(1.5);
+  for (int k = 1; k <= 2000; k++) {
+    terms.insert(new Composition(new Trigo(Trigo::Sin), new Polynomial(k, 0)));
+    expected += sin(0.3 * k);
+  }
+  terms.insert(new Composition(new Trigo(Trigo::Sin), new Polynomial(5, 0)));
+  unique_ptr<Expression> sum = Expression::simplified(unique_ptr<Expression>(new Addition(terms)));
+  REQUIRE(sum->nodeType() == Expression::TypeAdd);
+  REQUIRE(static_cast<Addition *>(sum.get())->getChildren().size() == 2000);
+  REQUIRE((*sum)(0.3) == Approx(expected));
+}
+
+TEST_CASE("Tokenizer") {
+  ExpressionEvaluator evaluator;
+  const vector<Symbol> &symbols = evaluator.tokenize("-2.5e1*sin(x)+ .125");
+  REQUIRE(symbols.size() == 9);
+  REQUIRE(symbols[0].type == Symbol::Negative);
+  REQUIRE(symbols[1].type == Symbol::Number);
+  REQUIRE(symbols[1].number == 25);
+  REQUIRE(symbols[3].type == Symbol::FunName);
+  REQUIRE(symbols[3].funName == Sin);
+  REQUIRE(symbols[7].type == Symbol::Add);
+  REQUIRE(symbols[8].number == 0.125);
+  // the numbers are rounded like strtod
+  const char *numbers[] = {
+      "0.1", "3.14159", "1e-3", "123456789.987654321", "0.000000000000000000001234",
+      "9007199254740993", "1.7976931348623157e308", "4.9e-324", "12345678901234567890123"
+  };
+  for (auto s : numbers) {
+    REQUIRE(evaluator.tokenize(s).size() == 1);
+    REQUIRE(evaluator.tokenize(s)[0].number == strtod(s, NULL));
+  }
+  REQUIRE_THROWS_AS(evaluator.tokenize("."), invalid_argument);
+  REQUIRE_THROWS_AS(evaluator.tokenize("sinh(x)"), invalid_argument);
+  REQUIRE_THROWS_AS(evaluator.tokenize("x#2"), invalid_argument);
+  REQUIRE_THROWS_AS(evaluator.evaluate("sin"), invalid_argument);
+}
+
+TEST_CASE("Parser precedence and errors") {
+  ExpressionEvaluator evaluator;
+  const char *cases[] = {"8/2/2", "2-3-4", "-x*2+1", "2*-x/4", "1+2*3-4/2", "-(1+x)*3", "--x",
+                         "+x-+x*2", "sin(x)*2-cos(x+1)/3", "exp(-x)*log(2+x)"};
+  double expected[] = {2, -5, -0.4, -0.35, 5, -5.1, 0.7, -0.7,
+                       2 * sin(0.7) - cos(1.7) / 3, exp(-0.7) * log(2.7)};
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    Expression *e = evaluator.evaluate(cases[i]);
+    REQUIRE((*e)(0.7) == Approx(expected[i]));
+    delete e;
+  }
+  const char *invalid[] = {"(x", "x)", "2 x", "x^2", "x+", "*x", "sin x", "()", "sin(x"};
+  for (auto s : invalid)
+    REQUIRE_THROWS_AS(evaluator.evaluate(s), invalid_argument);
+  // the evaluator is still usable after an error
+  Expression *e = evaluator.evaluate("x*x");
+  REQUIRE(e->stringPrint() == "Poly[x^2]");
+  delete e;
+}
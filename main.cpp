@@ -2,20 +2,21 @@
 #include <cmath>
 #include "function.h"
 #include "ExpressionEvaluator.h"
+#include "ExpressionArena.h"
 
 using namespace std;
 
 double newtonMethod(Expression *f, double x0, double target) {
-  Expression *df = f->diffSimplify();
   double xn = x0;
   double lastXn;
   for (int iter = 0; iter < 100; iter++) {
     lastXn = xn;
-    xn = xn + (target - (*f)(xn)) / (*df)(xn);
+    // f(xn) and f'(xn) in one pass
+    Dual fx = (*f)(Dual(xn, 1));
+    xn = xn + (target - fx.value) / fx.derivative;
     if (abs(lastXn - xn) < 1e-10)
       break;
   }
-  delete df;
   return xn;
 }
 double solve(std::string equation, double x0, double target) {
@@ -26,6 +27,7 @@ double solve(std::string equation, double x0, double target) {
   cout << e1->stringPrint() << "==" << target << ", x=" << answer <<
       "\tverify:" << e1->stringPrint() << ", x=" << answer << ", =" << (*e1)(answer) << endl;
   delete e1;
+  return answer;
 }
 void simplifyTest(std::string expression) {
   ExpressionEvaluator evaluator;
@@ -43,11 +45,15 @@ void simplifyTest(std::string expression) {
   delete dfsimple;
 }
 int main() {
+  // every tree below is freed at once by the resets
+  ExpressionArena arena;
+  ExpressionArena::Scope scope(arena);
   cout << "simplify test:" << endl << endl;
   simplifyTest("x*x");
   simplifyTest("x*x*sin(x)");
   simplifyTest("sin(x)/x+cos(x)/x");
   simplifyTest("sin(cos(x))");
+  arena.reset();
 
   cout << endl << "newton method test:" << endl << endl;
   solve("x*x*x", 10, 27);
@@ -55,5 +61,6 @@ int main() {
   solve("sin(x)", 0.1, 1);
   solve("cos(x)", 0.5, 0);
   solve("sin(x)/x+cos(x)*x/3", 0.5, 0);
+  arena.reset();
   return 0;
 }